@@ -0,0 +1,307 @@
+/*
+ * quote_bench.c -- micro benchmark for the quoting of literal values
+ *
+ *
+ * see bench/README for details
+ *
+ * Compares the old character loop of do_quote_literal() (with and
+ * without the pg_mblen() call of the MULTIBYTE version) with the word at
+ * a time scan used by table_log.c now, on ASCII and on UTF-8 input.
+ * Stand alone, it does not need the PostgreSQL headers:
+ *
+ *   cc -O2 -o quote_bench bench/quote_bench.c && ./quote_bench
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+
+typedef uint64_t uint64;
+
+/* just enough of StringInfo */
+typedef struct StringInfoData
+{
+	char       *data;
+	size_t      len;
+	size_t      maxlen;
+} StringInfoData;
+
+typedef StringInfoData *StringInfo;
+
+static void initStringInfo(StringInfo str)
+{
+	str->maxlen = 1024;
+	str->data = malloc(str->maxlen);
+	str->len = 0;
+	str->data[0] = '\0';
+}
+
+static void enlargeStringInfo(StringInfo str, size_t needed)
+{
+	needed += str->len + 1;
+	if (needed <= str->maxlen)
+		return;
+	while (str->maxlen < needed)
+		str->maxlen *= 2;
+	str->data = realloc(str->data, str->maxlen);
+}
+
+static void appendBinaryStringInfo(StringInfo str, const char *data, size_t datalen)
+{
+	enlargeStringInfo(str, datalen);
+	memcpy(str->data + str->len, data, datalen);
+	str->len += datalen;
+	str->data[str->len] = '\0';
+}
+
+static void appendStringInfoChar(StringInfo str, char ch)
+{
+	if (str->len + 1 >= str->maxlen)
+		enlargeStringInfo(str, 1);
+	str->data[str->len++] = ch;
+	str->data[str->len] = '\0';
+}
+
+/* pg_mblen() for UTF-8 */
+static int pg_mblen(const char *s)
+{
+	unsigned char c = (unsigned char) *s;
+
+	if ((c & 0x80) == 0)
+		return 1;
+	if ((c & 0xe0) == 0xc0)
+		return 2;
+	if ((c & 0xf0) == 0xe0)
+		return 3;
+	if ((c & 0xf8) == 0xf0)
+		return 4;
+	return 1;
+}
+
+/* the old implementation, without MULTIBYTE */
+static char *old_quote_literal(char *lptr)
+{
+	char    *result;
+	char    *result_return;
+	int     len;
+
+	len           = strlen(lptr);
+	result        = (char *) malloc(len * 2 + 3);
+	result_return = result;
+	*result++     = '\'';
+
+	while (len-- > 0)
+	{
+		if (*lptr == '\'')
+			*result++ = '\\';
+		if (*lptr == '\\')
+			*result++ = '\\';
+		*result++ = *lptr++;
+	}
+
+	*result++ = '\'';
+	*result++ = '\0';
+
+	return result_return;
+}
+
+/* the old implementation, MULTIBYTE version */
+static char *old_quote_literal_mb(char *lptr)
+{
+	char    *result;
+	char    *result_return;
+	int     len;
+	int     wl;
+
+	len           = strlen(lptr);
+	result        = (char *) malloc(len * 2 + 3);
+	result_return = result;
+	*result++     = '\'';
+
+	while (len > 0)
+	{
+		if ((wl = pg_mblen(lptr)) != 1)
+		{
+			len -= wl;
+			while (wl-- > 0)
+				*result++ = *lptr++;
+			continue;
+		}
+
+		if (*lptr == '\'')
+			*result++ = '\\';
+		if (*lptr == '\\')
+			*result++ = '\\';
+		*result++ = *lptr++;
+		len--;
+	}
+	*result++ = '\'';
+	*result++ = '\0';
+
+	return result_return;
+}
+
+/* the new implementation, as in table_log.c */
+#define TABLE_LOG_WORD_ONES   0x0101010101010101ULL
+#define TABLE_LOG_WORD_HIGHS  0x8080808080808080ULL
+
+static inline const char *find_special(const char *ptr, const char *end, char c1, char c2)
+{
+	uint64     mask1 = TABLE_LOG_WORD_ONES * (unsigned char) c1;
+	uint64     mask2 = TABLE_LOG_WORD_ONES * (unsigned char) c2;
+
+	while (end - ptr >= (ptrdiff_t) sizeof(uint64))
+	{
+		uint64     word;
+		uint64     x1;
+		uint64     x2;
+
+		memcpy(&word, ptr, sizeof(uint64));
+		x1 = word ^ mask1;
+		x2 = word ^ mask2;
+		if ((((x1 - TABLE_LOG_WORD_ONES) & ~x1) | ((x2 - TABLE_LOG_WORD_ONES) & ~x2)) & TABLE_LOG_WORD_HIGHS)
+			break;
+		ptr += sizeof(uint64);
+	}
+
+	while (ptr < end && *ptr != c1 && *ptr != c2)
+		ptr++;
+
+	return ptr;
+}
+
+static void append_literal(StringInfo buf, const char *str)
+{
+	size_t      len = strlen(str);
+	const char *end = str + len;
+	const char *ptr = str;
+	int         backslash = (strchr(str, '\\') != NULL);
+	char        other = (backslash ? '\\' : '\'');
+
+	enlargeStringInfo(buf, len + 3);
+	if (backslash)
+		appendStringInfoChar(buf, 'E');
+	appendStringInfoChar(buf, '\'');
+	while (ptr < end)
+	{
+		const char *special = find_special(ptr, end, '\'', other);
+
+		appendBinaryStringInfo(buf, ptr, special - ptr);
+		if (special == end)
+			break;
+		appendStringInfoChar(buf, *special);
+		appendStringInfoChar(buf, *special);
+		ptr = special + 1;
+	}
+	appendStringInfoChar(buf, '\'');
+}
+
+/* reference for the new output: quote_literal() of the server */
+static char *ref_quote_literal(const char *str)
+{
+	char       *result = malloc(strlen(str) * 2 + 4);
+	char       *r = result;
+	const char *s;
+
+	if (strchr(str, '\\') != NULL)
+		*r++ = 'E';
+	*r++ = '\'';
+	for (s = str; *s; s++)
+	{
+		if (*s == '\'' || *s == '\\')
+			*r++ = *s;
+		*r++ = *s;
+	}
+	*r++ = '\'';
+	*r = '\0';
+
+	return result;
+}
+
+/* a value of size bytes built from piece, with a quote every 4 kB */
+static char *make_input(const char *piece, size_t size)
+{
+	char       *s = malloc(size + 1);
+	size_t      plen = strlen(piece);
+	size_t      n = 0;
+
+	while (n + plen <= size)
+	{
+		memcpy(s + n, piece, plen);
+		n += plen;
+		if (n % 4096 < plen)
+			s[n - 1] = '\'';
+	}
+	s[n] = '\0';
+
+	return s;
+}
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void run(const char *name, const char *piece, size_t size, int loops)
+{
+	char       *input = make_input(piece, size);
+	char       *ref = ref_quote_literal(input);
+	StringInfoData buf;
+	double      t;
+	double      t_old, t_old_mb, t_new;
+	int         i;
+
+	initStringInfo(&buf);
+	append_literal(&buf, input);
+	if (strcmp(buf.data, ref) != 0)
+	{
+		fprintf(stderr, "%s: wrong result of the new implementation\n", name);
+		exit(1);
+	}
+
+	t = now_ms();
+	for (i = 0; i < loops; i++)
+		free(old_quote_literal(input));
+	t_old = now_ms() - t;
+
+	t = now_ms();
+	for (i = 0; i < loops; i++)
+		free(old_quote_literal_mb(input));
+	t_old_mb = now_ms() - t;
+
+	t = now_ms();
+	for (i = 0; i < loops; i++)
+	{
+		buf.len = 0;
+		append_literal(&buf, input);
+	}
+	t_new = now_ms() - t;
+
+	printf("%-10s %8zu bytes  old %8.1f MB/s  old MULTIBYTE %8.1f MB/s  new %8.1f MB/s\n",
+		   name, strlen(input),
+		   strlen(input) * (double) loops / 1048576.0 / (t_old / 1000.0),
+		   strlen(input) * (double) loops / 1048576.0 / (t_old_mb / 1000.0),
+		   strlen(input) * (double) loops / 1048576.0 / (t_new / 1000.0));
+
+	free(buf.data);
+	free(ref);
+	free(input);
+}
+
+int main(int argc, char **argv)
+{
+	int         loops = (argc > 1 ? atoi(argv[1]) : 2000);
+
+	run("ascii", "{\"id\": 12345, \"name\": \"some value\", \"tags\": [1, 2, 3]}, ", 100 * 1024, loops);
+	run("utf8", "{\"name\": \"Gr\xc3\xbc\xc3\x9f" "e \xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e\", \"path\": \"C:\\\\tmp\"}, ", 100 * 1024, loops);
+	run("ascii", "short value", 100, loops * 1000);
+
+	return 0;
+}
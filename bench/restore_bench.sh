@@ -0,0 +1,56 @@
+#!/bin/sh
+#
+# restore_bench.sh -- scaling benchmark for table_log_restore_table()
+#
+#
+# see bench/README for details
+#
+#
+
+SIZES=${SIZES:-"1000 10000 100000 1000000"}
+KEYS=${KEYS:-}
+DELETE_PCT=${DELETE_PCT:-10}
+TARGET=${TARGET:-0.5}
+OUT=${OUT:-restore_bench.csv}
+PSQL=${PSQL:-psql}
+
+BENCHDIR=`dirname "$0"`
+
+run_sql () {
+    $PSQL -X -q -A -t -v ON_ERROR_STOP=1 -c "$1"
+}
+
+set -e
+
+$PSQL -X -q -v ON_ERROR_STOP=1 -f "$BENCHDIR/restore_bench.sql" > /dev/null
+
+VERSION=`run_sql "SELECT extversion FROM pg_extension WHERE extname = 'table_log'"`
+
+if [ ! -f "$OUT" ]; then
+    echo "version,log_rows,keys,delete_pct,method,scope,wall_ms,peak_kb,statements" > "$OUT"
+fi
+
+for size in $SIZES; do
+    keys=${KEYS:-`expr $size / 100 + 1`}
+
+    rows=`run_sql "SELECT table_log_bench_generate($size, $keys, $DELETE_PCT)"`
+    ts=`run_sql "SELECT table_log_bench_target($TARGET)"`
+
+    for method in 0 1; do
+        for scope in full single; do
+            if [ "$scope" = "full" ]; then
+                pkey="NULL"
+            else
+                pkey="'1'"
+            fi
+
+            # every run needs its own backend, see table_log_bench_run()
+            result=`run_sql "SELECT table_log_bench_run($method, $pkey, '$ts')"`
+
+            echo "$VERSION,$rows,$keys,$DELETE_PCT,$method,$scope,$result" >> "$OUT"
+            echo "log_rows=$rows keys=$keys method=$method scope=$scope: $result"
+        done
+    done
+done
+
+run_sql "DROP TABLE bench_src; DROP TABLE bench_src_log" > /dev/null
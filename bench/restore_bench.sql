@@ -0,0 +1,176 @@
+--
+-- restore_bench.sql -- synthetic log generator and probes for the
+--                      table_log_restore_table() scaling benchmark
+--
+--
+-- see bench/README for details
+--
+--
+
+SET client_min_messages TO warning;
+
+--
+-- table_log_bench_generate(rows, keys, delete_pct)
+--
+-- Builds bench_src and bench_src_log from scratch. The log holds a
+-- consistent history of roughly <rows> entries spread over <keys>
+-- primary keys: every key starts with an INSERT, every following event
+-- is either an UPDATE (old + new entry) or, for <delete_pct> percent of
+-- the events, a DELETE immediately followed by a re-INSERT of the same
+-- key. Another <delete_pct> percent of the keys end with a final DELETE.
+-- bench_src holds the state after the last log entry, so method 0 and
+-- method 1 restores must produce the same result.
+--
+-- Returns the number of generated log entries.
+--
+CREATE OR REPLACE FUNCTION table_log_bench_generate(bigint, bigint, int) RETURNS bigint AS $$
+DECLARE
+    p_rows         ALIAS FOR $1;
+    p_keys         ALIAS FOR $2;
+    p_delete       ALIAS FOR $3;
+    events_per_key bigint;
+    n              bigint;
+BEGIN
+    IF p_keys < 1 OR p_rows < p_keys THEN
+        RAISE EXCEPTION 'table_log_bench_generate: need 1 <= keys <= rows';
+    END IF;
+
+    -- the initial INSERT writes one entry, every later event two
+    events_per_key := greatest(0, (p_rows / p_keys - 1) / 2);
+
+    DROP TABLE IF EXISTS bench_src;
+    DROP TABLE IF EXISTS bench_src_log;
+
+    CREATE TABLE bench_src (
+        id       BIGINT NOT NULL PRIMARY KEY,
+        payload  TEXT
+    );
+    CREATE TABLE bench_src_log (
+        id              BIGINT,
+        payload         TEXT,
+        trigger_mode    VARCHAR(10) NOT NULL,
+        trigger_tuple   VARCHAR(5) NOT NULL,
+        trigger_changed TIMESTAMPTZ NOT NULL,
+        trigger_id      BIGINT NOT NULL
+    );
+
+    WITH ev AS (
+        SELECT k, j,
+               CASE WHEN j = 0 THEN 'I'
+                    WHEN j > events_per_key THEN 'X'
+                    WHEN abs(hashtext(k || ':' || j)) % 100 < p_delete THEN 'D'
+                    ELSE 'U' END AS kind
+          FROM generate_series(1, p_keys) AS k,
+               generate_series(0, events_per_key + 1) AS j
+         WHERE j <= events_per_key
+            OR abs(hashtext(k || ':end')) % 100 < p_delete
+    ), img AS (
+        SELECT k, j, 0 AS sub, 'INSERT' AS mode, 'new' AS tuple,
+               md5(k || ':0') AS payload
+          FROM ev WHERE kind = 'I'
+        UNION ALL
+        SELECT k, j, 0, 'UPDATE', 'old', md5(k || ':' || (j - 1))
+          FROM ev WHERE kind = 'U'
+        UNION ALL
+        SELECT k, j, 1, 'UPDATE', 'new', md5(k || ':' || j)
+          FROM ev WHERE kind = 'U'
+        UNION ALL
+        SELECT k, j, 0, 'DELETE', 'old', md5(k || ':' || (j - 1))
+          FROM ev WHERE kind = 'D'
+        UNION ALL
+        SELECT k, j, 1, 'INSERT', 'new', md5(k || ':' || j)
+          FROM ev WHERE kind = 'D'
+        UNION ALL
+        SELECT k, j, 0, 'DELETE', 'old', md5(k || ':' || (j - 1))
+          FROM ev WHERE kind = 'X'
+    )
+    INSERT INTO bench_src_log
+    SELECT k, payload, mode, tuple,
+           '2000-01-01 00:00:00+00'::timestamptz
+               + (row_number() OVER w) * interval '1 millisecond',
+           row_number() OVER w
+      FROM img
+    WINDOW w AS (ORDER BY j, k, sub);
+
+    GET DIAGNOSTICS n = ROW_COUNT;
+
+    INSERT INTO bench_src
+    SELECT k, md5(k || ':' || events_per_key)
+      FROM generate_series(1, p_keys) AS k
+     WHERE abs(hashtext(k || ':end')) % 100 >= p_delete;
+
+    ALTER TABLE bench_src_log ADD PRIMARY KEY (trigger_id);
+    CREATE INDEX bench_src_log_changed ON bench_src_log (trigger_changed);
+    ANALYZE bench_src;
+    ANALYZE bench_src_log;
+
+    RETURN n;
+END;
+$$ LANGUAGE plpgsql;
+
+
+--
+-- table_log_bench_target(fraction)
+--
+-- Returns the trigger_changed timestamp found at <fraction> (0..1) of the
+-- generated history, used as restore target.
+--
+CREATE OR REPLACE FUNCTION table_log_bench_target(float8) RETURNS timestamptz AS $$
+    SELECT trigger_changed
+      FROM bench_src_log
+     ORDER BY trigger_id
+    OFFSET (SELECT greatest(floor(count(*) * least($1, 1))::bigint - 1, 0)
+              FROM bench_src_log)
+     LIMIT 1;
+$$ LANGUAGE sql;
+
+
+--
+-- table_log_bench_run(method, pkey, timestamp)
+--
+-- Runs one restore of bench_src and returns a CSV fragment:
+--   wall time (ms), peak backend memory (kB), replay statements
+--
+-- The peak memory is the VmHWM of the backend, read from /proc. This only
+-- works on Linux and for superusers, otherwise the field stays empty.
+-- Run every measurement in a fresh connection, VmHWM never goes down.
+--
+CREATE OR REPLACE FUNCTION table_log_bench_run(int, text, timestamptz) RETURNS text AS $$
+DECLARE
+    p_method  ALIAS FOR $1;
+    p_pkey    ALIAS FOR $2;
+    p_ts      ALIAS FOR $3;
+    t_start   timestamptz;
+    ms        numeric;
+    copied    bigint = 0;
+    written   bigint;
+    peak      text;
+BEGIN
+    DROP TABLE IF EXISTS bench_restore;
+
+    IF p_method = 1 THEN
+        -- rows copied from the live table are not replay statements
+        SELECT count(*) INTO copied FROM bench_src
+         WHERE p_pkey IS NULL OR id = p_pkey::bigint;
+    END IF;
+
+    t_start := clock_timestamp();
+    PERFORM table_log_restore_table('bench_src', 'id', 'bench_src_log',
+                                    'trigger_id', 'bench_restore', p_ts,
+                                    p_pkey, p_method, 0);
+    ms := round((extract(epoch FROM clock_timestamp() - t_start) * 1000)::numeric, 3);
+
+    SELECT n_tup_ins + n_tup_upd + n_tup_del - copied INTO written
+      FROM pg_stat_xact_user_tables
+     WHERE relname = 'bench_restore';
+
+    BEGIN
+        peak := substring(pg_read_file('/proc/' || pg_backend_pid() || '/status')
+                          FROM 'VmHWM:\s+([0-9]+) kB');
+    EXCEPTION WHEN OTHERS THEN
+        peak := '';
+    END;
+
+    RETURN ms || ',' || coalesce(peak, '') || ',' || coalesce(written, 0);
+END;
+$$ LANGUAGE plpgsql;
@@ -0,0 +1,36 @@
+# A refresh of a restore table while a transaction which changes the
+# table is still running: its log entries have the start time of the
+# transaction as trigger_changed, before the timestamp of the refresh,
+# the next refresh has to apply them.
+
+setup
+{
+  SET client_min_messages TO warning;
+  CREATE EXTENSION table_log;
+  CREATE TABLE test(id integer PRIMARY KEY, name text);
+  SELECT table_log_init(4, 'public', 'test', 'public', 'test_log', ARRAY['txid']);
+  INSERT INTO test VALUES(1, 'joe');
+  INSERT INTO test VALUES(2, 'barney');
+}
+setup
+{
+  SELECT table_log_create_restore('test', 'id', 'test_log', 'trigger_id', 'test_refresh', clock_timestamp());
+}
+
+teardown
+{
+  SELECT table_log_drop_restore('test_refresh');
+  DROP TABLE test;
+  DROP TABLE test_log;
+  DROP EXTENSION table_log;
+}
+
+session s1
+step s1_update	{ BEGIN; UPDATE test SET name = 'betty' WHERE id = 2; }
+step s1_commit	{ COMMIT; }
+
+session s2
+step s2_refresh	{ SELECT table_log_refresh_restore('test_refresh', clock_timestamp()); }
+step s2_show	{ SELECT id, name FROM test_refresh ORDER BY id; }
+
+permutation s1_update s2_refresh s1_commit s2_refresh s2_show
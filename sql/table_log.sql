@@ -81,6 +81,453 @@ SELECT id, name, trigger_mode, trigger_tuple FROM test_log;
 DROP TABLE test;
 DROP TABLE test_log;
 
+-- ordering key without a shared sequence
+
+CREATE TABLE test(id integer, name text);
+ALTER TABLE test ADD PRIMARY KEY(id);
+SELECT table_log_init(5, 'public', 'test', 'public', 'test_log', ARRAY['local_id']);
+SELECT count(*) FROM pg_index i, pg_attribute a WHERE i.indrelid = 'test_log'::regclass AND a.attrelid = i.indrelid AND a.attname = 'trigger_id' AND i.indkey::text = a.attnum::text;
+INSERT INTO test VALUES(1, 'joe');
+INSERT INTO test VALUES(2, 'barney');
+INSERT INTO test VALUES(3, 'monica');
+UPDATE test SET name = 'veronica' WHERE id = 3;
+DELETE FROM test WHERE id = 1;
+SELECT id, name, trigger_mode, trigger_tuple FROM test_log ORDER BY trigger_id;
+SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover', NOW());
+SELECT id, name FROM test_recover ORDER BY id;
+DROP TABLE test;
+DROP TABLE test_log;
+DROP TABLE test_recover;
+
+-- rewind the table in place
+CREATE TABLE test(id integer, name text);
+ALTER TABLE test ADD PRIMARY KEY(id);
+SELECT table_log_init(5, 'test');
+INSERT INTO test VALUES(1, 'joe');
+INSERT INTO test VALUES(2, 'barney');
+INSERT INTO test VALUES(3, 'monica');
+CREATE TEMP TABLE rewind_point AS SELECT clock_timestamp() AS ts;
+UPDATE test SET name = 'veronica' WHERE id = 3;
+DELETE FROM test WHERE id = 1;
+INSERT INTO test VALUES(4, 'fred');
+SELECT table_log_rewind('test', (SELECT ts FROM rewind_point));
+SELECT id, name FROM test ORDER BY id;
+SELECT table_log_rewind('test', (SELECT ts FROM rewind_point));
+SELECT id, name FROM test ORDER BY id;
+DROP TABLE test;
+DROP TABLE test_log;
+DROP TABLE rewind_point;
+
+-- net changes between two timestamps
+CREATE TABLE test(id integer, name text);
+ALTER TABLE test ADD PRIMARY KEY(id);
+SELECT table_log_init(5, 'test');
+INSERT INTO test VALUES(1, 'joe');
+INSERT INTO test VALUES(2, 'barney');
+INSERT INTO test VALUES(3, 'monica');
+CREATE TEMP TABLE diff_points AS SELECT 't1'::text AS name, clock_timestamp() AS ts;
+UPDATE test SET name = 'veronica' WHERE id = 3;
+DELETE FROM test WHERE id = 1;
+INSERT INTO test VALUES(4, 'fred');
+INSERT INTO test VALUES(5, 'wilma');
+DELETE FROM test WHERE id = 5;
+UPDATE test SET name = 'betty' WHERE id = 2;
+UPDATE test SET name = 'barney' WHERE id = 2;
+INSERT INTO diff_points SELECT 't2', clock_timestamp();
+UPDATE test SET name = 'pebbles' WHERE id = 4;
+SELECT * FROM table_log_diff('test', (SELECT ts FROM diff_points WHERE name = 't1'), (SELECT ts FROM diff_points WHERE name = 't2')) ORDER BY pkey;
+DROP TABLE test;
+DROP TABLE test_log;
+DROP TABLE diff_points;
+
+-- change feed for downstream consumers
+CREATE TABLE test(id integer, name text);
+ALTER TABLE test ADD PRIMARY KEY(id);
+SELECT table_log_init(5, 'public', 'test', 'public', 'test_log', ARRAY['txid']);
+INSERT INTO test VALUES(1, 'joe');
+SELECT table_log_register_consumer('feed', 'test_log');
+INSERT INTO test VALUES(2, 'barney');
+UPDATE test SET name = 'betty' WHERE id = 2;
+INSERT INTO test VALUES(3, 'monica');
+SELECT trigger_mode, trigger_tuple, (log_row::test_log).id, (log_row::test_log).name FROM table_log_fetch('feed', 2);
+-- without ack the same batch is returned again
+SELECT trigger_mode, trigger_tuple, (log_row::test_log).id, (log_row::test_log).name FROM table_log_fetch('feed', 2);
+SELECT table_log_ack('feed');
+SELECT trigger_mode, trigger_tuple, (log_row::test_log).id, (log_row::test_log).name FROM table_log_fetch('feed', 10);
+SELECT table_log_ack('feed');
+SELECT trigger_mode, trigger_tuple, (log_row::test_log).id, (log_row::test_log).name FROM table_log_fetch('feed', 10);
+SELECT table_log_unregister_consumer('feed');
+DROP TABLE test;
+DROP TABLE test_log;
+
+-- shared log table for many tables
+CREATE TABLE test(id integer, name text);
+ALTER TABLE test ADD PRIMARY KEY(id);
+CREATE TABLE test2(id integer, amount numeric);
+ALTER TABLE test2 ADD PRIMARY KEY(id);
+SELECT table_log_init(4, 'public', 'test', 'public', 'shared_log', ARRAY['shared']);
+SELECT table_log_init(4, 'public', 'test2', 'public', 'shared_log', ARRAY['shared']);
+INSERT INTO test VALUES(1, 'joe');
+INSERT INTO test VALUES(2, 'barney');
+INSERT INTO test2 VALUES(1, 10.5);
+UPDATE test SET name = 'veronica' WHERE id = 2;
+DELETE FROM test WHERE id = 1;
+UPDATE test2 SET amount = 11 WHERE id = 1;
+SELECT trigger_relid::regclass, trigger_data, trigger_mode, trigger_tuple FROM shared_log ORDER BY trigger_id;
+SELECT table_log_restore_table('test', 'id', 'shared_log', 'trigger_id', 'test_recover', NOW());
+SELECT id, name FROM test_recover ORDER BY id;
+SELECT table_log_restore_table('test2', 'id', 'shared_log', 'trigger_id', 'test2_recover', NOW());
+SELECT id, amount FROM test2_recover ORDER BY id;
+SELECT table_log_rewind('test', '-infinity');
+SELECT count(*) FROM test;
+DROP TABLE test;
+DROP TABLE test2;
+DROP TABLE shared_log;
+DROP TABLE test_recover;
+DROP TABLE test2_recover;
+
+-- refreshable restore table, the log table needs trigger_txid
+CREATE TABLE test(id integer, name text);
+ALTER TABLE test ADD PRIMARY KEY(id);
+SELECT table_log_init(4, 'test');
+SELECT table_log_create_restore('test', 'id', 'test_log', 'trigger_id', 'test_refresh', now());
+DROP TABLE test;
+DROP TABLE test_log;
+CREATE TABLE test(id integer, name text);
+ALTER TABLE test ADD PRIMARY KEY(id);
+SELECT table_log_init(4, 'public', 'test', 'public', 'test_log', ARRAY['txid']);
+INSERT INTO test VALUES(1, 'joe');
+INSERT INTO test VALUES(2, 'barney');
+CREATE TEMP TABLE refresh_points AS SELECT 't1'::text AS name, clock_timestamp() AS ts;
+UPDATE test SET name = 'betty' WHERE id = 2;
+DELETE FROM test WHERE id = 1;
+INSERT INTO test VALUES(3, 'monica');
+INSERT INTO refresh_points SELECT 't2', clock_timestamp();
+SELECT table_log_create_restore('test', 'id', 'test_log', 'trigger_id', 'test_refresh', (SELECT ts FROM refresh_points WHERE name = 't1'));
+SELECT id, name FROM test_refresh ORDER BY id;
+SELECT table_log_refresh_restore('test_refresh', (SELECT ts FROM refresh_points WHERE name = 't2'));
+SELECT id, name FROM test_refresh ORDER BY id;
+SELECT restored_until = (SELECT ts FROM refresh_points WHERE name = 't2') FROM table_log_restore_state WHERE restore_table = 'test_refresh';
+SELECT table_log_refresh_restore('test_refresh', (SELECT ts FROM refresh_points WHERE name = 't2'));
+SELECT table_log_drop_restore('test_refresh');
+DROP TABLE test;
+DROP TABLE test_log;
+DROP TABLE refresh_points;
+
+-- restore job in a background worker
+CREATE TABLE test(id integer, name text);
+ALTER TABLE test ADD PRIMARY KEY(id);
+SELECT table_log_init(4, 'test');
+INSERT INTO test VALUES(1, 'joe');
+INSERT INTO test VALUES(2, 'barney');
+CREATE TEMP TABLE job_points AS SELECT clock_timestamp() AS ts;
+UPDATE test SET name = 'betty' WHERE id = 2;
+SELECT table_log_restore_submit('test', 'id', 'test_log', 'trigger_id', 'test_job', (SELECT ts FROM job_points)) AS job_id \gset
+DO $$
+BEGIN
+    FOR i IN 1 .. 300 LOOP
+        PERFORM 1 FROM table_log_job WHERE status IN ('queued', 'running');
+        EXIT WHEN NOT FOUND;
+        PERFORM pg_sleep(0.1);
+    END LOOP;
+END;
+$$;
+SELECT status, restore_table, log_rows_processed, method_used, error FROM table_log_restore_jobs WHERE job_id = :job_id;
+SELECT id, name FROM test_job ORDER BY id;
+SELECT table_log_restore_cancel(:job_id);
+DROP TABLE test_job;
+DROP TABLE test;
+DROP TABLE test_log;
+DROP TABLE job_points;
+DELETE FROM table_log_job;
+
+-- TRUNCATE
+CREATE TABLE test(id integer, name text);
+ALTER TABLE test ADD PRIMARY KEY(id);
+SELECT table_log_init(4, 'test');
+INSERT INTO test VALUES(1, 'joe');
+INSERT INTO test VALUES(2, 'barney');
+CREATE TEMP TABLE truncate_points AS SELECT clock_timestamp() AS ts;
+TRUNCATE test;
+INSERT INTO test VALUES(3, 'monica');
+SELECT id, name, trigger_mode, trigger_tuple FROM test_log ORDER BY trigger_id;
+SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover', now());
+SELECT id, name FROM test_recover ORDER BY id;
+SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover2', (SELECT ts FROM truncate_points), NULL, 1);
+SELECT id, name FROM test_recover2 ORDER BY id;
+DROP TABLE test_recover;
+DROP TABLE test_recover2;
+DROP TABLE test;
+DROP TABLE test_log;
+DROP TABLE truncate_points;
+
+-- automatic choice of the restore method
+CREATE TABLE test(id integer, name text);
+ALTER TABLE test ADD PRIMARY KEY(id);
+SELECT table_log_init(4, 'test');
+INSERT INTO test VALUES(1, 'joe');
+INSERT INTO test VALUES(2, 'barney');
+INSERT INTO test VALUES(3, 'monica');
+CREATE TEMP TABLE auto_points AS SELECT clock_timestamp() AS ts;
+UPDATE test SET name = 'betty' WHERE id = 2;
+-- the estimate uses the statistics, the tables are never counted
+ANALYZE test;
+ANALYZE test_log;
+SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover', (SELECT ts FROM auto_points), NULL, 2);
+SELECT id, name FROM test_recover ORDER BY id;
+DROP TABLE test_recover;
+SELECT DISTINCT method_used, est_log_before IS NOT NULL AS estimated FROM table_log_restore_table_timing('test', 'id', 'test_log', 'trigger_id', 'test_recover', (SELECT ts FROM auto_points), NULL, 2);
+DROP TABLE test_recover;
+DROP TABLE test;
+DROP TABLE test_log;
+DROP TABLE auto_points;
+
+-- restore cache
+CREATE TABLE test(id integer, name text);
+ALTER TABLE test ADD PRIMARY KEY(id);
+SELECT table_log_init(4, 'test');
+INSERT INTO test VALUES(1, 'joe');
+INSERT INTO test VALUES(2, 'barney');
+CREATE TEMP TABLE cache_points AS SELECT clock_timestamp() AS ts;
+UPDATE test SET name = 'betty' WHERE id = 2;
+SELECT table_log_restore_cached('test', 'id', 'test_log', 'trigger_id', (SELECT ts FROM cache_points)) AS cache_table \gset
+SELECT id, name FROM :cache_table ORDER BY id;
+SELECT table_log_restore_cached('test', 'id', 'test_log', 'trigger_id', (SELECT ts FROM cache_points)) = :'cache_table';
+SELECT hits FROM table_log_restore_cache;
+UPDATE test SET name = 'wilma' WHERE id = 2;
+SELECT table_log_restore_cached('test', 'id', 'test_log', 'trigger_id', (SELECT ts FROM cache_points)) = :'cache_table';
+SELECT count(*), sum(hits) FROM table_log_restore_cache;
+SELECT table_log_restore_cache_clear();
+SELECT count(*) FROM table_log_restore_cache;
+DROP TABLE test;
+DROP TABLE test_log;
+DROP TABLE cache_points;
+
+-- restore of many keys
+CREATE TABLE test(id integer, name text);
+ALTER TABLE test ADD PRIMARY KEY(id);
+SELECT table_log_init(4, 'test');
+INSERT INTO test VALUES(1, 'joe');
+INSERT INTO test VALUES(2, 'barney');
+INSERT INTO test VALUES(3, 'monica');
+INSERT INTO test VALUES(4, 'fred');
+CREATE TEMP TABLE keys_points AS SELECT clock_timestamp() AS ts;
+UPDATE test SET name = upper(name) WHERE id > 1;
+SELECT table_log_restore_table_keys('test', 'id', 'test_log', 'trigger_id', 'test_recover', (SELECT ts FROM keys_points), ARRAY['2', '3']);
+SELECT id, name FROM test_recover ORDER BY id;
+SELECT table_log_restore_table_where('test', 'id', 'test_log', 'trigger_id', 'test_recover2', (SELECT ts FROM keys_points), 'id > 2', 1);
+SELECT id, name FROM test_recover2 ORDER BY id;
+DROP TABLE test_recover;
+DROP TABLE test_recover2;
+DROP TABLE test;
+DROP TABLE test_log;
+DROP TABLE keys_points;
+
+-- bulk mode
+CREATE TABLE test(id integer, name text);
+ALTER TABLE test ADD PRIMARY KEY(id);
+SELECT table_log_init(4, 'test');
+INSERT INTO test VALUES(1, 'joe');
+INSERT INTO test VALUES(2, 'barney');
+INSERT INTO test VALUES(3, 'monica');
+CREATE TEMP TABLE bulk_points AS SELECT clock_timestamp() AS ts;
+SELECT table_log_begin_bulk('test');
+SELECT count(*) FROM pg_locks WHERE relation = 'test'::regclass AND mode = 'ShareRowExclusiveLock';
+UPDATE test SET name = upper(name);
+CREATE TEMP TABLE bulk_inside AS SELECT clock_timestamp() AS ts;
+DELETE FROM test WHERE id = 3;
+SELECT table_log_end_bulk('test');
+SELECT count(*) FROM pg_locks WHERE relation = 'test'::regclass AND mode = 'ShareRowExclusiveLock';
+SELECT count(*) FROM table_log_bulk WHERE relid = 'test'::regclass AND ended > started;
+SELECT trigger_mode, trigger_tuple, count(*) FROM test_log GROUP BY 1, 2 ORDER BY 1, 2;
+SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover', now());
+SELECT id, name FROM test_recover ORDER BY id;
+SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover2', (SELECT ts FROM bulk_points), NULL, 1);
+SELECT id, name FROM test_recover2 ORDER BY id;
+-- into the window: the rows of the 'old' snapshot, with both methods
+SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover3', (SELECT ts FROM bulk_inside), NULL, 0);
+SELECT id, name FROM test_recover3 ORDER BY id;
+SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover4', (SELECT ts FROM bulk_inside), NULL, 1);
+SELECT id, name FROM test_recover4 ORDER BY id;
+SELECT * FROM table_log_as_of(NULL::test, (SELECT ts FROM bulk_inside)) ORDER BY id;
+-- a rollback to a savepoint ends the bulk mode started in it
+BEGIN;
+SAVEPOINT before_bulk;
+SELECT table_log_begin_bulk('test');
+ROLLBACK TO SAVEPOINT before_bulk;
+UPDATE test SET name = 'fred' WHERE id = 1;
+COMMIT;
+SELECT count(*) FROM pg_locks WHERE relation = 'test'::regclass AND mode = 'ShareRowExclusiveLock';
+SELECT id, name, trigger_mode, trigger_tuple FROM test_log WHERE trigger_mode = 'UPDATE' ORDER BY trigger_id;
+DROP TABLE test_recover;
+DROP TABLE test_recover2;
+DROP TABLE test_recover3;
+DROP TABLE test_recover4;
+DROP TABLE test;
+DROP TABLE test_log;
+DROP TABLE bulk_points;
+DROP TABLE bulk_inside;
+
+-- log into striped child tables
+CREATE TABLE test(id integer, name text);
+ALTER TABLE test ADD PRIMARY KEY(id);
+SELECT table_log_init(5, 'public', 'test', 'public', 'test_log', ARRAY['partitions=2']);
+INSERT INTO test VALUES(1, 'joe');
+INSERT INTO test VALUES(2, 'barney');
+UPDATE test SET name = 'fred' WHERE id = 2;
+DELETE FROM test WHERE id = 1;
+SELECT count(*) FROM pg_inherits WHERE inhparent = 'test_log'::regclass;
+SELECT count(*) FROM ONLY test_log;
+SELECT id, name, trigger_mode, trigger_tuple FROM test_log ORDER BY trigger_id;
+SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover', NOW());
+SELECT id, name FROM test_recover ORDER BY id;
+DROP TABLE test;
+DROP TABLE test_log CASCADE;
+DROP TABLE test_recover;
+
+-- rows at a timestamp, without a restore table
+CREATE TABLE test(id integer, name text);
+ALTER TABLE test ADD PRIMARY KEY(id);
+SELECT table_log_init(5, 'test');
+INSERT INTO test VALUES(1, 'joe');
+INSERT INTO test VALUES(2, 'barney');
+INSERT INTO test VALUES(3, 'monica');
+CREATE TEMP TABLE as_of_point AS SELECT clock_timestamp() AS ts;
+UPDATE test SET name = 'veronica' WHERE id = 3;
+DELETE FROM test WHERE id = 1;
+INSERT INTO test VALUES(4, 'fred');
+SELECT * FROM table_log_as_of(NULL::test, (SELECT ts FROM as_of_point)) ORDER BY id;
+COPY (SELECT * FROM table_log_as_of(NULL::test, (SELECT ts FROM as_of_point)) ORDER BY id) TO STDOUT;
+DROP TABLE test;
+DROP TABLE test_log;
+
+-- log only the primary key
+CREATE TABLE test(id integer, name text);
+ALTER TABLE test ADD PRIMARY KEY(id);
+SELECT table_log_init(5, 'public', 'test', 'public', 'test_log', ARRAY['keys_only']);
+INSERT INTO test VALUES(1, 'joe');
+INSERT INTO test VALUES(2, 'barney');
+CREATE TEMP TABLE keys_point AS SELECT clock_timestamp() AS ts;
+UPDATE test SET name = 'fred' WHERE id = 2;
+DELETE FROM test WHERE id = 1;
+INSERT INTO test VALUES(3, 'monica');
+SELECT id, trigger_mode, trigger_tuple FROM test_log ORDER BY trigger_id;
+SELECT * FROM table_log_diff('test', (SELECT ts FROM keys_point), now()) ORDER BY pkey;
+SELECT table_log_rewind('test', (SELECT ts FROM keys_point));
+SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover', NOW());
+DROP TABLE test;
+DROP TABLE test_log;
+DROP TABLE keys_point;
+
+-- quoting of logged values
+CREATE TABLE test(id integer, name text);
+ALTER TABLE test ADD PRIMARY KEY(id);
+SELECT table_log_init(5, 'test');
+INSERT INTO test VALUES(1, 'it''s');
+INSERT INTO test VALUES(2, 'C:\tmp\');
+UPDATE test SET name = name || '''\''' WHERE id = 2;
+SELECT id, name, trigger_mode, trigger_tuple FROM test_log ORDER BY trigger_id;
+SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover', NOW());
+SELECT id, name FROM test_recover ORDER BY id;
+DROP TABLE test;
+DROP TABLE test_log;
+DROP TABLE test_recover;
+
+-- compact log table
+CREATE TABLE test(id integer, name text);
+ALTER TABLE test ADD PRIMARY KEY(id);
+SELECT table_log_init(5, 'public', 'test', 'public', 'test_log', ARRAY['compact']);
+INSERT INTO test VALUES(1, 'joe');
+INSERT INTO test VALUES(2, 'barney');
+CREATE TEMP TABLE compact_point AS SELECT clock_timestamp() AS ts;
+UPDATE test SET name = 'fred' WHERE id = 2;
+DELETE FROM test WHERE id = 1;
+SELECT id, name, trigger_op, table_log_op_mode(trigger_op), table_log_op_tuple(trigger_op),
+       trigger_user = (SELECT oid FROM pg_roles WHERE rolname = session_user) AS user_ok
+  FROM test_log ORDER BY trigger_id;
+SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover', (SELECT ts FROM compact_point));
+SELECT id, name FROM test_recover ORDER BY id;
+DROP TABLE test_recover;
+SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover', (SELECT ts FROM compact_point), NULL, 1);
+SELECT id, name FROM test_recover ORDER BY id;
+SELECT * FROM table_log_diff('test', (SELECT ts FROM compact_point), now()) ORDER BY pkey;
+DROP TABLE test;
+DROP TABLE test_log;
+DROP TABLE test_recover;
+DROP TABLE compact_point;
+
+-- coalesced changes
+CREATE TABLE test(id integer, name text);
+ALTER TABLE test ADD PRIMARY KEY(id);
+SELECT table_log_init(4, 'public', 'test', 'public', 'test_log', ARRAY['coalesce']);
+INSERT INTO test VALUES(1, 'joe');
+INSERT INTO test VALUES(2, 'barney');
+BEGIN;
+UPDATE test SET name = 'fred' WHERE id = 2;
+UPDATE test SET name = 'wilma' WHERE id = 2;
+INSERT INTO test VALUES(3, 'monica');
+DELETE FROM test WHERE id = 3;
+INSERT INTO test VALUES(4, 'betty');
+UPDATE test SET name = 'pebbles' WHERE id = 4;
+UPDATE test SET name = 'dino' WHERE id = 1;
+DELETE FROM test WHERE id = 1;
+SELECT count(*) FROM test_log;
+COMMIT;
+SELECT id, name, trigger_mode, trigger_tuple FROM test_log ORDER BY trigger_id;
+BEGIN;
+UPDATE test SET name = 'dino' WHERE id = 2;
+UPDATE test SET name = 'wilma' WHERE id = 2;
+COMMIT;
+SELECT count(*) FROM test_log;
+-- the cached primary key follows a change of the table
+ALTER TABLE test DROP CONSTRAINT test_pkey;
+UPDATE test SET name = 'fred' WHERE id = 2;
+ALTER TABLE test ADD PRIMARY KEY(id);
+SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover', NOW());
+SELECT id, name FROM test_recover ORDER BY id;
+DROP TABLE test;
+DROP TABLE test_log;
+DROP TABLE test_recover;
+
+-- log all tables of a schema
+CREATE SCHEMA test_schema;
+CREATE TABLE test_schema.a(id integer PRIMARY KEY, name text);
+CREATE TABLE test_schema.b(id integer PRIMARY KEY, name text);
+SELECT table_log_init_schema(4, 'test_schema', 'test_schema', NULL, NULL, 1);
+SELECT table_log_init_schema(4, 'test_schema', 'test_schema');
+SELECT table_log_init_schema(4, 'test_schema', 'test_schema');
+CREATE TABLE test_schema.c(id integer PRIMARY KEY, name text);
+SELECT table_log_init_schema(4, 'test_schema', 'test_schema');
+SELECT relname FROM pg_class WHERE relnamespace = 'test_schema'::regnamespace AND relkind = 'r' ORDER BY relname;
+INSERT INTO test_schema.c VALUES(1, 'joe');
+SELECT id, name, trigger_mode, trigger_tuple FROM test_schema.c_log;
+DROP TABLE test_schema.a, test_schema.a_log, test_schema.b, test_schema.b_log, test_schema.c, test_schema.c_log;
+DROP SCHEMA test_schema;
+
+-- archive old log entries
+CREATE TABLE test(id integer, name text);
+ALTER TABLE test ADD PRIMARY KEY(id);
+SELECT table_log_init(5, 'test');
+INSERT INTO test VALUES(1, 'joe');
+INSERT INTO test VALUES(2, 'barney');
+CREATE TEMP TABLE archive_point AS SELECT clock_timestamp() AS ts, current_setting('data_directory') || '/table_log_archive' AS dir;
+UPDATE test SET name = 'veronica' WHERE id = 2;
+SELECT table_log_archive('test_log', (SELECT ts FROM archive_point), (SELECT dir FROM archive_point));
+SELECT log_table, n_rows, file = (SELECT dir FROM archive_point) || '/table_log_' || 'test_log'::regclass::oid || '_' || segment_id || '.copy.gz' AS file_ok FROM table_log_archive_segment;
+SELECT id, name, trigger_mode, trigger_tuple FROM table_log_archive_read(NULL::test_log) ORDER BY trigger_id;
+SELECT count(*) FROM test_log;
+SELECT * FROM table_log_as_of(NULL::test, (SELECT ts FROM archive_point)) ORDER BY id;
+SELECT table_log_rewind('test', (SELECT ts FROM archive_point) - interval '1 hour');
+SELECT table_log_unarchive('test_log', (SELECT ts FROM archive_point) - interval '1 hour');
+SELECT count(*) FROM table_log_archive_segment;
+SELECT count(*) FROM test_log;
+SELECT table_log_rewind('test', (SELECT ts FROM archive_point) - interval '1 hour');
+SELECT id, name FROM test ORDER BY id;
+DO $$ BEGIN EXECUTE 'COPY (SELECT 1) TO PROGRAM ' || quote_literal('rm -rf ' || (SELECT dir FROM archive_point)); END $$;
+DROP TABLE test;
+DROP TABLE test_log;
+DROP TABLE archive_point;
+
 -- Check table_log_restore_table()
 
 CREATE TABLE test(id integer, name text);
@@ -94,10 +541,67 @@ DELETE FROM test WHERE id = 1;
 
 SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover', NOW(), '2', NULL::int, 1);
 SELECT id, name FROM test_recover;
+DROP TABLE test_recover;
+
+SELECT restore_table, phase FROM table_log_restore_table_timing('test', 'id', 'test_log', 'trigger_id', 'test_recover', NOW());
+SELECT id, name FROM test_recover ORDER BY id;
 
 DROP TABLE test;
 DROP TABLE test_log;
 DROP TABLE test_recover;
 
+-- statistics, table_log is in shared_preload_libraries (see table_log.conf)
+SELECT table_log_stats_reset();
+CREATE TABLE test(id integer PRIMARY KEY, name text);
+SELECT table_log_init(4, 'test');
+INSERT INTO test VALUES(1, 'joe');
+INSERT INTO test VALUES(2, 'barney');
+UPDATE test SET name = 'fred' WHERE id = 2;
+DELETE FROM test WHERE id = 1;
+SELECT rows_insert, rows_update, rows_delete, rows_skipped, bytes_logged > 0 AS logged, restores FROM table_log_stats WHERE relid = 'test'::regclass;
+SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover', NOW());
+SELECT restores FROM table_log_stats WHERE relid = 'test'::regclass;
+DROP TABLE test_recover;
+SELECT sum(changes) FROM table_log_change_rate WHERE relid = 'test'::regclass;
+-- the buckets are one second long (see table_log.conf), the next change goes into a new one
+SELECT table_log_stats_reset();
+SELECT count(*) FROM table_log_stats WHERE relid = 'test'::regclass;
+INSERT INTO test VALUES(3, 'monica');
+SELECT pg_sleep(1);
+UPDATE test SET name = 'betty' WHERE id = 3;
+SELECT count(*), sum(changes), max(bucket_start) - min(bucket_start) >= '1 second' AS rollover FROM table_log_change_rate WHERE relid = 'test'::regclass;
+-- hot keys: 16 slots, the 17th key replaces the key with the lowest count
+SELECT table_log_stats_reset();
+SET table_log.track_hot_keys = on;
+DO $$ BEGIN FOR i IN 1..4 LOOP UPDATE test SET name = 'wilma' WHERE id = 3; END LOOP; END $$;
+INSERT INTO test SELECT g, 'pebbles' FROM generate_series(10, 25) g;
+SELECT count(*), sum(changes) FROM table_log_hot_keys WHERE relid = 'test'::regclass;
+SELECT pkey, changes, error FROM table_log_hot_keys WHERE relid = 'test'::regclass ORDER BY changes DESC, pkey LIMIT 3;
+SELECT count(*) FROM table_log_hot_keys WHERE relid = 'test'::regclass AND pkey = '10';
+-- a new primary key is used from the next change on
+ALTER TABLE test DROP CONSTRAINT test_pkey;
+ALTER TABLE test ADD PRIMARY KEY(id, name);
+UPDATE test SET name = 'dino' WHERE id = 3;
+SELECT pkey, changes, error FROM table_log_hot_keys WHERE relid = 'test'::regclass AND pkey LIKE '(%';
+RESET table_log.track_hot_keys;
+-- table_log.stats_max is 100 (see table_log.conf), new tables replace the least active ones
+SELECT table_log_stats_reset();
+DO $$ BEGIN FOR i IN 1..4 LOOP UPDATE test SET name = 'joe' || i WHERE id = 3; END LOOP; END $$;
+CREATE SCHEMA test_stats;
+DO $$
+BEGIN
+    FOR i IN 1..150 LOOP
+        EXECUTE 'CREATE TABLE test_stats.t' || i || ' (id integer PRIMARY KEY)';
+        PERFORM table_log_init(4, 'test_stats', 't' || i, 'test_stats', 't' || i || '_log');
+        EXECUTE 'INSERT INTO test_stats.t' || i || ' VALUES (1)';
+    END LOOP;
+END $$;
+SELECT count(*) FROM table_log_stats WHERE dbid = (SELECT oid FROM pg_database WHERE datname = current_database());
+SELECT rows_update FROM table_log_stats WHERE relid = 'test'::regclass;
+SELECT count(*) FROM table_log_stats WHERE relid = 'test_stats.t150'::regclass;
+DROP SCHEMA test_stats CASCADE;
+DROP TABLE test;
+DROP TABLE test_log;
+
 RESET client_min_messages;
 
@@ -0,0 +1,29 @@
+-- table_log without shared_preload_libraries
+CREATE EXTENSION table_log;
+SET client_min_messages TO warning;
+
+-- logging and restore work without the shared memory
+CREATE TABLE test(id integer PRIMARY KEY, name text);
+SELECT table_log_init(4, 'test');
+SET table_log.track_hot_keys = on;
+INSERT INTO test VALUES(1, 'joe');
+INSERT INTO test VALUES(2, 'barney');
+UPDATE test SET name = 'fred' WHERE id = 2;
+SELECT id, name, trigger_mode, trigger_tuple FROM test_log ORDER BY trigger_id;
+SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover', NOW(), NULL, 2);
+SELECT id, name FROM test_recover ORDER BY id;
+SELECT DISTINCT method_used FROM table_log_restore_table_timing('test', 'id', 'test_log', 'trigger_id', 'test_recover2', NOW(), NULL, 1);
+RESET table_log.track_hot_keys;
+
+-- the statistics and the progress need it
+SELECT * FROM table_log_stats;
+SELECT table_log_stats_reset();
+SELECT * FROM table_log_hot_keys;
+SELECT * FROM table_log_change_rate;
+SELECT * FROM table_log_restore_progress;
+SHOW table_log.stats_max;
+
+DROP TABLE test;
+DROP TABLE test_log;
+DROP TABLE test_recover;
+DROP TABLE test_recover2;
@@ -0,0 +1,1284 @@
+--
+-- table_log () -- log changes to another table
+--
+--
+-- see README.table_log for details
+--
+--
+-- written by Andreas ' ads' Scherbaum (ads@pgug.de)
+--
+--
+
+-- create function
+
+CREATE FUNCTION table_log ()
+    RETURNS TRIGGER
+    AS 'MODULE_PATHNAME' LANGUAGE C;
+CREATE FUNCTION "table_log_restore_table" (VARCHAR, VARCHAR, CHAR, CHAR, CHAR, TIMESTAMPTZ, CHAR, INT, INT)
+    RETURNS VARCHAR
+    AS 'MODULE_PATHNAME', 'table_log_restore_table' LANGUAGE C;
+CREATE FUNCTION "table_log_restore_table" (VARCHAR, VARCHAR, CHAR, CHAR, CHAR, TIMESTAMPTZ, CHAR, INT)
+    RETURNS VARCHAR
+    AS 'MODULE_PATHNAME', 'table_log_restore_table' LANGUAGE C;
+CREATE FUNCTION "table_log_restore_table" (VARCHAR, VARCHAR, CHAR, CHAR, CHAR, TIMESTAMPTZ, CHAR)
+    RETURNS VARCHAR
+    AS 'MODULE_PATHNAME', 'table_log_restore_table' LANGUAGE C;
+CREATE FUNCTION "table_log_restore_table" (VARCHAR, VARCHAR, CHAR, CHAR, CHAR, TIMESTAMPTZ)
+    RETURNS VARCHAR
+    AS 'MODULE_PATHNAME', 'table_log_restore_table' LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION table_log_init(int, text, text, text, text, text[]) RETURNS void AS '
+DECLARE
+    level        ALIAS FOR $1;
+    orig_schema  ALIAS FOR $2;
+    orig_name    ALIAS FOR $3;
+    log_schema   ALIAS FOR $4;
+    log_name     ALIAS FOR $5;
+    log_options  ALIAS FOR $6;
+    do_log_user  int = 0;
+    level_create text = '''';
+    orig_qq      text;
+    log_qq       text;
+    opt          text;
+    use_local_id boolean = false;
+    use_txid     boolean = false;
+    use_shared   boolean = false;
+    trigger_opts text[] = ''{}'';
+    trigger_args text;
+    col          name;
+    n_partitions int = 0;
+    part_qq      text;
+    use_keys     boolean = false;
+    key_cols     text = '''';
+    col_type     text;
+    use_compact  boolean = false;
+    op_cols      text;
+    use_coalesce boolean = false;
+BEGIN
+    -- Quoted qualified names
+    orig_qq := quote_ident(orig_schema)||''.''||quote_ident(orig_name);
+    log_qq := quote_ident(log_schema)||''.''||quote_ident(log_name);
+
+    -- Log table options
+    FOREACH opt IN ARRAY coalesce(log_options, ''{}'') LOOP
+        IF opt = ''local_id'' THEN
+            use_local_id := true;
+        ELSIF opt = ''txid'' THEN
+            use_txid := true;
+        ELSIF opt = ''shared'' THEN
+            use_shared := true;
+            trigger_opts := trigger_opts || opt;
+        ELSIF opt = ''keys_only'' THEN
+            use_keys := true;
+            trigger_opts := trigger_opts || opt;
+        ELSIF opt = ''compact'' THEN
+            use_compact := true;
+            trigger_opts := trigger_opts || opt;
+        ELSIF opt = ''coalesce'' THEN
+            use_coalesce := true;
+            trigger_opts := trigger_opts || opt;
+        ELSIF opt ~ ''^partitions=[0-9]+$'' THEN
+            n_partitions := substr(opt, 12)::int;
+            IF n_partitions < 1 THEN
+                RAISE EXCEPTION
+                    ''table_log_init: option partitions needs at least 1 partition.'';
+            END IF;
+            trigger_opts := trigger_opts || opt;
+        ELSE
+            RAISE EXCEPTION
+                ''table_log_init: unknown option "%"'', opt;
+        END IF;
+    END LOOP;
+
+    IF level <> 3 THEN
+        IF use_local_id THEN
+            level_create := level_create
+                ||'', trigger_id BIGINT NOT NULL DEFAULT table_log_local_id()'';
+        ELSE
+            level_create := level_create
+                ||'', trigger_id BIGSERIAL NOT NULL PRIMARY KEY'';
+        END IF;
+        IF use_txid THEN
+            level_create := level_create
+                ||'', trigger_txid BIGINT NOT NULL DEFAULT txid_current()'';
+        END IF;
+        IF level <> 4 THEN
+            IF use_compact THEN
+                -- the oid of the role instead of its name
+                level_create := level_create
+                    ||'', trigger_user OID NOT NULL'';
+            ELSE
+                level_create := level_create
+                    ||'', trigger_user VARCHAR(32) NOT NULL'';
+            END IF;
+            do_log_user := 1;
+            IF level <> 5 THEN
+                RAISE EXCEPTION
+                    ''table_log_init: First arg has to be 3, 4 or 5.'';
+            END IF;
+        END IF;
+    ELSIF use_local_id OR use_txid OR use_shared OR n_partitions > 0 THEN
+        RAISE EXCEPTION
+            ''table_log_init: options local_id, txid, shared and partitions need level 4 or 5.'';
+    END IF;
+
+    IF use_shared AND n_partitions > 0 THEN
+        RAISE EXCEPTION
+            ''table_log_init: options shared and partitions cannot be combined.'';
+    END IF;
+
+    IF use_local_id THEN
+        -- fails if the server has more backends than the key has room for
+        PERFORM table_log_local_id();
+    END IF;
+
+    IF use_compact THEN
+        IF use_shared THEN
+            RAISE EXCEPTION
+                ''table_log_init: options shared and compact cannot be combined.'';
+        END IF;
+        -- mode and tuple in one byte, see table_log_op_mode()
+        op_cols := ''trigger_op "char" NOT NULL'';
+    ELSE
+        op_cols := ''trigger_mode VARCHAR(10) NOT NULL''
+            ||'', trigger_tuple VARCHAR(5) NOT NULL'';
+    END IF;
+
+    IF use_keys THEN
+        IF use_shared THEN
+            RAISE EXCEPTION
+                ''table_log_init: options shared and keys_only cannot be combined.'';
+        END IF;
+
+        -- only the primary key columns, nullable for the TRUNCATE marker
+        FOR col, col_type IN SELECT a.attname, format_type(a.atttypid, a.atttypmod)
+                               FROM pg_index i, pg_attribute a
+                              WHERE i.indrelid = orig_qq::regclass AND i.indisprimary
+                                AND a.attrelid = i.indrelid AND a.attnum = ANY (i.indkey)
+                              ORDER BY a.attnum LOOP
+            key_cols := key_cols||quote_ident(col)||'' ''||col_type||'', '';
+        END LOOP;
+        IF key_cols = '''' THEN
+            RAISE EXCEPTION
+                ''table_log_init: option keys_only needs a primary key on %'', orig_qq;
+        END IF;
+    END IF;
+
+    IF use_coalesce THEN
+        -- the changed rows are identified by the primary key
+        PERFORM 1 FROM pg_index
+          WHERE indrelid = orig_qq::regclass AND indisprimary;
+        IF NOT FOUND THEN
+            RAISE EXCEPTION
+                ''table_log_init: option coalesce needs a primary key on %'', orig_qq;
+        END IF;
+    END IF;
+
+    IF use_shared THEN
+        -- one log table for many tables, created by the first of them
+        PERFORM 1 FROM pg_class c, pg_namespace n
+          WHERE c.relnamespace = n.oid
+            AND n.nspname = log_schema AND c.relname = log_name;
+        IF NOT FOUND THEN
+            EXECUTE ''CREATE TABLE ''||log_qq
+                  ||''(trigger_relid OID NOT NULL''
+                  ||'', trigger_data TEXT''
+                  ||'', trigger_mode VARCHAR(10) NOT NULL''
+                  ||'', trigger_tuple VARCHAR(5) NOT NULL''
+                  ||'', trigger_changed TIMESTAMPTZ NOT NULL''
+                  ||level_create
+                  ||'')'';
+            EXECUTE ''CREATE INDEX ON ''||log_qq||'' (trigger_relid, trigger_changed)'';
+            EXECUTE ''CREATE INDEX ON ''||log_qq||'' (trigger_relid, trigger_id)'';
+            IF use_local_id THEN
+                EXECUTE ''CREATE UNIQUE INDEX ON ''||log_qq
+                      ||'' (((trigger_id >> 2) & 1023), trigger_id)'';
+                EXECUTE ''CREATE INDEX ON ''||log_qq||'' (trigger_id)'';
+            END IF;
+            IF use_txid THEN
+                EXECUTE ''CREATE INDEX ON ''||log_qq||'' (trigger_txid, trigger_id)'';
+            END IF;
+        END IF;
+    ELSIF use_keys THEN
+        EXECUTE ''CREATE TABLE ''||log_qq
+              ||''(''||key_cols
+              ||op_cols
+              ||'', trigger_changed TIMESTAMPTZ NOT NULL''
+              ||level_create
+              ||'')'';
+    ELSE
+        EXECUTE ''CREATE TABLE ''||log_qq
+              ||''(LIKE ''||orig_qq
+              ||'', ''||op_cols
+              ||'', trigger_changed TIMESTAMPTZ NOT NULL''
+              ||level_create
+              ||'')'';
+
+        -- the marker entry after a TRUNCATE has no data
+        FOR col IN SELECT attname FROM pg_attribute
+                    WHERE attrelid = orig_qq::regclass AND attnum > 0
+                      AND attnotnull AND NOT attisdropped LOOP
+            EXECUTE ''ALTER TABLE ''||log_qq||'' ALTER COLUMN ''
+                  ||quote_ident(col)||'' DROP NOT NULL'';
+        END LOOP;
+    END IF;
+
+    IF NOT use_shared THEN
+        -- with partitions=N the backends write into N child tables,
+        -- every child table gets the same indexes as the log table
+        FOR i IN 0 .. n_partitions LOOP
+            IF i = 0 THEN
+                part_qq := log_qq;
+            ELSE
+                part_qq := quote_ident(log_schema)||''.''
+                    ||quote_ident(log_name||''_p''||(i - 1));
+                EXECUTE ''CREATE TABLE ''||part_qq||'' () INHERITS (''||log_qq||'')'';
+                IF NOT use_local_id THEN
+                    EXECUTE ''ALTER TABLE ''||part_qq||'' ADD PRIMARY KEY (trigger_id)'';
+                END IF;
+            END IF;
+
+            IF use_local_id THEN
+                -- one insert position per backend, see table_log_local_id()
+                EXECUTE ''CREATE UNIQUE INDEX ON ''||part_qq
+                      ||'' (((trigger_id >> 2) & 1023), trigger_id)'';
+                -- the restore and the ranges of trigger_id need the plain order
+                EXECUTE ''CREATE INDEX ON ''||part_qq||'' (trigger_id)'';
+            END IF;
+
+            -- table_log_rewind() reads only the entries after the target time
+            EXECUTE ''CREATE INDEX ON ''||part_qq||'' (trigger_changed)'';
+
+            IF use_txid THEN
+                -- batches of table_log_fetch() are ranges in this index
+                EXECUTE ''CREATE INDEX ON ''||part_qq||'' (trigger_txid, trigger_id)'';
+            END IF;
+        END LOOP;
+    END IF;
+
+    trigger_args := quote_literal(log_name)||'',''
+          ||do_log_user||'',''
+          ||quote_literal(log_schema)
+          ||CASE WHEN array_length(trigger_opts, 1) > 0
+                 THEN '',''||quote_literal(array_to_string(trigger_opts, '',''))
+                 ELSE '''' END;
+
+    EXECUTE ''CREATE TRIGGER "table_log_trigger" AFTER UPDATE OR INSERT OR DELETE ON ''
+          ||orig_qq||'' FOR EACH ROW EXECUTE PROCEDURE table_log(''
+          ||trigger_args||'')'';
+
+    -- TRUNCATE: snapshot of the rows before, one marker entry after
+    EXECUTE ''CREATE TRIGGER "table_log_truncate_before" BEFORE TRUNCATE ON ''
+          ||orig_qq||'' FOR EACH STATEMENT EXECUTE PROCEDURE table_log(''
+          ||trigger_args||'')'';
+    EXECUTE ''CREATE TRIGGER "table_log_truncate_after" AFTER TRUNCATE ON ''
+          ||orig_qq||'' FOR EACH STATEMENT EXECUTE PROCEDURE table_log(''
+          ||trigger_args||'')'';
+
+    IF use_coalesce THEN
+        -- the net changes are written at the end of the transaction
+        EXECUTE ''CREATE CONSTRAINT TRIGGER "table_log_flush" AFTER UPDATE OR INSERT OR DELETE ON ''
+              ||orig_qq||'' DEFERRABLE INITIALLY DEFERRED''
+              ||'' FOR EACH ROW EXECUTE PROCEDURE table_log_flush()'';
+    END IF;
+
+    RETURN;
+END;
+' LANGUAGE plpgsql;
+
+
+CREATE OR REPLACE FUNCTION table_log_init(int, text, text, text, text) RETURNS void AS '
+DECLARE
+    level        ALIAS FOR $1;
+    orig_schema  ALIAS FOR $2;
+    orig_name    ALIAS FOR $3;
+    log_schema   ALIAS FOR $4;
+    log_name     ALIAS FOR $5;
+BEGIN
+    PERFORM table_log_init(level, orig_schema, orig_name, log_schema,
+        log_name, ''{}''::text[]);
+    RETURN;
+END;
+' LANGUAGE plpgsql;
+
+
+CREATE OR REPLACE FUNCTION table_log_init(int, text) RETURNS void AS '
+DECLARE
+    level        ALIAS FOR $1;
+    orig_name    ALIAS FOR $2;
+BEGIN
+    PERFORM table_log_init(level, orig_name, current_schema());
+    RETURN;
+END;
+' LANGUAGE plpgsql;
+
+
+CREATE OR REPLACE FUNCTION table_log_init(int, text, text) RETURNS void AS '
+DECLARE
+    level        ALIAS FOR $1;
+    orig_name    ALIAS FOR $2;
+    log_schema   ALIAS FOR $3;
+BEGIN
+    PERFORM table_log_init(level, current_schema(), orig_name, log_schema);
+    RETURN;
+END;
+' LANGUAGE plpgsql;
+
+
+CREATE OR REPLACE FUNCTION table_log_init(int, text, text, text) RETURNS void AS '
+DECLARE
+    level        ALIAS FOR $1;
+    orig_schema  ALIAS FOR $2;
+    orig_name    ALIAS FOR $3;
+    log_schema   ALIAS FOR $4;
+BEGIN
+    PERFORM table_log_init(level, orig_schema, orig_name, log_schema,
+        CASE WHEN orig_schema=log_schema
+            THEN orig_name||''_log'' ELSE orig_name END);
+    RETURN;
+END;
+' LANGUAGE plpgsql;
+
+-- statistics, need table_log in shared_preload_libraries
+
+CREATE FUNCTION table_log_stats (
+    OUT dbid oid,
+    OUT relid oid,
+    OUT rows_insert int8,
+    OUT rows_update int8,
+    OUT rows_delete int8,
+    OUT rows_skipped int8,
+    OUT bytes_logged int8,
+    OUT log_time float8,
+    OUT log_max_time float8,
+    OUT restores int8,
+    OUT restore_time float8,
+    OUT restore_max_time float8)
+    RETURNS SETOF record
+    AS 'MODULE_PATHNAME', 'table_log_stats' LANGUAGE C;
+CREATE FUNCTION table_log_stats_reset ()
+    RETURNS void
+    AS 'MODULE_PATHNAME', 'table_log_stats_reset' LANGUAGE C;
+
+CREATE VIEW table_log_stats AS
+    SELECT * FROM table_log_stats();
+
+GRANT SELECT ON table_log_stats TO PUBLIC;
+REVOKE ALL ON FUNCTION table_log_stats_reset() FROM PUBLIC;
+
+-- restore with timing of each phase
+
+CREATE FUNCTION table_log_restore_table_timing (VARCHAR, VARCHAR, CHAR, CHAR, CHAR, TIMESTAMPTZ,
+    CHAR DEFAULT NULL, INT DEFAULT NULL, INT DEFAULT NULL,
+    OUT restore_table VARCHAR,
+    OUT phase TEXT,
+    OUT duration FLOAT8,
+    OUT method_used INT,
+    OUT est_log_before FLOAT8,
+    OUT est_log_after FLOAT8,
+    OUT est_live_rows FLOAT8)
+    RETURNS SETOF record
+    AS 'MODULE_PATHNAME', 'table_log_restore_table_timing' LANGUAGE C;
+
+-- progress of running restores, needs table_log in shared_preload_libraries
+
+CREATE FUNCTION table_log_restore_progress (
+    OUT pid int4,
+    OUT dbid oid,
+    OUT relid oid,
+    OUT phase text,
+    OUT log_rows_total int8,
+    OUT log_rows_processed int8,
+    OUT rows_written int8,
+    OUT started timestamptz)
+    RETURNS SETOF record
+    AS 'MODULE_PATHNAME', 'table_log_restore_progress' LANGUAGE C;
+
+CREATE VIEW table_log_restore_progress AS
+    SELECT * FROM table_log_restore_progress();
+
+GRANT SELECT ON table_log_restore_progress TO PUBLIC;
+
+-- ordering key without a shared sequence, see table_log_init(..., ARRAY['local_id'])
+
+CREATE FUNCTION table_log_local_id ()
+    RETURNS BIGINT
+    AS 'MODULE_PATHNAME', 'table_log_local_id' LANGUAGE C VOLATILE;
+
+-- undo all changes in a logged table after a timestamp
+
+CREATE FUNCTION table_log_rewind (REGCLASS, TIMESTAMPTZ)
+    RETURNS BIGINT
+    AS 'MODULE_PATHNAME', 'table_log_rewind' LANGUAGE C;
+
+-- net changes between two timestamps
+
+CREATE FUNCTION table_log_diff (REGCLASS, TIMESTAMPTZ, TIMESTAMPTZ,
+    OUT operation TEXT, OUT pkey TEXT, OUT old_row TEXT, OUT new_row TEXT)
+    RETURNS SETOF RECORD
+    AS 'MODULE_PATHNAME', 'table_log_diff' LANGUAGE C;
+
+-- change feed for downstream consumers, needs a log table
+-- created with table_log_init(..., ARRAY['txid'])
+
+CREATE TABLE table_log_consumer (
+    consumer      TEXT NOT NULL PRIMARY KEY,
+    log_table     REGCLASS NOT NULL,
+    -- all changes visible in snap_done are consumed
+    snap_done     TXID_SNAPSHOT NOT NULL,
+    -- the batch window: changes visible in snap_batch but not in snap_done
+    snap_batch    TXID_SNAPSHOT,
+    -- position inside the batch window
+    pos_txid      BIGINT NOT NULL DEFAULT 0,
+    pos_id        BIGINT NOT NULL DEFAULT 0,
+    -- position after the last fetch, becomes the position with the ack
+    fetch_txid    BIGINT,
+    fetch_id      BIGINT,
+    fetch_last    BOOLEAN NOT NULL DEFAULT false
+);
+
+SELECT pg_catalog.pg_extension_config_dump('table_log_consumer', '');
+
+
+CREATE FUNCTION table_log_register_consumer(text, regclass) RETURNS void AS '
+DECLARE
+    p_consumer   ALIAS FOR $1;
+    p_log_table  ALIAS FOR $2;
+BEGIN
+    PERFORM 1 FROM pg_attribute
+      WHERE attrelid = p_log_table AND attname = ''trigger_txid''
+        AND NOT attisdropped;
+    IF NOT FOUND THEN
+        RAISE EXCEPTION
+            ''table_log_register_consumer: log table % has no column trigger_txid'',
+            p_log_table;
+    END IF;
+
+    -- start with the changes committed after the registration
+    INSERT INTO table_log_consumer (consumer, log_table, snap_done)
+        VALUES (p_consumer, p_log_table, txid_current_snapshot());
+    RETURN;
+END;
+' LANGUAGE plpgsql;
+
+
+CREATE FUNCTION table_log_unregister_consumer(text) RETURNS void AS '
+BEGIN
+    DELETE FROM table_log_consumer WHERE consumer = $1;
+    IF NOT FOUND THEN
+        RAISE EXCEPTION ''table_log_unregister_consumer: unknown consumer "%"'', $1;
+    END IF;
+    RETURN;
+END;
+' LANGUAGE plpgsql;
+
+
+CREATE FUNCTION table_log_fetch(text, int,
+    OUT trigger_txid BIGINT, OUT trigger_id BIGINT,
+    OUT trigger_mode VARCHAR, OUT trigger_tuple VARCHAR,
+    OUT trigger_changed TIMESTAMPTZ, OUT log_row TEXT)
+    RETURNS SETOF RECORD AS '
+DECLARE
+    p_consumer   ALIAS FOR $1;
+    p_batch_size ALIAS FOR $2;
+    c            table_log_consumer%ROWTYPE;
+    r            record;
+    n            int = 0;
+    op_cols      text = ''l.trigger_mode::varchar, l.trigger_tuple::varchar'';
+BEGIN
+    SELECT * INTO c FROM table_log_consumer
+     WHERE consumer = p_consumer FOR UPDATE;
+    IF NOT FOUND THEN
+        RAISE EXCEPTION ''table_log_fetch: unknown consumer "%"'', p_consumer;
+    END IF;
+
+    -- start a new batch window with the transactions committed by now
+    IF c.snap_batch IS NULL THEN
+        c.snap_batch := txid_current_snapshot();
+        c.pos_txid := 0;
+        c.pos_id := 0;
+    END IF;
+
+    -- a compact log table has trigger_op instead of mode and tuple
+    PERFORM 1 FROM pg_attribute
+      WHERE attrelid = c.log_table AND attname = ''trigger_op'' AND NOT attisdropped;
+    IF FOUND THEN
+        op_cols := ''table_log_op_mode(l.trigger_op) AS trigger_mode,''
+            ||'' table_log_op_tuple(l.trigger_op) AS trigger_tuple'';
+    END IF;
+
+    -- only the index range between the two snapshots is read
+    FOR r IN EXECUTE ''SELECT l.trigger_txid, l.trigger_id, ''||op_cols
+        ||'', l.trigger_changed, l::text AS log_row''
+        ||'' FROM ''||c.log_table::text||'' l''
+        ||'' WHERE l.trigger_txid >= txid_snapshot_xmin($1)''
+        ||'' AND l.trigger_txid < txid_snapshot_xmax($2)''
+        ||'' AND (l.trigger_txid, l.trigger_id) > ($3, $4)''
+        ||'' AND txid_visible_in_snapshot(l.trigger_txid, $2)''
+        ||'' AND NOT txid_visible_in_snapshot(l.trigger_txid, $1)''
+        ||'' ORDER BY l.trigger_txid, l.trigger_id LIMIT $5''
+        USING c.snap_done, c.snap_batch, c.pos_txid, c.pos_id, p_batch_size
+    LOOP
+        trigger_txid := r.trigger_txid;
+        trigger_id := r.trigger_id;
+        trigger_mode := r.trigger_mode;
+        trigger_tuple := r.trigger_tuple;
+        trigger_changed := r.trigger_changed;
+        log_row := r.log_row;
+        n := n + 1;
+        RETURN NEXT;
+    END LOOP;
+
+    -- a short batch is the end of the window
+    UPDATE table_log_consumer
+       SET snap_batch = c.snap_batch, pos_txid = c.pos_txid, pos_id = c.pos_id,
+           fetch_txid = coalesce(trigger_txid, c.pos_txid),
+           fetch_id = coalesce(trigger_id, c.pos_id),
+           fetch_last = (n < p_batch_size)
+     WHERE consumer = p_consumer;
+    RETURN;
+END;
+' LANGUAGE plpgsql;
+
+
+CREATE FUNCTION table_log_ack(text) RETURNS void AS '
+DECLARE
+    p_consumer   ALIAS FOR $1;
+    c            table_log_consumer%ROWTYPE;
+BEGIN
+    SELECT * INTO c FROM table_log_consumer
+     WHERE consumer = p_consumer FOR UPDATE;
+    IF NOT FOUND THEN
+        RAISE EXCEPTION ''table_log_ack: unknown consumer "%"'', p_consumer;
+    END IF;
+    IF c.fetch_txid IS NULL THEN
+        RETURN;
+    END IF;
+
+    IF c.fetch_last THEN
+        -- window done, the next fetch starts a new one
+        UPDATE table_log_consumer
+           SET snap_done = c.snap_batch, snap_batch = NULL,
+               pos_txid = 0, pos_id = 0,
+               fetch_txid = NULL, fetch_id = NULL, fetch_last = false
+         WHERE consumer = p_consumer;
+    ELSE
+        UPDATE table_log_consumer
+           SET pos_txid = c.fetch_txid, pos_id = c.fetch_id,
+               fetch_txid = NULL, fetch_id = NULL
+         WHERE consumer = p_consumer;
+    END IF;
+    RETURN;
+END;
+' LANGUAGE plpgsql;
+
+-- restore tables which can be rolled forward to a later timestamp
+
+CREATE TABLE table_log_restore_state (
+    restore_table   TEXT NOT NULL PRIMARY KEY,
+    orig_table      TEXT NOT NULL,
+    orig_pkey       TEXT NOT NULL,
+    log_table       TEXT NOT NULL,
+    log_pkey        TEXT NOT NULL,
+    -- the restore table contains all log entries up to this time
+    restored_until  TIMESTAMPTZ NOT NULL,
+    -- of the entries up to restored_until, the ones committed in this
+    -- snapshot are in the restore table, the next refresh reads the others
+    snap_done       TXID_SNAPSHOT NOT NULL
+);
+
+SELECT pg_catalog.pg_extension_config_dump('table_log_restore_state', '');
+
+
+CREATE FUNCTION table_log_create_restore(VARCHAR, VARCHAR, CHAR, CHAR, CHAR, TIMESTAMPTZ) RETURNS VARCHAR AS '
+DECLARE
+    p_orig       ALIAS FOR $1;
+    p_orig_pkey  ALIAS FOR $2;
+    p_log        ALIAS FOR $3;
+    p_log_pkey   ALIAS FOR $4;
+    p_restore    ALIAS FOR $5;
+    p_timestamp  ALIAS FOR $6;
+    snap         txid_snapshot;
+BEGIN
+    -- the refresh finds the entries committed later by their transaction
+    PERFORM 1 FROM pg_attribute
+      WHERE attrelid = quote_ident(p_log)::regclass AND attname = ''trigger_txid''
+        AND NOT attisdropped;
+    IF NOT FOUND THEN
+        RAISE EXCEPTION
+            ''table_log_create_restore: log table % has no column trigger_txid'',
+            p_log;
+    END IF;
+
+    -- the restore below sees at least the transactions committed here
+    snap := txid_current_snapshot();
+
+    -- a normal (not temporary) restore table, restored forward
+    PERFORM table_log_restore_table(p_orig, p_orig_pkey, p_log, p_log_pkey,
+        p_restore, p_timestamp, NULL, 0, 1);
+
+    -- table_log_refresh_restore() replaces rows by key
+    EXECUTE ''CREATE UNIQUE INDEX ON ''||p_restore::text::regclass::text
+          ||'' (''||quote_ident(p_orig_pkey)||'')'';
+
+    INSERT INTO table_log_restore_state
+        VALUES (p_restore, p_orig, p_orig_pkey, p_log, p_log_pkey,
+                p_timestamp, snap);
+
+    RETURN p_restore;
+END;
+' LANGUAGE plpgsql;
+
+
+CREATE FUNCTION table_log_refresh_restore(VARCHAR, TIMESTAMPTZ) RETURNS BIGINT AS '
+DECLARE
+    p_restore    ALIAS FOR $1;
+    p_timestamp  ALIAS FOR $2;
+    s            table_log_restore_state%ROWTYPE;
+    restore_qq   text;
+    log_source   text;
+    cols         text;
+    pk           text;
+    n_deleted    bigint;
+    n_inserted   bigint;
+    snap         txid_snapshot;
+    bulk_old     text;
+    log_range    text;
+BEGIN
+    SELECT * INTO s FROM table_log_restore_state
+     WHERE restore_table = p_restore FOR UPDATE;
+    IF NOT FOUND THEN
+        RAISE EXCEPTION
+            ''table_log_refresh_restore: % was not created by table_log_create_restore()'',
+            p_restore;
+    END IF;
+    IF p_timestamp < s.restored_until THEN
+        RAISE EXCEPTION
+            ''table_log_refresh_restore: % is already restored until %'',
+            p_restore, s.restored_until;
+    END IF;
+
+    restore_qq := p_restore::text::regclass::text;
+    pk := quote_ident(s.orig_pkey);
+    SELECT string_agg(quote_ident(attname), '', '' ORDER BY attnum) INTO cols
+      FROM pg_attribute
+     WHERE attrelid = p_restore::text::regclass AND attnum > 0 AND NOT attisdropped;
+
+    -- a shared log table has the rows in trigger_data
+    log_source := quote_ident(s.log_table)::regclass::text;
+    PERFORM 1 FROM pg_attribute
+      WHERE attrelid = quote_ident(s.log_table)::regclass
+        AND attname = ''trigger_relid'' AND NOT attisdropped;
+    IF FOUND THEN
+        log_source := ''(SELECT (trigger_data::''||s.orig_table::regclass::text||'').*,''
+            ||'' trigger_mode, trigger_tuple, trigger_changed, trigger_txid, ''||quote_ident(s.log_pkey)
+            ||'' FROM ''||log_source
+            ||'' WHERE trigger_relid = ''||s.orig_table::regclass::oid||'')'';
+    END IF;
+
+    -- a compact log table has trigger_op instead of mode and tuple
+    PERFORM 1 FROM pg_attribute
+      WHERE attrelid = quote_ident(s.log_table)::regclass
+        AND attname = ''trigger_op'' AND NOT attisdropped;
+    IF FOUND THEN
+        log_source := ''(SELECT *, table_log_op_mode(trigger_op) AS trigger_mode,''
+            ||'' table_log_op_tuple(trigger_op) AS trigger_tuple''
+            ||'' FROM ''||log_source||'')'';
+    END IF;
+
+    -- the ''old'' snapshot of a bulk mode window is the state of its rows
+    -- until the window ends, see table_log_begin_bulk(): skipped while
+    -- the window is open at the timestamp, read again when it ended since
+    -- the last refresh
+    bulk_old := ''trigger_mode = ''''BULK'''' AND trigger_tuple = ''''old''''''
+        ||'' AND EXISTS (SELECT 1 FROM table_log_bulk w''
+        ||'' WHERE w.relid = ''||s.orig_table::regclass::oid
+        ||'' AND w.started = trigger_changed'';
+
+    -- trigger_changed is the start of the writing transaction, a
+    -- transaction committed after the last refresh can have entries up
+    -- to restored_until: the entries not committed in snap_done are read
+    -- as well as the ones after restored_until. Both statements below
+    -- read the entries committed in snap, the others are left for the
+    -- next refresh.
+    snap := txid_current_snapshot();
+    log_range := ''trigger_changed <= $2 AND txid_visible_in_snapshot(trigger_txid, $4)''
+        ||'' AND ((trigger_txid >= txid_snapshot_xmin($1) AND NOT txid_visible_in_snapshot(trigger_txid, $1))''
+        ||'' OR trigger_changed > $3''
+        ||'' OR (''||bulk_old||'' AND w.ended > $3 AND w.ended <= $2)))''
+        ||'' AND NOT (''||bulk_old||'' AND (w.ended IS NULL OR w.ended > $2)))'';
+
+    -- every key changed since the last refresh gets the state of its
+    -- newest entry up to the timestamp, keys read again get the same
+    -- state again
+    EXECUTE ''DELETE FROM ''||restore_qq||'' r USING (SELECT DISTINCT ''||pk
+          ||'' FROM ''||log_source||'' l''
+          ||'' WHERE ''||log_range||'') k''
+          ||'' WHERE r.''||pk||'' = k.''||pk
+      USING s.snap_done, p_timestamp, s.restored_until, snap;
+    GET DIAGNOSTICS n_deleted = ROW_COUNT;
+
+    EXECUTE ''INSERT INTO ''||restore_qq||'' (''||cols||'') SELECT ''||cols
+          ||'' FROM (SELECT DISTINCT ON (''||pk||'') ''||cols||'', trigger_tuple''
+          ||'' FROM ''||log_source||'' l''
+          ||'' WHERE ''||log_range
+          ||'' ORDER BY ''||pk||'', ''||quote_ident(s.log_pkey)||'' DESC) n''
+          ||'' WHERE trigger_tuple = ''''new''''''
+          -- not the marker after a TRUNCATE, it has no key
+          ||'' AND ''||pk||'' IS NOT NULL''
+      USING s.snap_done, p_timestamp, s.restored_until, snap;
+    GET DIAGNOSTICS n_inserted = ROW_COUNT;
+
+    UPDATE table_log_restore_state
+       SET restored_until = p_timestamp,
+           snap_done = snap
+     WHERE restore_table = p_restore;
+
+    RETURN n_deleted + n_inserted;
+END;
+' LANGUAGE plpgsql;
+
+
+CREATE FUNCTION table_log_drop_restore(VARCHAR) RETURNS void AS '
+BEGIN
+    DELETE FROM table_log_restore_state WHERE restore_table = $1;
+    IF NOT FOUND THEN
+        RAISE EXCEPTION
+            ''table_log_drop_restore: % was not created by table_log_create_restore()'', $1;
+    END IF;
+    EXECUTE ''DROP TABLE ''||$1::text::regclass::text;
+    RETURN;
+END;
+' LANGUAGE plpgsql;
+
+-- restores running as a job in a background worker
+
+CREATE TABLE table_log_job (
+    job_id              SERIAL NOT NULL PRIMARY KEY,
+    -- queued, running, done, failed or cancelled
+    status              TEXT NOT NULL DEFAULT 'queued',
+    orig_table          TEXT NOT NULL,
+    orig_pkey           TEXT NOT NULL,
+    log_table           TEXT NOT NULL,
+    log_pkey            TEXT NOT NULL,
+    restore_table       TEXT NOT NULL,
+    restore_ts          TIMESTAMPTZ NOT NULL,
+    search_pkey         TEXT,
+    method              INT NOT NULL,
+    -- search_path of the submitting session
+    search_path         TEXT NOT NULL,
+    submitted_by        NAME NOT NULL DEFAULT current_user,
+    submitted           TIMESTAMPTZ NOT NULL DEFAULT now(),
+    started             TIMESTAMPTZ,
+    finished            TIMESTAMPTZ,
+    pid                 INT,
+    log_rows_total      BIGINT,
+    log_rows_processed  BIGINT,
+    rows_written        BIGINT,
+    error               TEXT,
+    -- the method used, with method 2 the estimate it was chosen by
+    method_used         INT,
+    est_log_before      FLOAT8,
+    est_log_after       FLOAT8,
+    est_live_rows       FLOAT8
+);
+
+SELECT pg_catalog.pg_extension_config_dump('table_log_job', '');
+SELECT pg_catalog.pg_extension_config_dump('table_log_job_job_id_seq', '');
+
+CREATE FUNCTION table_log_restore_submit (VARCHAR, VARCHAR, CHAR, CHAR, CHAR, TIMESTAMPTZ,
+    CHAR DEFAULT NULL, INT DEFAULT NULL)
+    RETURNS INT
+    AS 'MODULE_PATHNAME', 'table_log_restore_submit' LANGUAGE C;
+
+CREATE FUNCTION table_log_restore_cancel(INT) RETURNS BOOLEAN AS '
+DECLARE
+    p_job_id  ALIAS FOR $1;
+    j         table_log_job%ROWTYPE;
+BEGIN
+    SELECT * INTO j FROM table_log_job WHERE job_id = p_job_id FOR UPDATE;
+    IF NOT FOUND THEN
+        RAISE EXCEPTION ''table_log_restore_cancel: job % does not exist'', p_job_id;
+    END IF;
+
+    IF j.status = ''queued'' THEN
+        UPDATE table_log_job SET status = ''cancelled'', finished = now()
+         WHERE job_id = p_job_id;
+        RETURN true;
+    END IF;
+
+    IF j.status = ''running'' THEN
+        -- the worker records the cancellation itself
+        RETURN pg_cancel_backend(j.pid);
+    END IF;
+
+    RETURN false;
+END;
+' LANGUAGE plpgsql;
+
+CREATE VIEW table_log_restore_jobs AS
+    SELECT j.job_id, j.status, j.orig_table, j.restore_table, j.restore_ts,
+           j.submitted_by, j.submitted, j.started, j.finished,
+           coalesce(p.phase, CASE WHEN j.status = 'running' THEN 'init' END) AS phase,
+           coalesce(p.log_rows_total, j.log_rows_total) AS log_rows_total,
+           coalesce(p.log_rows_processed, j.log_rows_processed) AS log_rows_processed,
+           coalesce(p.rows_written, j.rows_written) AS rows_written,
+           CASE WHEN j.started IS NULL THEN NULL
+                ELSE coalesce(p.log_rows_processed, j.log_rows_processed)
+                     / nullif(extract(epoch FROM coalesce(j.finished, now()) - j.started), 0)
+           END AS log_rows_per_sec,
+           j.method_used,
+           j.error
+      FROM table_log_job j
+      LEFT JOIN table_log_restore_progress() p
+        ON j.status = 'running' AND p.pid = j.pid;
+
+-- cache of restore results for repeated point-in-time queries
+
+CREATE TABLE table_log_restore_cache (
+    cache_id        SERIAL NOT NULL PRIMARY KEY,
+    -- the table with the restored rows
+    cache_table     TEXT NOT NULL UNIQUE,
+    orig_table      TEXT NOT NULL,
+    log_table       TEXT NOT NULL,
+    restore_ts      TIMESTAMPTZ NOT NULL,
+    -- '' for all keys
+    search_pkey     TEXT NOT NULL,
+    -- the newest log entry when the result was restored
+    log_max_id      BIGINT,
+    size_bytes      BIGINT NOT NULL,
+    created         TIMESTAMPTZ NOT NULL DEFAULT now(),
+    last_used       TIMESTAMPTZ NOT NULL DEFAULT now(),
+    hits            BIGINT NOT NULL DEFAULT 0,
+    UNIQUE (orig_table, log_table, restore_ts, search_pkey)
+);
+
+SELECT pg_catalog.pg_extension_config_dump('table_log_restore_cache', '');
+SELECT pg_catalog.pg_extension_config_dump('table_log_restore_cache_cache_id_seq', '');
+
+
+CREATE FUNCTION table_log_restore_cached(VARCHAR, VARCHAR, CHAR, CHAR, TIMESTAMPTZ, CHAR DEFAULT NULL) RETURNS VARCHAR AS '
+DECLARE
+    p_orig       ALIAS FOR $1;
+    p_orig_pkey  ALIAS FOR $2;
+    p_log        ALIAS FOR $3;
+    p_log_pkey   ALIAS FOR $4;
+    p_timestamp  ALIAS FOR $5;
+    p_pkey       text = coalesce($6, '''');
+    c            table_log_restore_cache%ROWTYPE;
+    max_id       bigint;
+    cache_name   text;
+    budget       bigint;
+BEGIN
+    -- identical requests wait here for the first one and use its result
+    PERFORM pg_advisory_xact_lock(hashtext(''table_log_restore_cache''),
+        hashtext(p_orig||''/''||p_log||''/''||p_timestamp::text||''/''||p_pkey));
+
+    EXECUTE ''SELECT max(''||quote_ident(p_log_pkey)||'')::bigint FROM ''
+          ||quote_ident(p_log)
+       INTO max_id;
+
+    SELECT * INTO c FROM table_log_restore_cache
+     WHERE orig_table = p_orig AND log_table = p_log
+       AND restore_ts = p_timestamp AND search_pkey = p_pkey;
+    IF FOUND THEN
+        IF c.log_max_id IS NOT DISTINCT FROM max_id
+           AND to_regclass(c.cache_table) IS NOT NULL THEN
+            UPDATE table_log_restore_cache
+               SET last_used = now(), hits = hits + 1
+             WHERE cache_id = c.cache_id;
+            RETURN c.cache_table;
+        END IF;
+
+        -- the log has changed since
+        EXECUTE ''DROP TABLE IF EXISTS ''||c.cache_table;
+        DELETE FROM table_log_restore_cache WHERE cache_id = c.cache_id;
+    END IF;
+
+    cache_name := ''table_log_cache_''||nextval(''table_log_restore_cache_cache_id_seq'');
+    PERFORM table_log_restore_table(p_orig, p_orig_pkey, p_log, p_log_pkey,
+        cache_name, p_timestamp, nullif(p_pkey, ''''), 2, 1);
+    cache_name := cache_name::regclass::text;
+
+    INSERT INTO table_log_restore_cache (cache_table, orig_table, log_table,
+        restore_ts, search_pkey, log_max_id, size_bytes)
+    VALUES (cache_name, p_orig, p_log, p_timestamp, p_pkey, max_id,
+        pg_total_relation_size(cache_name::regclass));
+
+    -- drop the least recently used results above the size budget
+    SELECT setting::bigint * 1024 INTO budget
+      FROM pg_settings WHERE name = ''table_log.restore_cache_size'';
+    budget := coalesce(budget, 65536 * 1024);
+    FOR c IN SELECT * FROM table_log_restore_cache
+              WHERE cache_table <> cache_name
+              ORDER BY last_used LOOP
+        EXIT WHEN (SELECT sum(size_bytes) FROM table_log_restore_cache) <= budget;
+        EXECUTE ''DROP TABLE IF EXISTS ''||c.cache_table;
+        DELETE FROM table_log_restore_cache WHERE cache_id = c.cache_id;
+    END LOOP;
+
+    RETURN cache_name;
+END;
+' LANGUAGE plpgsql;
+
+
+CREATE FUNCTION table_log_restore_cache_clear() RETURNS void AS '
+DECLARE
+    c            table_log_restore_cache%ROWTYPE;
+BEGIN
+    FOR c IN SELECT * FROM table_log_restore_cache LOOP
+        EXECUTE ''DROP TABLE IF EXISTS ''||c.cache_table;
+    END LOOP;
+    DELETE FROM table_log_restore_cache;
+    RETURN;
+END;
+' LANGUAGE plpgsql;
+
+-- restore of many keys with one scan of the log table
+
+CREATE FUNCTION table_log_restore_table_keys (VARCHAR, VARCHAR, CHAR, CHAR, CHAR, TIMESTAMPTZ,
+    TEXT[], INT DEFAULT NULL, INT DEFAULT NULL)
+    RETURNS VARCHAR
+    AS 'MODULE_PATHNAME', 'table_log_restore_table_keys' LANGUAGE C;
+CREATE FUNCTION table_log_restore_table_where (VARCHAR, VARCHAR, CHAR, CHAR, CHAR, TIMESTAMPTZ,
+    TEXT, INT DEFAULT NULL, INT DEFAULT NULL)
+    RETURNS VARCHAR
+    AS 'MODULE_PATHNAME', 'table_log_restore_table_where' LANGUAGE C;
+
+-- bulk mode: one snapshot before and after instead of logging every row
+
+CREATE FUNCTION table_log_begin_bulk (REGCLASS, TEXT DEFAULT NULL)
+    RETURNS BIGINT
+    AS 'MODULE_PATHNAME', 'table_log_begin_bulk' LANGUAGE C;
+CREATE FUNCTION table_log_end_bulk (REGCLASS)
+    RETURNS BIGINT
+    AS 'MODULE_PATHNAME', 'table_log_end_bulk' LANGUAGE C;
+
+-- rows of a logged table at a timestamp, without a restore table
+
+CREATE FUNCTION table_log_as_of (ANYELEMENT, TIMESTAMPTZ)
+    RETURNS SETOF ANYELEMENT
+    AS 'MODULE_PATHNAME', 'table_log_as_of' LANGUAGE C;
+
+-- write the rows at a timestamp into a server side file
+CREATE FUNCTION table_log_export(REGCLASS, TIMESTAMPTZ, TEXT, TEXT DEFAULT 'text') RETURNS BIGINT AS '
+DECLARE
+    tbl        ALIAS FOR $1;
+    ts         ALIAS FOR $2;
+    filename   ALIAS FOR $3;
+    fmt        ALIAS FOR $4;
+    n          bigint;
+BEGIN
+    IF fmt IS NULL OR lower(fmt) NOT IN (''text'', ''csv'', ''binary'') THEN
+        RAISE EXCEPTION ''table_log_export: format must be text, csv or binary'';
+    END IF;
+    IF filename IS NULL THEN
+        RAISE EXCEPTION ''table_log_export: file name must not be NULL'';
+    END IF;
+
+    EXECUTE ''COPY (SELECT * FROM table_log_as_of(NULL::''||tbl::text||'', ''
+         ||quote_literal(ts)||''::timestamptz)) TO ''||quote_literal(filename)
+         ||'' (FORMAT ''||lower(fmt)||'')'';
+    GET DIAGNOSTICS n = ROW_COUNT;
+
+    RETURN n;
+END;
+' LANGUAGE plpgsql;
+
+-- archive of old log entries in compressed files on the server
+
+CREATE TABLE table_log_archive_segment (
+    segment_id      SERIAL NOT NULL PRIMARY KEY,
+    -- the log table, schema qualified and quoted
+    log_table       TEXT NOT NULL,
+    -- gzip compressed COPY BINARY file on the server
+    file            TEXT NOT NULL UNIQUE,
+    min_id          BIGINT NOT NULL,
+    max_id          BIGINT NOT NULL,
+    min_changed     TIMESTAMPTZ NOT NULL,
+    max_changed     TIMESTAMPTZ NOT NULL,
+    n_rows          BIGINT NOT NULL,
+    archived        TIMESTAMPTZ NOT NULL DEFAULT now()
+);
+CREATE INDEX table_log_archive_segment_range
+    ON table_log_archive_segment (log_table, min_changed, max_changed);
+
+SELECT pg_catalog.pg_extension_config_dump('table_log_archive_segment', '');
+SELECT pg_catalog.pg_extension_config_dump('table_log_archive_segment_segment_id_seq', '');
+
+
+CREATE FUNCTION table_log_archive(REGCLASS, TIMESTAMPTZ, TEXT) RETURNS BIGINT AS '
+DECLARE
+    p_log        ALIAS FOR $1;
+    p_before     ALIAS FOR $2;
+    p_directory  ALIAS FOR $3;
+    log_name     text;
+    seg          record;
+    seg_id       int;
+    dir          text;
+    file         text;
+    n            bigint;
+BEGIN
+    -- the directory is part of a shell command
+    IF p_directory IS NULL OR p_directory !~ ''^/[A-Za-z0-9_./-]*$'' THEN
+        RAISE EXCEPTION
+            ''table_log_archive: directory must be an absolute path of the characters A-Z a-z 0-9 _ . / -'';
+    END IF;
+
+    -- the name of the log table independent of the search_path
+    SELECT quote_ident(s.nspname)||''.''||quote_ident(c.relname) INTO log_name
+      FROM pg_class c, pg_namespace s
+     WHERE c.oid = p_log AND s.oid = c.relnamespace;
+
+    -- no new entries while the old ones are copied and deleted
+    EXECUTE ''LOCK TABLE ''||log_name||'' IN EXCLUSIVE MODE'';
+
+    EXECUTE ''SELECT min(trigger_id) AS min_id, max(trigger_id) AS max_id, ''
+          ||''min(trigger_changed) AS min_changed, max(trigger_changed) AS max_changed, ''
+          ||''count(*) AS n_rows FROM ''||log_name||'' WHERE trigger_changed < $1''
+       INTO seg USING p_before;
+    IF seg.n_rows = 0 THEN
+        RETURN 0;
+    END IF;
+
+    -- oid of the log table and segment id make the file name unique,
+    -- the shell refuses to overwrite an existing file (set -C)
+    seg_id := nextval(''table_log_archive_segment_segment_id_seq'');
+    dir := rtrim(p_directory, ''/'');
+    file := dir||''/table_log_''||p_log::oid||''_''||seg_id||''.copy.gz'';
+
+    EXECUTE ''COPY (SELECT * FROM ''||log_name
+          ||'' WHERE trigger_changed < ''||quote_literal(p_before)||''::timestamptz''
+          ||'' ORDER BY trigger_id) TO PROGRAM ''
+          ||quote_literal(''mkdir -p ''||dir||'' && set -C && gzip > ''||file)
+          ||'' (FORMAT binary)'';
+
+    EXECUTE ''DELETE FROM ''||log_name||'' WHERE trigger_changed < $1''
+      USING p_before;
+    GET DIAGNOSTICS n = ROW_COUNT;
+    IF n <> seg.n_rows THEN
+        RAISE EXCEPTION ''table_log_archive: % rows archived, but % deleted'', seg.n_rows, n;
+    END IF;
+
+    INSERT INTO table_log_archive_segment
+           (segment_id, log_table, file, min_id, max_id, min_changed, max_changed, n_rows)
+    VALUES (seg_id, log_name, file, seg.min_id, seg.max_id, seg.min_changed, seg.max_changed, n);
+
+    RETURN n;
+END;
+' LANGUAGE plpgsql;
+
+
+-- the archived entries of a log table, optionally only those in [from, to]
+CREATE FUNCTION table_log_archive_read(ANYELEMENT, TIMESTAMPTZ DEFAULT NULL, TIMESTAMPTZ DEFAULT NULL)
+    RETURNS SETOF ANYELEMENT AS '
+DECLARE
+    p_from       ALIAS FOR $2;
+    p_to         ALIAS FOR $3;
+    log_oid      oid;
+    log_name     text;
+    tmp_name     text;
+    seg          table_log_archive_segment%ROWTYPE;
+BEGIN
+    SELECT c.oid, quote_ident(s.nspname)||''.''||quote_ident(c.relname)
+      INTO log_oid, log_name
+      FROM pg_class c, pg_namespace s
+     WHERE c.reltype = pg_typeof($1)::oid AND s.oid = c.relnamespace;
+    IF log_name IS NULL THEN
+        RAISE EXCEPTION ''table_log_archive_read: first argument must be of the row type of a log table'';
+    END IF;
+
+    -- one work table per log table, gone at the end of the transaction
+    tmp_name := ''table_log_archive_rows_''||log_oid;
+
+    BEGIN
+        IF to_regclass(''pg_temp.''||tmp_name) IS NOT NULL THEN
+            EXECUTE ''DROP TABLE pg_temp.''||tmp_name;
+        END IF;
+        EXECUTE ''CREATE TEMP TABLE ''||tmp_name||'' (LIKE ''||log_name||'') ON COMMIT DROP'';
+
+        -- only the segments which overlap the time range
+        FOR seg IN SELECT * FROM table_log_archive_segment
+                    WHERE log_table = log_name
+                      AND (p_to IS NULL OR min_changed <= p_to)
+                      AND (p_from IS NULL OR max_changed >= p_from)
+                    ORDER BY min_id LOOP
+            EXECUTE ''TRUNCATE pg_temp.''||tmp_name;
+            EXECUTE ''COPY pg_temp.''||tmp_name||'' FROM PROGRAM ''
+                  ||quote_literal(''gzip -dc ''||seg.file)||'' (FORMAT binary)'';
+            RETURN QUERY EXECUTE ''SELECT * FROM pg_temp.''||tmp_name
+                               ||'' WHERE ($1 IS NULL OR trigger_changed >= $1)''
+                               ||'' AND ($2 IS NULL OR trigger_changed <= $2)''
+                               ||'' ORDER BY trigger_id''
+              USING p_from, p_to;
+        END LOOP;
+
+        EXECUTE ''DROP TABLE pg_temp.''||tmp_name;
+    EXCEPTION WHEN OTHERS THEN
+        IF to_regclass(''pg_temp.''||tmp_name) IS NOT NULL THEN
+            EXECUTE ''DROP TABLE pg_temp.''||tmp_name;
+        END IF;
+        RAISE;
+    END;
+
+    RETURN;
+END;
+' LANGUAGE plpgsql;
+
+
+-- move the archive segments with entries after a timestamp back into the log table
+CREATE FUNCTION table_log_unarchive(REGCLASS, TIMESTAMPTZ) RETURNS BIGINT AS '
+DECLARE
+    p_log        ALIAS FOR $1;
+    p_from       ALIAS FOR $2;
+    log_name     text;
+    seg          table_log_archive_segment%ROWTYPE;
+    n            bigint;
+    total        bigint = 0;
+BEGIN
+    SELECT quote_ident(s.nspname)||''.''||quote_ident(c.relname) INTO log_name
+      FROM pg_class c, pg_namespace s
+     WHERE c.oid = p_log AND s.oid = c.relnamespace;
+
+    FOR seg IN SELECT * FROM table_log_archive_segment
+                WHERE log_table = log_name AND max_changed >= p_from
+                ORDER BY min_id LOOP
+        EXECUTE ''COPY ''||log_name||'' FROM PROGRAM ''
+              ||quote_literal(''gzip -dc ''||seg.file)||'' (FORMAT binary)'';
+        GET DIAGNOSTICS n = ROW_COUNT;
+        total := total + n;
+
+        -- the file is kept, remove it when it is not needed any more
+        DELETE FROM table_log_archive_segment WHERE segment_id = seg.segment_id;
+    END LOOP;
+
+    RETURN total;
+END;
+' LANGUAGE plpgsql;
+
+-- mode and tuple of a log entry in a compact log table, which has the
+-- code trigger_op instead: the first letter of the mode, upper case for
+-- 'new' and lower case for 'old' entries
+
+CREATE FUNCTION table_log_op_mode("char") RETURNS VARCHAR AS '
+    SELECT CASE upper($1::text) WHEN ''I'' THEN ''INSERT'' WHEN ''U'' THEN ''UPDATE''
+           WHEN ''D'' THEN ''DELETE'' WHEN ''T'' THEN ''TRUNCATE'' ELSE ''BULK'' END::varchar;
+' LANGUAGE sql IMMUTABLE STRICT;
+
+CREATE FUNCTION table_log_op_tuple("char") RETURNS VARCHAR AS '
+    SELECT CASE WHEN $1::text = upper($1::text) THEN ''new'' ELSE ''old'' END::varchar;
+' LANGUAGE sql IMMUTABLE STRICT;
+
+-- deferred trigger of the option coalesce: writes the net changes of
+-- the rows changed in the transaction, see table_log_init()
+
+CREATE FUNCTION table_log_flush ()
+    RETURNS TRIGGER
+    AS 'MODULE_PATHNAME', 'table_log_flush' LANGUAGE C;
+
+-- hot keys and change rate per table, need table_log in
+-- shared_preload_libraries, see table_log_stats
+
+CREATE FUNCTION table_log_hot_keys (
+    OUT dbid oid,
+    OUT relid oid,
+    OUT pkey text,
+    OUT changes int8,
+    OUT error int8)
+    RETURNS SETOF record
+    AS 'MODULE_PATHNAME', 'table_log_hot_keys' LANGUAGE C;
+CREATE FUNCTION table_log_change_rate (
+    OUT dbid oid,
+    OUT relid oid,
+    OUT bucket_start timestamptz,
+    OUT changes int8,
+    OUT bytes_logged int8)
+    RETURNS SETOF record
+    AS 'MODULE_PATHNAME', 'table_log_change_rate' LANGUAGE C;
+
+CREATE VIEW table_log_hot_keys AS
+    SELECT * FROM table_log_hot_keys();
+CREATE VIEW table_log_change_rate AS
+    SELECT * FROM table_log_change_rate();
+
+GRANT SELECT ON table_log_hot_keys TO PUBLIC;
+GRANT SELECT ON table_log_change_rate TO PUBLIC;
+
+-- table_log_init() for all tables of a schema
+
+CREATE FUNCTION table_log_init_schema(int, text, text, text DEFAULT NULL,
+    text[] DEFAULT NULL, int DEFAULT NULL) RETURNS int AS '
+DECLARE
+    level        ALIAS FOR $1;
+    orig_schema  ALIAS FOR $2;
+    log_schema   ALIAS FOR $3;
+    name_filter  ALIAS FOR $4;
+    log_options  ALIAS FOR $5;
+    max_tables   ALIAS FOR $6;
+    tab          name;
+    log_name     text;
+    use_shared   boolean;
+    done         int = 0;
+BEGIN
+    use_shared := ''shared'' = ANY (coalesce(log_options, ''{}''));
+
+    -- one catalog scan finds the tables without a table_log() trigger,
+    -- log tables (with trigger_changed) are not logged themselves; every
+    -- table is then set up on its own by table_log_init()
+    FOR tab IN SELECT c.relname FROM pg_class c, pg_namespace n
+                WHERE c.relnamespace = n.oid AND n.nspname = orig_schema
+                  AND c.relkind = ''r''
+                  AND (name_filter IS NULL OR c.relname LIKE name_filter)
+                  AND NOT EXISTS (SELECT 1 FROM pg_trigger t, pg_proc p
+                                   WHERE t.tgrelid = c.oid AND t.tgfoid = p.oid
+                                     AND p.proname = ''table_log'')
+                  AND NOT EXISTS (SELECT 1 FROM pg_attribute a
+                                   WHERE a.attrelid = c.oid AND a.attname = ''trigger_changed''
+                                     AND NOT a.attisdropped)
+                ORDER BY c.relname LOOP
+        IF use_shared THEN
+            log_name := orig_schema||''_log'';
+        ELSIF orig_schema = log_schema THEN
+            log_name := tab||''_log'';
+        ELSE
+            log_name := tab;
+        END IF;
+
+        IF NOT use_shared THEN
+            PERFORM 1 FROM pg_class c, pg_namespace n
+              WHERE c.relnamespace = n.oid
+                AND n.nspname = log_schema AND c.relname = log_name;
+            IF FOUND THEN
+                RAISE NOTICE
+                    ''table_log_init_schema: log table %.% exists, table % skipped'',
+                    log_schema, log_name, tab;
+                CONTINUE;
+            END IF;
+        END IF;
+
+        PERFORM table_log_init(level, orig_schema, tab, log_schema, log_name, log_options);
+
+        -- stop after max_tables tables, the next call goes on with the rest
+        done := done + 1;
+        EXIT WHEN done = max_tables;
+    END LOOP;
+
+    RETURN done;
+END;
+' LANGUAGE plpgsql;
+
+
+-- bulk mode windows, see table_log_begin_bulk()
+
+CREATE TABLE table_log_bulk (
+    relid      OID NOT NULL,
+    -- trigger_changed of the 'old' snapshot
+    started    TIMESTAMPTZ NOT NULL,
+    -- trigger_changed of the 'new' snapshot, NULL until
+    -- table_log_end_bulk(), and for good if the session ended without it
+    ended      TIMESTAMPTZ
+);
+
+CREATE INDEX ON table_log_bulk (relid, started);
+
+SELECT pg_catalog.pg_extension_config_dump('table_log_bulk', '');
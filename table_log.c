@@ -18,15 +18,47 @@
 #include "fmgr.h"
 #include "executor/spi.h"	/* this is what you need to work with SPI */
 #include "commands/trigger.h"	/* -"- and triggers */
-#include "mb/pg_wchar.h"	/* support for the quoting functions */
 #include "miscadmin.h"
 #include "lib/stringinfo.h"
+#include "mb/pg_wchar.h"
 #include "utils/formatting.h"
 #include "utils/builtins.h"
 #include <utils/lsyscache.h>
 #include <utils/rel.h>
 #include <utils/timestamp.h>
 #include "funcapi.h"
+#include "access/heapam.h"
+#include "access/htup_details.h"
+#include "access/xact.h"
+#include "catalog/namespace.h"
+#include "catalog/pg_index.h"
+#include "catalog/pg_trigger.h"
+#include "catalog/pg_type.h"
+#include "pgstat.h"
+#include "portability/instr_time.h"
+#include "postmaster/bgworker.h"
+#include "storage/backendid.h"
+#include "storage/ipc.h"
+#include "storage/lmgr.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "tcop/tcopprot.h"
+#include "utils/guc.h"
+#include "utils/fmgroids.h"
+#include "utils/hsearch.h"
+#include "utils/inval.h"
+#include "utils/snapmgr.h"
+#include "utils/syscache.h"
+#include "utils/tuplestore.h"
+#if PG_VERSION_NUM >= 100000
+#include "utils/varlena.h"
+#endif
+#if PG_VERSION_NUM >= 110000
+#include "utils/regproc.h"
+#endif
+
+#include "table_log_probes.h"
 
 /* for PostgreSQL >= 8.2.x */
 #ifdef PG_MODULE_MAGIC
@@ -42,14 +74,357 @@ PG_MODULE_MAGIC;
 #define PG_NARGS() (fcinfo->nargs)
 #endif
 
+/*
+ * shared memory statistics, only available if table_log is loaded
+ * through shared_preload_libraries
+ */
+typedef struct TableLogStatsKey
+{
+	Oid        dbid;                  /* database of the logged table */
+	Oid        relid;                 /* the logged (original) table */
+} TableLogStatsKey;
+
+typedef struct TableLogCounters
+{
+	int64      rows_insert;           /* logged INSERT events */
+	int64      rows_update;           /* logged UPDATE events */
+	int64      rows_delete;           /* logged DELETE events */
+	int64      rows_skipped;          /* events not written to the log */
+	int64      bytes_logged;          /* size of the logged values */
+	double     log_time;              /* time spent in table_log(), in msec */
+	double     log_max_time;          /* max time of a single table_log() call */
+	int64      restores;              /* number of restores of this table */
+	double     restore_time;          /* time spent in restores, in msec */
+	double     restore_max_time;      /* max time of a single restore */
+} TableLogCounters;
+
+/*
+ * the most often changed primary keys of a table, counted with the
+ * Space-Saving algorithm: a key which is not tracked replaces the key
+ * with the lowest count and takes over its count as possible error
+ */
+#define TABLE_LOG_HOT_KEYS         16
+#define TABLE_LOG_HOT_KEY_LEN      64
+
+typedef struct TableLogHotKey
+{
+	uint32     hash;                  /* hash of key, 0: unused slot */
+	int64      count;                 /* changes counted for the key */
+	int64      error;                 /* maximum overestimation of count */
+	char       key[TABLE_LOG_HOT_KEY_LEN];  /* the primary key as text, truncated */
+} TableLogHotKey;
+
+/*
+ * changes per time bucket, a ring of buckets of table_log.change_rate_interval
+ * (one minute by default) over the last 60 intervals
+ */
+#define TABLE_LOG_RATE_BUCKETS     60
+
+typedef struct TableLogRateBucket
+{
+	int64      bucket;                /* number of the bucket since 2000-01-01 */
+	int64      changes;               /* logged INSERT, UPDATE and DELETE events */
+	int64      bytes_logged;          /* size of the logged values */
+} TableLogRateBucket;
+
+typedef struct TableLogStatsEntry
+{
+	TableLogStatsKey key;             /* hash key, must be first */
+	slock_t    mutex;                 /* protects the counters */
+	TableLogCounters counters;
+	TableLogHotKey hot_keys[TABLE_LOG_HOT_KEYS];
+	TableLogRateBucket rate[TABLE_LOG_RATE_BUCKETS];
+} TableLogStatsEntry;
+
+typedef struct TableLogSharedState
+{
+	LWLock     *lock;                 /* protects the hash table layout and
+									   * the allocation of progress slots */
+} TableLogSharedState;
+
+/*
+ * phases of a restore, reported in table_log_restore_progress
+ * and returned by table_log_restore_table_timing()
+ */
+#define TABLE_LOG_PHASE_INIT       0
+#define TABLE_LOG_PHASE_CATALOG    1
+#define TABLE_LOG_PHASE_COPY       2
+#define TABLE_LOG_PHASE_SCAN       3
+#define TABLE_LOG_PHASE_REPLAY     4
+#define TABLE_LOG_NUM_PHASES       5
+
+/*
+ * restore methods, TABLE_LOG_METHOD_AUTO picks one of the other two by
+ * the estimated cost: every replayed log entry is one statement, a row
+ * copied from the live table costs only TABLE_LOG_COPY_ROW_COST of that
+ */
+#define TABLE_LOG_METHOD_FORWARD   0
+#define TABLE_LOG_METHOD_BACKWARD  1
+#define TABLE_LOG_METHOD_AUTO      2
+#define TABLE_LOG_COPY_ROW_COST    0.02
+#define TABLE_LOG_ROW_WIDTH        100  /* bytes per row, for a table never analyzed */
+
+/* kind of the key filter, the 7th argument of the restore functions */
+#define TABLE_LOG_FILTER_KEY       0    /* a single key */
+#define TABLE_LOG_FILTER_KEYS      1    /* an array of keys */
+#define TABLE_LOG_FILTER_WHERE     2    /* a predicate on the key */
+
+static const char *const table_log_phase_names[TABLE_LOG_NUM_PHASES] = {
+	"initializing",
+	"checking catalog",
+	"copying table",
+	"scanning log",
+	"replaying log"
+};
+
+/*
+ * progress of a running restore, one slot in shared memory
+ * per restore, pid is 0 for unused slots
+ */
+typedef struct TableLogRestoreProgress
+{
+	slock_t      mutex;               /* protects the fields below */
+	int          pid;                 /* backend running the restore */
+	Oid          dbid;
+	Oid          relid;               /* the restored (original) table */
+	int          phase;               /* TABLE_LOG_PHASE_* */
+	int64        log_rows_total;      /* log entries to replay */
+	int64        log_rows_processed;  /* log entries replayed so far */
+	int64        rows_written;        /* rows written into the restore table */
+	TimestampTz  started;
+} TableLogRestoreProgress;
+
+/* arguments of table_log_restore_table() */
+typedef struct TableLogRestoreArgs
+{
+	char       *table_orig;           /* the original table name */
+	char       *table_orig_pkey;      /* the primary key in the original table */
+	char       *table_log;            /* the log table name */
+	char       *table_log_pkey;       /* the primary key in the log table */
+	char       *table_restore;        /* the restore table name */
+	Datum       timestamp;            /* the timestamp in past */
+	char       *search_pkey;          /* the single pkey, "" for all keys */
+	char       *search_keys;          /* array of pkeys (text form), or NULL */
+	char       *search_where;         /* predicate on the pkey, or NULL */
+	int         method;               /* 0: forward, 1: backwards */
+	int         not_temporarly;       /* 1: dont create a temporary table */
+} TableLogRestoreArgs;
+
+/* backend local state of a running restore */
+typedef struct TableLogRestoreState
+{
+	TableLogRestoreProgress *progress;  /* shared slot, or NULL */
+	Oid          relid;               /* the original table */
+	int          phase;               /* current phase */
+	instr_time   phase_start;         /* start of the current phase */
+	double       phase_time[TABLE_LOG_NUM_PHASES];  /* in msec */
+	int64        log_rows_total;      /* log entries to replay */
+	int64        log_rows_processed;  /* log entries replayed */
+	int64        rows_written;        /* rows written into the restore table */
+	int          method;              /* the method used, 0 or 1, -1 before the choice */
+	bool         estimated;           /* method chosen by the estimate below */
+	double       est_log_before;      /* estimated log entries before the timestamp */
+	double       est_log_after;       /* estimated log entries after the timestamp */
+	double       est_live_rows;       /* estimated rows in the original table */
+} TableLogRestoreState;
+
+/* a table in bulk mode, see table_log_begin_bulk() */
+typedef struct TableLogBulk
+{
+	Oid            relid;
+	LockRelId      lockid;            /* session lock against other writers */
+	char          *where;             /* the affected rows, or NULL for all */
+	TimestampTz    started;           /* the window in table_log_bulk */
+	SubTransactionId begin_subid;     /* table_log_begin_bulk() not yet committed */
+	SubTransactionId end_subid;       /* table_log_end_bulk() not yet committed */
+} TableLogBulk;
+
+/* a row changed in this transaction, in a table with the option coalesce */
+typedef struct TableLogCoalesceKey
+{
+	Oid            relid;
+	char          *where;             /* condition on the primary key of the row */
+} TableLogCoalesceKey;
+
+typedef struct TableLogCoalesceEntry
+{
+	TableLogCoalesceKey key;
+	HeapTuple      old_tuple;         /* the row before the transaction, NULL if it did not exist */
+} TableLogCoalesceEntry;
+
+/* the changed rows of a table, in the order of their first change */
+typedef struct TableLogCoalesceTable
+{
+	Oid            relid;
+	List          *entries;
+} TableLogCoalesceTable;
+
+/* primary key columns of a table, cached for the hot keys and coalesce */
+typedef struct TableLogKeyColumns
+{
+	Oid            relid;             /* hash key */
+	int            nkeys;             /* 0 for a table without primary key */
+	AttrNumber     attnums[INDEX_MAX_KEYS];
+} TableLogKeyColumns;
+
+/* passed to a restore job worker in bgw_extra */
+typedef struct TableLogJobExtra
+{
+	Oid            dbid;
+	Oid            userid;            /* the user who submitted the job */
+	TransactionId  xid;               /* the transaction which submitted the job */
+	Oid            job_table;         /* table_log_job */
+} TableLogJobExtra;
+
+/* arguments of a table_log() trigger */
+typedef struct TableLogTriggerInfo
+{
+	char       *log_schema;           /* schema of the log table */
+	char       *log_table;            /* the log table name */
+	int         use_session_user;     /* 1: write the session user */
+	int         shared;               /* 1: shared log table for many tables */
+	int         partitions;           /* number of child tables, 0: none */
+	int         keys_only;            /* 1: log only the primary key columns */
+	int         compact;              /* 1: trigger_op and a role oid as trigger_user */
+	int         coalesce;             /* 1: only the net change of a transaction */
+	List       *keys;                 /* the primary key columns, for keys_only and coalesce */
+} TableLogTriggerInfo;
+
+static TableLogSharedState *table_log_shared = NULL;
+static HTAB *table_log_stats_hash = NULL;
+static TableLogRestoreProgress *table_log_progress = NULL;
+
+/* the progress slot used by this backend, for cleanup at exit */
+static TableLogRestoreProgress *table_log_my_progress = NULL;
+
+/* tables in bulk mode in this session (in TopMemoryContext) */
+static List *table_log_bulk = NIL;
+static bool table_log_bulk_callback_registered = false;
+static bool table_log_progress_exit_registered = false;
+
+/* rows changed in this transaction (in TopTransactionContext), see table_log_flush() */
+static HTAB *table_log_coalesce_hash = NULL;
+static List *table_log_coalesce_tables = NIL;
+static bool table_log_coalesce_callback_registered = false;
+
+/* primary key columns per table, reset by relcache invalidations */
+static HTAB *table_log_key_columns = NULL;
+
+/*
+ * layout of the keys generated by table_log_local_id():
+ * microseconds since 2000-01-01 (51 bits), backend id (10 bits)
+ * and a per-backend counter (2 bits)
+ */
+#define TABLE_LOG_LOCAL_ID_BACKEND_BITS  10
+#define TABLE_LOG_LOCAL_ID_COUNTER_BITS  2
+
+/*
+ * mode and tuple of a log entry from the trigger_op column of a compact
+ * log table, see __table_log_op_code()
+ */
+#define TABLE_LOG_OP_MODE_EXPR \
+	"CASE upper(trigger_op::text) WHEN 'I' THEN 'INSERT' WHEN 'U' THEN 'UPDATE' " \
+	"WHEN 'D' THEN 'DELETE' WHEN 'T' THEN 'TRUNCATE' ELSE 'BULK' END"
+#define TABLE_LOG_OP_TUPLE_EXPR \
+	"CASE WHEN trigger_op::text = upper(trigger_op::text) THEN 'new' ELSE 'old' END"
+/* and the other way round, for a log table with trigger_mode and trigger_tuple */
+#define TABLE_LOG_OP_CODE_EXPR \
+	"(CASE WHEN trigger_tuple = 'new' THEN substr(trigger_mode, 1, 1) " \
+	"ELSE lower(substr(trigger_mode, 1, 1)) END)::\"char\""
+
+/* GUC variables */
+static bool table_log_track_stats = true;
+static bool table_log_track_hot_keys = false;
+static int  table_log_stats_max = 1000;
+static int  table_log_max_restores = 16;
+static int  table_log_change_rate_interval = 60;    /* in seconds */
+static int  table_log_restore_cache_size = 65536;    /* in kB */
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+
+void _PG_init(void);
 extern Datum table_log(PG_FUNCTION_ARGS);
 Datum table_log_restore_table(PG_FUNCTION_ARGS);
+Datum table_log_restore_table_timing(PG_FUNCTION_ARGS);
+Datum table_log_restore_table_keys(PG_FUNCTION_ARGS);
+Datum table_log_restore_table_where(PG_FUNCTION_ARGS);
+Datum table_log_stats(PG_FUNCTION_ARGS);
+Datum table_log_stats_reset(PG_FUNCTION_ARGS);
+Datum table_log_hot_keys(PG_FUNCTION_ARGS);
+Datum table_log_change_rate(PG_FUNCTION_ARGS);
+Datum table_log_restore_progress(PG_FUNCTION_ARGS);
+Datum table_log_local_id(PG_FUNCTION_ARGS);
+Datum table_log_rewind(PG_FUNCTION_ARGS);
+Datum table_log_diff(PG_FUNCTION_ARGS);
+Datum table_log_as_of(PG_FUNCTION_ARGS);
+Datum table_log_restore_submit(PG_FUNCTION_ARGS);
+Datum table_log_begin_bulk(PG_FUNCTION_ARGS);
+Datum table_log_end_bulk(PG_FUNCTION_ARGS);
+Datum table_log_flush(PG_FUNCTION_ARGS);
+PGDLLEXPORT void table_log_restore_worker(Datum main_arg);
 static char *do_quote_ident(char *iptr);
 static char *do_quote_literal(char *iptr);
-static void __table_log (TriggerData *trigdata, char *changed_mode, char *changed_tuple, HeapTuple tuple, int number_columns, char *log_table, int use_session_user, char *log_schema);
-void __table_log_restore_table_insert(SPITupleTable *spi_tuptable, char *table_restore, char *table_orig_pkey, char *col_query_start, int col_pkey, int number_columns, int i);
-void __table_log_restore_table_update(SPITupleTable *spi_tuptable, char *table_restore, char *table_orig_pkey, char *col_query_start, int col_pkey, int number_columns, int i, char *old_key_string);
-void __table_log_restore_table_delete(SPITupleTable *spi_tuptable, char *table_restore, char *table_orig_pkey, char *col_query_start, int col_pkey, int number_columns, int i);
+static void __table_log_append_literal(StringInfo buf, const char *lptr);
+static char __table_log_op_code(const char *changed_mode, const char *changed_tuple);
+static void __table_log_append_extra(StringInfo query, char *changed_mode, char *changed_tuple, TableLogTriggerInfo *info);
+static int64 __table_log (TriggerData *trigdata, char *changed_mode, char *changed_tuple, HeapTuple tuple, int number_columns, TableLogTriggerInfo *info);
+static int64 __table_log_shared (TriggerData *trigdata, char *changed_mode, char *changed_tuple, HeapTuple tuple, TableLogTriggerInfo *info);
+static int64 __table_log_snapshot (Relation rel, char *changed_mode, char *changed_tuple, char *where, int with_data, TableLogTriggerInfo *info);
+static void table_log_shmem_request(void);
+static void table_log_shmem_startup(void);
+static Size table_log_shmem_size(void);
+static TableLogStatsEntry *__table_log_stats_entry(Oid relid);
+static void __table_log_stats_evict(void);
+static void __table_log_stats_add(Oid relid, TableLogCounters *delta);
+static void __table_log_key_columns_invalidate(Datum arg, Oid relid);
+static TableLogKeyColumns *__table_log_key_columns(Relation rel);
+static void __table_log_stats_key(Relation rel, HeapTuple tuple);
+static Tuplestorestate *__table_log_materialize(FunctionCallInfo fcinfo, TupleDesc *tupdesc);
+static void __table_log_restore_args(FunctionCallInfo fcinfo, TableLogRestoreArgs *args, int key_filter);
+static void __table_log_restore(TableLogRestoreArgs *args, TableLogRestoreState *state);
+static void __table_log_restore_internal(TableLogRestoreArgs *args, TableLogRestoreState *state);
+static int __table_log_restore_choose(char *table_orig, char *table_log, char *table_log_pkey, int log_shared, Datum timestamp, TableLogRestoreState *state);
+static void __table_log_restore_phase(TableLogRestoreState *state, int phase);
+static void __table_log_progress_begin(TableLogRestoreState *state, Oid relid);
+static void __table_log_progress_total(TableLogRestoreState *state, int64 total);
+static void __table_log_progress_update(TableLogRestoreState *state, int64 processed, int64 written);
+static void __table_log_progress_end(TableLogRestoreState *state);
+static void __table_log_progress_exit(int code, Datum arg);
+static void __table_log_trigger_args(Relation rel, Trigger *trigger, TableLogTriggerInfo *info);
+static bool __table_log_trigger_option(Trigger *trigger, const char *name);
+static void __table_log_trigger_done(TriggerData *trigdata, const char *event_name, instr_time start_time, TableLogCounters *delta);
+static bool __table_log_find_trigger(Relation rel, TableLogTriggerInfo *info);
+static TableLogBulk *__table_log_bulk_find(Oid relid);
+static void __table_log_bulk_at_end(bool commit, SubTransactionId subid, SubTransactionId parent);
+static void __table_log_bulk_xact_callback(XactEvent event, void *arg);
+static void __table_log_bulk_subxact_callback(SubXactEvent event, SubTransactionId subid,
+											  SubTransactionId parent, void *arg);
+static void __table_log_bulk_window(Relation rel, TableLogBulk *bulk, bool end);
+static void __table_log_append_bulk_open(StringInfo query, Oid relid, int compact, const char *timestamp);
+static uint32 __table_log_coalesce_hash_key(const void *key, Size keysize);
+static int __table_log_coalesce_match(const void *key1, const void *key2, Size keysize);
+static void __table_log_coalesce_xact_callback(XactEvent event, void *arg);
+static TableLogCoalesceTable *__table_log_coalesce_table(Oid relid);
+static char *__table_log_coalesce_where(Relation rel, HeapTuple tuple, TableLogKeyColumns *cols);
+static void __table_log_coalesce_remember(Relation rel, char *where, HeapTuple old_tuple);
+static void __table_log_coalesce_add(TriggerData *trigdata);
+static bool __table_log_coalesce_equal(Relation rel, HeapTuple tuple1, HeapTuple tuple2);
+static void __table_log_coalesce_flush(TriggerData *trigdata, int number_columns, TableLogTriggerInfo *info, TableLogCounters *delta);
+static List *__table_log_pkey_columns(Relation rel);
+static char *__table_log_relation_name(Relation rel);
+static char *__table_log_insert_target(TableLogTriggerInfo *info);
+static char *__table_log_logged_table(Relation rel, const char *caller, List **pkey, bool need_rows, Oid *log_relid);
+static char *__table_log_extension_table(const char *name);
+static Oid __table_log_relname_relid(const char *name);
+static void __table_log_check_archive(Oid log_relid, Datum timestamp, bool whole_log, const char *caller);
+static void __table_log_job_finish(char *job_table, int32 job_id, char *status, TableLogRestoreState *state, char *error);
+int __table_log_restore_table_insert(SPITupleTable *spi_tuptable, char *table_restore, char *table_orig_pkey, char *col_query_start, int col_pkey, int number_columns, int i);
+int __table_log_restore_table_update(SPITupleTable *spi_tuptable, char *table_restore, char *table_orig_pkey, char *col_query_start, int col_pkey, int number_columns, int i, char *old_key_string);
+int __table_log_restore_table_delete(SPITupleTable *spi_tuptable, char *table_restore, char *table_orig_pkey, char *col_query_start, int col_pkey, int number_columns, int i);
+int __table_log_restore_table_truncate(char *table_restore);
 char *__table_log_varcharout(VarChar *s);
 int count_columns (TupleDesc tupleDesc);
 
@@ -63,6 +438,129 @@ PG_FUNCTION_INFO_V1(table_log_show_column);
 #endif /* FUNCAPI_H */
 /* restore a full table */
 PG_FUNCTION_INFO_V1(table_log_restore_table);
+/* restore a full table, with timing of each phase */
+PG_FUNCTION_INFO_V1(table_log_restore_table_timing);
+/* restore many keys with one log scan */
+PG_FUNCTION_INFO_V1(table_log_restore_table_keys);
+PG_FUNCTION_INFO_V1(table_log_restore_table_where);
+/* statistics */
+PG_FUNCTION_INFO_V1(table_log_stats);
+PG_FUNCTION_INFO_V1(table_log_stats_reset);
+PG_FUNCTION_INFO_V1(table_log_hot_keys);
+PG_FUNCTION_INFO_V1(table_log_change_rate);
+PG_FUNCTION_INFO_V1(table_log_restore_progress);
+/* ordering key without a shared sequence */
+PG_FUNCTION_INFO_V1(table_log_local_id);
+/* undo changes in the original table */
+PG_FUNCTION_INFO_V1(table_log_rewind);
+/* net changes between two timestamps */
+PG_FUNCTION_INFO_V1(table_log_diff);
+/* rows of a table at a timestamp */
+PG_FUNCTION_INFO_V1(table_log_as_of);
+/* restore in a background worker */
+PG_FUNCTION_INFO_V1(table_log_restore_submit);
+/* bulk mode */
+PG_FUNCTION_INFO_V1(table_log_begin_bulk);
+PG_FUNCTION_INFO_V1(table_log_end_bulk);
+/* net changes of a transaction */
+PG_FUNCTION_INFO_V1(table_log_flush);
+
+
+/*
+ * _PG_init()
+ * Module load callback. The statistics need shared memory, which is
+ * only available if the module is in shared_preload_libraries.
+ */
+void _PG_init(void)
+{
+	DefineCustomBoolVariable("table_log.track_stats",
+							 "Collects statistics about logging and restore activity.",
+							 NULL,
+							 &table_log_track_stats,
+							 true,
+							 PGC_SUSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	DefineCustomBoolVariable("table_log.track_hot_keys",
+							 "Counts the most often changed primary keys of every logged table.",
+							 NULL,
+							 &table_log_track_hot_keys,
+							 false,
+							 PGC_SUSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	DefineCustomIntVariable("table_log.restore_cache_size",
+							"Sets the maximum size of the tables kept by table_log_restore_cached().",
+							NULL,
+							&table_log_restore_cache_size,
+							65536,
+							0,
+							INT_MAX,
+							PGC_USERSET,
+							GUC_UNIT_KB,
+							NULL,
+							NULL,
+							NULL);
+
+	if (!process_shared_preload_libraries_in_progress)
+		return;
+
+	DefineCustomIntVariable("table_log.stats_max",
+							"Sets the maximum number of tables tracked by table_log_stats.",
+							NULL,
+							&table_log_stats_max,
+							1000,
+							100,
+							INT_MAX,
+							PGC_POSTMASTER,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("table_log.max_restores",
+							"Sets the maximum number of restores shown in table_log_restore_progress.",
+							NULL,
+							&table_log_max_restores,
+							16,
+							1,
+							1024,
+							PGC_POSTMASTER,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("table_log.change_rate_interval",
+							"Sets the length of the time buckets of table_log_change_rate.",
+							NULL,
+							&table_log_change_rate_interval,
+							60,
+							1,
+							3600,
+							PGC_POSTMASTER,
+							GUC_UNIT_S,
+							NULL,
+							NULL,
+							NULL);
+
+	EmitWarningsOnPlaceholders("table_log");
+
+#if PG_VERSION_NUM >= 150000
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = table_log_shmem_request;
+#else
+	table_log_shmem_request();
+#endif
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = table_log_shmem_startup;
+}
 
 
 /*
@@ -104,10 +602,18 @@ Datum table_log(PG_FUNCTION_ARGS)
 	StringInfo     query;
 	int            number_columns = 0;		/* counts the number columns in the table */
 	int            number_columns_log = 0;	/* counts the number columns in the table */
-	char           *orig_schema;
+	TupleDesc      log_tupdesc;
 	char           *log_schema;
 	char           *log_table;
 	int            use_session_user = 0;    /* should we write the current (session) user to the log table? */
+	TableLogTriggerInfo info;               /* parsed trigger arguments */
+	instr_time     start_time;
+	TableLogCounters delta;                 /* statistics for this call */
+	Oid            relid;
+	const char     *event_name;             /* for the probes */
+
+	INSTR_TIME_SET_CURRENT(start_time);
+	memset(&delta, 0, sizeof(delta));
 
 	/*
 	 * Some checks first...
@@ -121,18 +627,59 @@ Datum table_log(PG_FUNCTION_ARGS)
 		elog(ERROR, "table_log: not fired by trigger manager");
 	}
 
-	/* must only be called for ROW trigger */
-	if (TRIGGER_FIRED_FOR_STATEMENT(trigdata->tg_event))
+	/* must only be called for ROW trigger, TRUNCATE is the exception */
+	if (TRIGGER_FIRED_FOR_STATEMENT(trigdata->tg_event) &&
+		!TRIGGER_FIRED_BY_TRUNCATE(trigdata->tg_event))
 	{
 		elog(ERROR, "table_log: can't process STATEMENT events");
 	}
 
-	/* must only be called AFTER */
-	if (TRIGGER_FIRED_BEFORE(trigdata->tg_event))
+	/* must only be called AFTER, except for the snapshot before a TRUNCATE */
+	if (TRIGGER_FIRED_BEFORE(trigdata->tg_event) &&
+		!TRIGGER_FIRED_BY_TRUNCATE(trigdata->tg_event))
 	{
 		elog(ERROR, "table_log: must be fired after event");
 	}
 
+	relid = RelationGetRelid(trigdata->tg_relation);
+	if (TRIGGER_FIRED_BY_INSERT(trigdata->tg_event))
+		event_name = "INSERT";
+	else if (TRIGGER_FIRED_BY_UPDATE(trigdata->tg_event))
+		event_name = "UPDATE";
+	else if (TRIGGER_FIRED_BY_DELETE(trigdata->tg_event))
+		event_name = "DELETE";
+	else
+		event_name = "TRUNCATE";
+
+	TABLE_LOG_TRIGGER_START(relid, event_name);
+
+	/* in bulk mode the changes are covered by the snapshots, see table_log_begin_bulk() */
+	if (!TRIGGER_FIRED_BY_TRUNCATE(trigdata->tg_event) &&
+		__table_log_bulk_find(relid) != NULL)
+	{
+		delta.rows_skipped++;
+		__table_log_stats_add(relid, &delta);
+		TABLE_LOG_TRIGGER_DONE(relid, event_name, 0);
+		return PointerGetDatum(trigdata->tg_trigtuple);
+	}
+
+	/*
+	 * with the option coalesce only the key of the row is remembered, the
+	 * net change is written at the end of the transaction, see
+	 * table_log_flush(): no need for SPI or the log table here
+	 */
+	if (!TRIGGER_FIRED_BY_TRUNCATE(trigdata->tg_event) &&
+		__table_log_trigger_option(trigdata->tg_trigger, "coalesce"))
+	{
+		elog(DEBUG2, "mode: coalesce");
+
+		__table_log_coalesce_add(trigdata);
+		delta.rows_skipped++;
+
+		__table_log_trigger_done(trigdata, event_name, start_time, &delta);
+		return PointerGetDatum(trigdata->tg_trigtuple);
+	}
+
 	/* now connect to SPI manager */
 	ret = SPI_connect();
 
@@ -141,9 +688,6 @@ Datum table_log(PG_FUNCTION_ARGS)
 		elog(ERROR, "table_log: SPI_connect returned %d", ret);
 	}
 
-	/* get schema name for the table, in case we need it later */
-	orig_schema = get_namespace_name(RelationGetNamespace(trigdata->tg_relation));
-
 	elog(DEBUG2, "prechecks done, now getting original table attributes");
 
 	number_columns = count_columns(trigdata->tg_relation->rd_att);
@@ -154,53 +698,17 @@ Datum table_log(PG_FUNCTION_ARGS)
 
 	elog(DEBUG2, "number columns in orig table: %i", number_columns);
 
-	if (trigdata->tg_trigger->tgnargs > 3)
-	{
-		elog(ERROR, "table_log: too many arguments to trigger");
-	}
-
-  /* name of the log schema */
-	if (trigdata->tg_trigger->tgnargs > 2)
-	{
-		/* check if a log schema argument is given, if yes, use it */
-		log_schema = trigdata->tg_trigger->tgargs[2];
-	}
-	else
-	{
-		/* if no, use orig_schema */
-		log_schema = orig_schema;
-	}
+	/* log table, log schema and further options from the trigger arguments */
+	__table_log_trigger_args(trigdata->tg_relation, trigdata->tg_trigger, &info);
+	log_schema = info.log_schema;
+	log_table = info.log_table;
+	use_session_user = info.use_session_user;
 
-	/* should we write the current user? */
-	if (trigdata->tg_trigger->tgnargs > 1)
-	{
-		/*
-		 * check if a second argument is given
-		 * if yes, use it, if it is true
-		 */
-		if (atoi(trigdata->tg_trigger->tgargs[1]) == 1)
-		{
-			use_session_user = 1;
-			elog(DEBUG2, "will write session user to 'trigger_user'");
-		}
-	}
+	TABLE_LOG_TRIGGER_ARGS_DONE(relid);
 
-	/* name of the log table */
-	if (trigdata->tg_trigger->tgnargs > 0)
-	{
-		/*
-		 * check if a logtable argument is given
-		 * if yes, use it
-		 */
-		log_table = pstrdup(trigdata->tg_trigger->tgargs[0]);
-		sprintf(log_table, "%s", trigdata->tg_trigger->tgargs[0]);
-	}
-	else
+	if (use_session_user == 1)
 	{
-		/* if no, use 'table name' + '_log' */
-		log_table = (char *) palloc((strlen(do_quote_ident(SPI_getrelname(trigdata->tg_relation))) + 5)
-									* sizeof(char));
-		sprintf(log_table, "%s_log", SPI_getrelname(trigdata->tg_relation));
+		elog(DEBUG2, "will write session user to 'trigger_user'");
 	}
 
 	elog(DEBUG2, "log table: %s", log_table);
@@ -209,41 +717,77 @@ Datum table_log(PG_FUNCTION_ARGS)
 	/* get the number columns in the table */
 	query = makeStringInfo();
 	appendStringInfo(query, "%s.%s", do_quote_ident(log_schema), do_quote_ident(log_table));
-	number_columns_log = count_columns(RelationNameGetTupleDesc(query->data));
+	log_tupdesc = RelationNameGetTupleDesc(query->data);
+	number_columns_log = count_columns(log_tupdesc);
 
 	if (number_columns_log < 1)
 	{
 		elog(ERROR, "could not get number columns in relation %s", log_table);
 	}
 
-    elog(DEBUG2, "number columns in log table: %i", number_columns_log);
+	/* the transaction id for table_log_fetch() is optional and filled by its default */
+	if (SPI_fnumber(log_tupdesc, "trigger_txid") > 0)
+	{
+		number_columns_log--;
+	}
 
-	/*
-	 * check if the logtable has 3 (or now 4) columns more than our table
-	 * +1 if we should write the session user
-	 */
+	/* a compact log table has the single column trigger_op for mode and tuple */
+	if (info.compact == 1)
+	{
+		if (SPI_fnumber(log_tupdesc, "trigger_op") <= 0)
+		{
+			elog(ERROR, "relation %s is not a compact log table", log_table);
+		}
+		number_columns_log++;
+	}
+
+    elog(DEBUG2, "number columns in log table: %i", number_columns_log);
 
-	if (use_session_user == 0)
+	if (info.shared == 1)
 	{
-		/* without session user */
-		if (number_columns_log != number_columns + 3 && number_columns_log != number_columns + 4)
+		/* shared log table: the row is logged as a whole */
+		if (SPI_fnumber(log_tupdesc, "trigger_relid") <= 0 ||
+			SPI_fnumber(log_tupdesc, "trigger_data") <= 0)
 		{
-			elog(ERROR, "number colums in relation %s(%d) does not match columns in %s(%d)",
-				 SPI_getrelname(trigdata->tg_relation), number_columns,
-				 log_table, number_columns_log);
+			elog(ERROR, "relation %s is not a shared log table", log_table);
 		}
 	}
 	else
 	{
-		/* with session user */
-		if (number_columns_log != number_columns + 3 + 1 && number_columns_log != number_columns + 4 + 1)
+		/*
+		 * check if the logtable has 3 (or now 4) columns more than our table
+		 * +1 if we should write the session user
+		 */
+
+		/* a keys_only log table has only the primary key columns */
+		if (info.keys_only == 1)
+		{
+			number_columns = list_length(info.keys);
+		}
+
+		if (use_session_user == 0)
+		{
+			/* without session user */
+			if (number_columns_log != number_columns + 3 && number_columns_log != number_columns + 4)
+			{
+				elog(ERROR, "number colums in relation %s(%d) does not match columns in %s(%d)",
+					 SPI_getrelname(trigdata->tg_relation), number_columns,
+					 log_table, number_columns_log);
+			}
+		}
+		else
 		{
-			elog(ERROR, "number colums in relation %s does not match columns in %s",
-				 SPI_getrelname(trigdata->tg_relation), log_table);
+			/* with session user */
+			if (number_columns_log != number_columns + 3 + 1 && number_columns_log != number_columns + 4 + 1)
+			{
+				elog(ERROR, "number colums in relation %s does not match columns in %s",
+					 SPI_getrelname(trigdata->tg_relation), log_table);
+			}
 		}
 	}
 
 	elog(DEBUG2, "log table OK");
+	TABLE_LOG_TRIGGER_LOGTABLE_DONE(relid, number_columns_log);
 	/* For each column in key ... */
 	elog(DEBUG2, "copy data ...");
 
@@ -252,25 +796,51 @@ Datum table_log(PG_FUNCTION_ARGS)
 		/* trigger called from INSERT */
 		elog(DEBUG2, "mode: INSERT -> new");
 
-		__table_log(trigdata, "INSERT", "new", trigdata->tg_trigtuple, number_columns, log_table, use_session_user, log_schema);
+		delta.bytes_logged += __table_log(trigdata, "INSERT", "new", trigdata->tg_trigtuple, number_columns, &info);
+		delta.rows_insert++;
 	}
 	else if (TRIGGER_FIRED_BY_UPDATE(trigdata->tg_event))
 	{
 		/* trigger called from UPDATE */
 		elog(DEBUG2, "mode: UPDATE -> old");
 
-		__table_log(trigdata, "UPDATE", "old", trigdata->tg_trigtuple, number_columns, log_table, use_session_user, log_schema);
+		delta.bytes_logged += __table_log(trigdata, "UPDATE", "old", trigdata->tg_trigtuple, number_columns, &info);
 
 		elog(DEBUG2, "mode: UPDATE -> new");
 
-		__table_log(trigdata, "UPDATE", "new", trigdata->tg_newtuple, number_columns, log_table, use_session_user, log_schema);
+		delta.bytes_logged += __table_log(trigdata, "UPDATE", "new", trigdata->tg_newtuple, number_columns, &info);
+		delta.rows_update++;
 	}
 	else if (TRIGGER_FIRED_BY_DELETE(trigdata->tg_event))
 	{
 		/* trigger called from DELETE */
 		elog(DEBUG2, "mode: DELETE -> old");
 
-		__table_log(trigdata, "DELETE", "old", trigdata->tg_trigtuple, number_columns, log_table, use_session_user, log_schema);
+		delta.bytes_logged += __table_log(trigdata, "DELETE", "old", trigdata->tg_trigtuple, number_columns, &info);
+		delta.rows_delete++;
+	}
+	else if (TRIGGER_FIRED_BY_TRUNCATE(trigdata->tg_event))
+	{
+		if (TRIGGER_FIRED_BEFORE(trigdata->tg_event))
+		{
+			/* trigger called before TRUNCATE */
+			elog(DEBUG2, "mode: TRUNCATE -> old");
+
+			/* the net changes so far come before the snapshot */
+			if (info.coalesce == 1)
+			{
+				__table_log_coalesce_flush(trigdata, number_columns, &info, &delta);
+			}
+
+			delta.rows_delete += __table_log_snapshot(trigdata->tg_relation, "TRUNCATE", "old", NULL, 1, &info);
+		}
+		else
+		{
+			/* trigger called after TRUNCATE */
+			elog(DEBUG2, "mode: TRUNCATE -> new");
+
+			__table_log_snapshot(trigdata->tg_relation, "TRUNCATE", "new", NULL, 0, &info);
+		}
 	}
 	else
 	{
@@ -285,1063 +855,4976 @@ Datum table_log(PG_FUNCTION_ARGS)
 	/* close SPI connection */
 	SPI_finish();
 
+	__table_log_trigger_done(trigdata, event_name, start_time, &delta);
+
 	/* return trigger data */
 	return PointerGetDatum(trigdata->tg_trigtuple);
 }
 
 /*
-__table_log()
+__table_log_trigger_done()
 
-helper function for table_log()
+the end of a table_log() call: count the changed primary key, see
+table_log_hot_keys(), and account the work done in shared memory
 
 parameter:
   - trigger data
-  - change mode (INSERT, UPDATE, DELETE)
-  - tuple to log (old, new)
-  - pointer to tuple
-  - number columns in table
-  - logging table
-  - flag for writing session user
+  - the event, for the probes
+  - start of the call
+  - statistics of the call
 return:
   none
 */
-static void __table_log (TriggerData *trigdata, char *changed_mode,
-						 char *changed_tuple, HeapTuple tuple,
-						 int number_columns, char *log_table,
-						 int use_session_user, char *log_schema)
+static void __table_log_trigger_done(TriggerData *trigdata, const char *event_name,
+									 instr_time start_time, TableLogCounters *delta)
 {
-	StringInfo query;
-	char      *before_char;
-	int        i;
-	int        col_nr;
-	int        found_col;
-	int        ret;
+	Oid            relid = RelationGetRelid(trigdata->tg_relation);
+	instr_time     duration;
 
-	elog(DEBUG2, "build query");
+	if (table_log_track_hot_keys && !TRIGGER_FIRED_BY_TRUNCATE(trigdata->tg_event))
+	{
+		__table_log_stats_key(trigdata->tg_relation,
+							  (TRIGGER_FIRED_BY_UPDATE(trigdata->tg_event) ?
+							   trigdata->tg_newtuple : trigdata->tg_trigtuple));
+	}
 
-	/* allocate memory */
-	query = makeStringInfo();
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, start_time);
+	delta->log_time = INSTR_TIME_GET_MILLISEC(duration);
+	delta->log_max_time = delta->log_time;
+	__table_log_stats_add(relid, delta);
 
-	/* build query */
-	appendStringInfo(query, "INSERT INTO %s.%s (",
-					 do_quote_ident(log_schema), do_quote_ident(log_table));
+	TABLE_LOG_TRIGGER_DONE(relid, event_name, delta->bytes_logged);
+}
 
-	/* add colum names */
-	col_nr = 0;
+/*
+__table_log_trigger_args()
 
-	for (i = 1; i <= number_columns; i++)
+parse the arguments of a table_log() trigger
+
+parameter:
+  - the logged relation
+  - the trigger
+  - pointer to the result
+return:
+  none
+*/
+static void __table_log_trigger_args(Relation rel, Trigger *trigger, TableLogTriggerInfo *info)
+{
+	if (trigger->tgnargs > 4)
 	{
-		col_nr++;
-		found_col = 0;
+		elog(ERROR, "table_log: too many arguments to trigger");
+	}
+
+	/* options, separated by comma */
+	info->shared = 0;
+	info->partitions = 0;
+	info->keys_only = 0;
+	info->keys = NIL;
+	info->compact = 0;
+	info->coalesce = 0;
+	if (trigger->tgnargs > 3)
+	{
+		char       *options = pstrdup(trigger->tgargs[3]);
+		char       *option;
 
-		do
+		for (option = strtok(options, ", "); option != NULL; option = strtok(NULL, ", "))
 		{
-			if (trigdata->tg_relation->rd_att->attrs[col_nr - 1]->attisdropped)
+			if (strcmp(option, "shared") == 0)
 			{
-				/* this column is dropped, skip it */
-				col_nr++;
-				continue;
+				info->shared = 1;
 			}
-			else
+			else if (strcmp(option, "keys_only") == 0)
 			{
-				found_col++;
+				info->keys_only = 1;
 			}
-		}
-		while (found_col == 0);
-
-		appendStringInfo(query,
-						 "%s, ",
-						 do_quote_ident(SPI_fname(trigdata->tg_relation->rd_att, col_nr)));
-	}
-
-	/* add session user */
-	if (use_session_user == 1)
-		appendStringInfo(query, "trigger_user, ");
-
-	/* add the 3 extra colum names */
-	appendStringInfo(query, "trigger_mode, trigger_tuple, trigger_changed) VALUES (");
-
-	/* add values */
-	col_nr = 0;
-	for (i = 1; i <= number_columns; i++)
-	{
-		col_nr++;
-		found_col = 0;
-
-		do
-		{
-			if (trigdata->tg_relation->rd_att->attrs[col_nr - 1]->attisdropped)
+			else if (strcmp(option, "compact") == 0)
 			{
-				/* this column is dropped, skip it */
-				col_nr++;
-				continue;
+				info->compact = 1;
+			}
+			else if (strcmp(option, "coalesce") == 0)
+			{
+				info->coalesce = 1;
+			}
+			else if (strncmp(option, "partitions=", 11) == 0)
+			{
+				info->partitions = atoi(option + 11);
+				if (info->partitions < 1)
+				{
+					elog(ERROR, "table_log: invalid option \"%s\"", option);
+				}
 			}
 			else
 			{
-				found_col++;
+				elog(ERROR, "table_log: unknown option \"%s\"", option);
 			}
 		}
-		while (found_col == 0);
 
-		before_char = SPI_getvalue(tuple, trigdata->tg_relation->rd_att, col_nr);
-		if (before_char == NULL)
-		{
-			appendStringInfo(query, "NULL, ");
-		}
-		else
+		pfree(options);
+	}
+
+	/* with keys_only only the primary key is logged */
+	if (info->keys_only == 1)
+	{
+		info->keys = __table_log_pkey_columns(rel);
+		if (info->keys == NIL)
 		{
-			appendStringInfo(query, "%s, ",
-							 do_quote_literal(before_char));
+			elog(ERROR, "table_log: option %s needs a primary key on table %s",
+				 "keys_only", RelationGetRelationName(rel));
 		}
 	}
 
-	/* add session user */
-	if (use_session_user == 1)
-		appendStringInfo(query, "SESSION_USER, ");
-
-	/* add the 3 extra values */
-	appendStringInfo(query, "%s, %s, NOW());",
-					 do_quote_literal(changed_mode), do_quote_literal(changed_tuple));
-
-	elog(DEBUG3, "query: %s", query->data);
-	elog(DEBUG2, "execute query");
+	/* coalesce identifies the rows by it, see __table_log_coalesce_add() */
+	if (info->coalesce == 1 && __table_log_key_columns(rel)->nkeys == 0)
+	{
+		elog(ERROR, "table_log: option %s needs a primary key on table %s",
+			 "coalesce", RelationGetRelationName(rel));
+	}
 
-	/* execute insert */
-	ret = SPI_exec(query->data, 0);
-	if (ret != SPI_OK_INSERT)
+	/* name of the log schema, if no argument is given use the schema of the table */
+	if (trigger->tgnargs > 2)
 	{
-		elog(ERROR, "could not insert log information into relation %s (error: %d)", log_table, ret);
+		info->log_schema = pstrdup(trigger->tgargs[2]);
+	}
+	else
+	{
+		info->log_schema = get_namespace_name(RelationGetNamespace(rel));
 	}
 
-	/* clean up */
-	pfree(query->data);
-	pfree(query);
+	/* should we write the current user? */
+	info->use_session_user = 0;
+	if (trigger->tgnargs > 1 && atoi(trigger->tgargs[1]) == 1)
+	{
+		info->use_session_user = 1;
+	}
 
-	elog(DEBUG2, "done");
+	/* name of the log table, if no argument is given use 'table name' + '_log' */
+	if (trigger->tgnargs > 0)
+	{
+		info->log_table = pstrdup(trigger->tgargs[0]);
+	}
+	else
+	{
+		info->log_table = (char *) palloc(strlen(RelationGetRelationName(rel)) + 5);
+		sprintf(info->log_table, "%s_log", RelationGetRelationName(rel));
+	}
 }
 
-
-#ifdef FUNCAPI_H_not_implemented
 /*
-table_log_show_column()
+__table_log_trigger_option()
 
-show a single column on a date in the past
+check for an option of a table_log() trigger, without parsing all the
+arguments like __table_log_trigger_args()
 
 parameter:
-  not yet defined
+  - the trigger
+  - name of the option
 return:
-  not yet defined
+  - true, if the option is given
 */
-Datum table_log_show_column(PG_FUNCTION_ARGS)
+static bool __table_log_trigger_option(Trigger *trigger, const char *name)
 {
-	TriggerData    *trigdata = (TriggerData *) fcinfo->context;
-	int            ret;
-
-	/*
-	 * Some checks first...
-	 */
-	elog(DEBUG2, "start table_log_show_column()");
+	char       *options;
+	char       *option;
+	bool        found = false;
 
-	/* Connect to SPI manager */
-	ret = SPI_connect();
-	if (ret != SPI_OK_CONNECT)
+	if (trigger->tgnargs < 4)
 	{
-		elog(ERROR, "table_log_show_column: SPI_connect returned %d", ret);
+		return false;
 	}
 
-	elog(DEBUG2, "this function isnt available yet");
+	options = pstrdup(trigger->tgargs[3]);
+	for (option = strtok(options, ", "); option != NULL; option = strtok(NULL, ", "))
+	{
+		if (strcmp(option, name) == 0)
+		{
+			found = true;
+			break;
+		}
+	}
+	pfree(options);
 
-	/* close SPI connection */
-	SPI_finish();
-	return PG_RETURN_NULL;
+	return found;
 }
-#endif /* FUNCAPI_H */
 
+/*
+__table_log_find_trigger()
+
+find the table_log() trigger of a relation
+
+parameter:
+  - the logged relation
+  - pointer to the result
+return:
+  - false, if the relation has no table_log() trigger
+*/
+static bool __table_log_find_trigger(Relation rel, TableLogTriggerInfo *info)
+{
+	TriggerDesc    *trigdesc = rel->trigdesc;
+	int            i;
+
+	if (trigdesc == NULL)
+	{
+		return false;
+	}
+
+	for (i = 0; i < trigdesc->numtriggers; i++)
+	{
+		Trigger    *trigger = &trigdesc->triggers[i];
+		char       *func_name;
+
+		if (!TRIGGER_FOR_ROW(trigger->tgtype))
+		{
+			continue;
+		}
+
+		func_name = get_func_name(trigger->tgfoid);
+		if (func_name == NULL || strcmp(func_name, "table_log") != 0)
+		{
+			continue;
+		}
+
+		__table_log_trigger_args(rel, trigger, info);
+		return true;
+	}
+
+	return false;
+}
 
 /*
-table_log_restore_table()
+__table_log_pkey_columns()
 
-restore a complete table based on the logging table
+get the columns of the primary key of a relation
 
 parameter:
-  - original table name
-  - name of primary key in original table
-  - logging table
-  - name of primary key in logging table
-  - restore table name
-  - timestamp for restoring data
-  - primary key to restore (only this key will be restored) (optional)
-  - restore mode
-    0: restore from blank table (default)
-       needs a complete logging table
-    1: restore from actual table backwards
-  - dont create table temporarly
-    0: create restore table temporarly (default)
-    1: create restore table not temporarly
-  return:
-    not yet defined
+  - the relation
+return:
+  - list of column names, NIL if the relation has no primary key
 */
-Datum table_log_restore_table(PG_FUNCTION_ARGS)
+static List *__table_log_pkey_columns(Relation rel)
 {
-	/* the original table name */
-	char  *table_orig;
-	/* the primary key in the original table */
-	char  *table_orig_pkey;
-	/* number columns in original table */
-	int  table_orig_columns = 0;
-	/* the log table name */
-	char  *table_log;
-	/* the primary key in the log table (usually trigger_id) */
-	/* cannot be the same then then the pkey in the original table */
-	char  *table_log_pkey;
-	/* number columns in log table */
-	int  table_log_columns = 0;
-	/* the restore table name */
-	char  *table_restore;
-	/* the timestamp in past */
-	Datum      timestamp = PG_GETARG_DATUM(5);
-	/* the single pkey, can be null (then all keys will be restored) */
-	char  *search_pkey = "";
-	/* the restore method
-	   - 0: restore from blank table (default)
-	   needs a complete log table!
-	   - 1: restore from actual table backwards
-	*/
-	int            method = 0;
-	/* dont create restore table temporarly
-	   - 0: create restore table temporarly (default)
-	   - 1: dont create restore table temporarly
-	*/
-	int            not_temporarly = 0;
-	int            ret, results, i, number_columns;
+	List           *indexes;
+	ListCell       *lc;
+	List           *result = NIL;
 
-    /*
-	 * for getting table infos
-	 */
-	StringInfo     query;
+	indexes = RelationGetIndexList(rel);
 
-	int            need_search_pkey = 0;          /* does we have a single key to restore? */
-	char           *tmp, *timestamp_string, *old_pkey_string = "";
-	char           *trigger_mode;
-	char           *trigger_tuple;
-	char           *trigger_changed;
-	SPITupleTable  *spi_tuptable = NULL;          /* for saving query results */
-	VarChar        *return_name;
+	foreach(lc, indexes)
+	{
+		Oid            index_oid = lfirst_oid(lc);
+		HeapTuple      index_tuple;
+		Form_pg_index  index;
+		int            i;
 
-	/* memory for dynamic query */
-	StringInfo      d_query;
+		index_tuple = SearchSysCache1(INDEXRELID, ObjectIdGetDatum(index_oid));
+		if (!HeapTupleIsValid(index_tuple))
+		{
+			elog(ERROR, "cache lookup failed for index %u", index_oid);
+		}
+		index = (Form_pg_index) GETSTRUCT(index_tuple);
 
-	/* memory for column names */
-	StringInfo      col_query;
+		if (index->indisprimary)
+		{
+			for (i = 0; i < index->indnatts; i++)
+			{
+				result = lappend(result,
+								 pstrdup(NameStr(rel->rd_att->attrs[index->indkey.values[i] - 1]->attname)));
+			}
+		}
 
-	int      col_pkey = 0;
+		ReleaseSysCache(index_tuple);
 
-	/*
-	 * Some checks first...
-	 */
-	elog(DEBUG2, "start table_log_restore_table()");
+		if (result != NIL)
+		{
+			break;
+		}
+	}
 
-  /* does we have all arguments? */
-	if (PG_ARGISNULL(0))
+	list_free(indexes);
+
+	return result;
+}
+
+/*
+__table_log_relation_name()
+
+parameter:
+  - the relation
+return:
+  - the quoted and schema qualified name of the relation
+*/
+static char *__table_log_relation_name(Relation rel)
+{
+	StringInfo     name = makeStringInfo();
+
+	appendStringInfo(name, "%s.%s",
+					 do_quote_ident(get_namespace_name(RelationGetNamespace(rel))),
+					 do_quote_ident(RelationGetRelationName(rel)));
+
+	return name->data;
+}
+
+/*
+__table_log_insert_target()
+
+the table the log entries of this backend are written into: the log
+table, or with the option partitions=N one of its N child tables,
+chosen by the backend id. The writers are spread over the child tables
+and their indexes, readers of the log table see all of them.
+
+parameter:
+  - trigger arguments
+return:
+  - the quoted and schema qualified table name
+*/
+static char *__table_log_insert_target(TableLogTriggerInfo *info)
+{
+	StringInfo     name;
+
+	name = makeStringInfo();
+	if (info->partitions > 0)
 	{
-		elog(ERROR, "table_log_restore_table: missing original table name");
+		char       *partition;
+
+		partition = psprintf("%s_p%d", info->log_table, MyBackendId % info->partitions);
+		appendStringInfo(name, "%s.%s", do_quote_ident(info->log_schema), do_quote_ident(partition));
 	}
-	if (PG_ARGISNULL(1))
+	else
 	{
-		elog(ERROR, "table_log_restore_table: missing primary key name for original table");
+		appendStringInfo(name, "%s.%s", do_quote_ident(info->log_schema), do_quote_ident(info->log_table));
 	}
-	if (PG_ARGISNULL(2))
+
+	return name->data;
+}
+
+/*
+__table_log_logged_table()
+
+checks for the functions working directly on a logged table: the table
+must have a table_log() trigger and a primary key, and the log table
+needs a trigger_id column to get the order of the log entries
+
+parameter:
+  - the logged relation
+  - name of the calling function, for error messages
+  - pointer to the list of primary key columns (result)
+  - true if the caller needs the whole rows, not only the keys
+  - pointer to the oid of the log table (result)
+return:
+  - the quoted and schema qualified name of the log table, for a shared
+    log table a subquery with the entries of this table
+*/
+static char *__table_log_logged_table(Relation rel, const char *caller, List **pkey, bool need_rows, Oid *log_relid)
+{
+	TableLogTriggerInfo info;
+	StringInfo     name;
+
+	if (!__table_log_find_trigger(rel, &info))
 	{
-		elog(ERROR, "table_log_restore_table: missing log table name");
+		elog(ERROR, "%s: table %s is not logged by table_log()",
+			 caller, RelationGetRelationName(rel));
 	}
-	if (PG_ARGISNULL(3))
+
+	*pkey = __table_log_pkey_columns(rel);
+	if (*pkey == NIL)
 	{
-		elog(ERROR, "table_log_restore_table: missing primary key name for log table");
+		elog(ERROR, "%s: table %s has no primary key",
+			 caller, RelationGetRelationName(rel));
 	}
-	if (PG_ARGISNULL(4))
+
+	*log_relid = get_relname_relid(info.log_table, get_namespace_oid(info.log_schema, false));
+	if (!OidIsValid(*log_relid))
 	{
-		elog(ERROR, "table_log_restore_table: missing copy table name");
+		elog(ERROR, "%s: log table %s.%s does not exist",
+			 caller, info.log_schema, info.log_table);
 	}
-	if (PG_ARGISNULL(5))
+	if (get_attnum(*log_relid, "trigger_id") == InvalidAttrNumber)
 	{
-		elog(ERROR, "table_log_restore_table: missing timestamp");
+		elog(ERROR, "%s: log table %s.%s has no column trigger_id",
+			 caller, info.log_schema, info.log_table);
+	}
+	if (need_rows && info.keys_only == 1)
+	{
+		elog(ERROR, "%s: log table %s.%s has only the primary key columns (keys_only)",
+			 caller, info.log_schema, info.log_table);
 	}
 
-	/* first check number arguments to avoid an segfault */
-	if (PG_NARGS() >= 7)
+	name = makeStringInfo();
+	if (info.shared == 1)
 	{
-		/* if argument is given, check if not null */
-		if (!PG_ARGISNULL(6))
-		{
-			/* yes, fetch it */
-			search_pkey = __table_log_varcharout((VarChar *)PG_GETARG_VARCHAR_P(6));
+		/* expand the logged rows of this table into the layout of a normal log table */
+		appendStringInfo(name,
+						 "(SELECT (l.trigger_data::%s).*, l.trigger_mode, l.trigger_tuple, "
+						 "l.trigger_changed, l.trigger_id FROM %s.%s l WHERE l.trigger_relid = %u)",
+						 __table_log_relation_name(rel),
+						 do_quote_ident(info.log_schema), do_quote_ident(info.log_table),
+						 RelationGetRelid(rel));
+	}
+	else if (info.compact == 1)
+	{
+		/* decode trigger_op into the columns of a normal log table */
+		appendStringInfo(name,
+						 "(SELECT l.*, %s AS trigger_mode, %s AS trigger_tuple FROM %s.%s l)",
+						 TABLE_LOG_OP_MODE_EXPR, TABLE_LOG_OP_TUPLE_EXPR,
+						 do_quote_ident(info.log_schema), do_quote_ident(info.log_table));
+	}
+	else
+	{
+		appendStringInfo(name, "%s.%s", do_quote_ident(info.log_schema), do_quote_ident(info.log_table));
+	}
 
-			/* and check, if we have an argument */
-			if (strlen(search_pkey) > 0)
-			{
-				need_search_pkey = 1;
-				elog(DEBUG2, "table_log_restore_table: will restore a single key");
-			}
-		}
-	} /* nargs >= 7 */
+	return name->data;
+}
 
-	/* same procedere here */
-	if (PG_NARGS() >= 8)
-	{
-		if (!PG_ARGISNULL(7))
-		{
-			method = PG_GETARG_INT32(7);
+/*
+__table_log_extension_table()
 
-			if (method > 0)
-			{
-				method = 1;
-			}
-			else
-			{
-				method = 0;
-			}
-		}
-	} /* nargs >= 8 */
+the name of a table of the extension, qualified with the schema the
+extension is installed in, so it is found without the search_path
 
-	if (method == 1)
-		elog(DEBUG2, "table_log_restore_table: will restore from actual state backwards");
-	else
-		elog(DEBUG2, "table_log_restore_table: will restore from begin forward");
+parameter:
+  - name of the table
+return:
+  - the quoted and schema qualified name, NULL if the extension is not
+    installed (table_log.so used without CREATE EXTENSION)
+note:
+  - needs SPI
+*/
+static char *__table_log_extension_table(const char *name)
+{
+	int            ret;
 
-	if (PG_NARGS() >= 9)
+	ret = SPI_exec("SELECT quote_ident(n.nspname) FROM pg_catalog.pg_extension e, pg_catalog.pg_namespace n "
+				   "WHERE e.extname = 'table_log' AND n.oid = e.extnamespace", 1);
+	if (ret != SPI_OK_SELECT)
 	{
-		if (!PG_ARGISNULL(8))
-		{
-			not_temporarly = PG_GETARG_INT32(8);
+		elog(ERROR, "could not find schema of extension table_log");
+	}
+	if (SPI_processed == 0)
+	{
+		return NULL;
+	}
 
-			if (not_temporarly > 0)
-			{
-				not_temporarly = 1;
-				elog(DEBUG2, "table_log_restore_table: dont create restore table temporarly");
-			}
-			else
-			{
-				not_temporarly = 0;
-			}
-		}
- 	} /* nargs >= 9 */
+	return psprintf("%s.%s", SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1),
+					do_quote_ident((char *) name));
+}
 
-	/* get parameter */
-	table_orig = __table_log_varcharout((VarChar *)PG_GETARG_VARCHAR_P(0));
-	table_orig_pkey = __table_log_varcharout((VarChar *)PG_GETARG_VARCHAR_P(1));
-	table_log = __table_log_varcharout((VarChar *)PG_GETARG_VARCHAR_P(2));
-	table_log_pkey = __table_log_varcharout((VarChar *)PG_GETARG_VARCHAR_P(3));
-	table_restore = __table_log_varcharout((VarChar *)PG_GETARG_VARCHAR_P(4));
+/*
+__table_log_relname_relid()
 
-	/* pkey of original table cannot be the same as of log table */
-	if (strcmp((const char *)table_orig_pkey, (const char *)table_log_pkey) == 0)
+the oid of a table given by name to the restore functions: the name as
+it is (like the restore resolves it), else as a qualified and possibly
+quoted name ("schema"."table")
+
+parameter:
+  - name of the table
+return:
+  - the oid, InvalidOid if there is no such table
+*/
+static Oid __table_log_relname_relid(const char *name)
+{
+	Oid            relid;
+	List           *names;
+
+	relid = RelnameGetRelid(name);
+	if (OidIsValid(relid))
 	{
-		elog(ERROR, "pkey of logging table cannot be the pkey of the original table: %s <-> %s",
-			 table_orig_pkey, table_log_pkey);
+		return relid;
 	}
 
-	/* Connect to SPI manager */
-	ret = SPI_connect();
+#if PG_VERSION_NUM >= 160000
+	names = stringToQualifiedNameList(name, NULL);
+#else
+	names = stringToQualifiedNameList(name);
+#endif
 
-	if (ret != SPI_OK_CONNECT)
+	return RangeVarGetRelid(makeRangeVarFromNameList(names), NoLock, true);
+}
+
+/*
+__table_log_check_archive()
+
+entries moved away by table_log_archive() are not in the log table
+anymore, a function replaying the log up to or from a timestamp before
+the newest archived entry would silently work with a part of the log
+
+parameter:
+  - oid of the log table
+  - the timestamp the caller replays the log to or from
+  - true if the caller replays the whole log, regardless of the timestamp
+  - name of the calling function, for error messages
+note:
+  - needs SPI
+  - raises an error if archived entries are needed
+*/
+static void __table_log_check_archive(Oid log_relid, Datum timestamp, bool whole_log, const char *caller)
+{
+	char           *segment_table;
+	StringInfo     query;
+	Oid            argtypes[2] = { OIDOID, TIMESTAMPTZOID };
+	Datum          values[2];
+	bool           isnull;
+	bool           needed;
+	int            ret;
+
+	segment_table = __table_log_extension_table("table_log_archive_segment");
+	if (segment_table == NULL)
 	{
-		elog(ERROR, "table_log_restore_table: SPI_connect returned %d", ret);
+		return;
 	}
 
-	/* check original table */
 	query = makeStringInfo();
 	appendStringInfo(query,
-					 "SELECT a.attname FROM pg_class c, pg_attribute a WHERE c.relname = %s AND a.attnum > 0 AND a.attrelid = c.oid ORDER BY a.attnum",
-					 do_quote_literal(table_orig));
+					 "SELECT max(max_changed), max(max_changed) >= $2 FROM %s "
+					 "WHERE log_table = (SELECT quote_ident(n.nspname) || '.' || quote_ident(c.relname) "
+					 "FROM pg_catalog.pg_class c, pg_catalog.pg_namespace n WHERE c.oid = $1 AND n.oid = c.relnamespace)",
+					 segment_table);
 
 	elog(DEBUG3, "query: %s", query->data);
 
-	ret = SPI_exec(query->data, 0);
-
-	if (ret != SPI_OK_SELECT)
+	values[0] = ObjectIdGetDatum(log_relid);
+	values[1] = timestamp;
+	ret = SPI_execute_with_args(query->data, 2, argtypes, values, NULL, true, 1);
+	if (ret != SPI_OK_SELECT || SPI_processed != 1)
 	{
-		elog(ERROR, "could not check relation: %s", table_orig);
+		elog(ERROR, "%s: could not check archived entries", caller);
 	}
 
-	if (SPI_processed > 0)
+	SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull);
+	if (isnull)
 	{
-		table_orig_columns = SPI_processed;
-	} else {
-		elog(ERROR, "could not check relation: %s", table_orig);
+		/* nothing archived */
+		return;
+	}
+	needed = DatumGetBool(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 2, &isnull));
+	if (whole_log || needed)
+	{
+		elog(ERROR, "%s: log table %s has archived entries in the range, run table_log_unarchive() first",
+			 caller, get_rel_name(log_relid));
 	}
 
-	/* check pkey in original table */
-	resetStringInfo(query);
-	appendStringInfo(query,
-					 "SELECT a.attname FROM pg_class c, pg_attribute a WHERE c.relname=%s AND c.relkind='r' AND a.attname=%s AND a.attnum > 0 AND a.attrelid = c.oid",
-					 do_quote_literal(table_orig), do_quote_literal(table_orig_pkey));
+	pfree(query->data);
+	pfree(query);
+}
+
+/*
+__table_log_op_code()
+
+the code of a log entry in the trigger_op column of a compact log table:
+the first letter of the mode, upper case for 'new' and lower case for
+'old' entries (I, u, U, d, t, T, b, B)
+
+parameter:
+  - change mode (INSERT, UPDATE, DELETE, TRUNCATE, BULK)
+  - tuple (old, new)
+return:
+  - the code
+*/
+static char __table_log_op_code(const char *changed_mode, const char *changed_tuple)
+{
+	if (strcmp(changed_tuple, "new") == 0)
+	{
+		return changed_mode[0];
+	}
+
+	return tolower((unsigned char) changed_mode[0]);
+}
+
+/*
+__table_log_append_extra()
+
+append the values of the extra columns of a log entry: the session user
+(if logged), mode and tuple, and the time of the change. A compact log
+table gets the oid of the session user and the code of mode and tuple.
+
+parameter:
+  - the query
+  - change mode (INSERT, UPDATE, DELETE, TRUNCATE, BULK)
+  - tuple (old, new)
+  - trigger arguments
+return:
+  none
+*/
+static void __table_log_append_extra(StringInfo query, char *changed_mode, char *changed_tuple,
+									 TableLogTriggerInfo *info)
+{
+	if (info->compact == 1)
+	{
+		if (info->use_session_user == 1)
+			appendStringInfo(query, "%u, ", GetSessionUserId());
+
+		appendStringInfo(query, "'%c', NOW()", __table_log_op_code(changed_mode, changed_tuple));
+	}
+	else
+	{
+		if (info->use_session_user == 1)
+			appendStringInfo(query, "SESSION_USER, ");
+
+		appendStringInfo(query, "%s, %s, NOW()",
+						 do_quote_literal(changed_mode), do_quote_literal(changed_tuple));
+	}
+}
+
+/*
+__table_log()
+
+helper function for table_log()
+
+parameter:
+  - trigger data
+  - change mode (INSERT, UPDATE, DELETE)
+  - tuple to log (old, new)
+  - pointer to tuple
+  - number columns in table
+  - trigger arguments (log table, flag for writing session user, ...)
+return:
+  number of bytes in the logged values
+*/
+static int64 __table_log (TriggerData *trigdata, char *changed_mode,
+						 char *changed_tuple, HeapTuple tuple,
+						 int number_columns, TableLogTriggerInfo *info)
+{
+	StringInfo query;
+	char      *before_char;
+	char      *log_table = info->log_table;
+	int        use_session_user = info->use_session_user;
+	int        i;
+	int        col_nr;
+	int        found_col;
+	int        ret;
+	int64      bytes = 0;
+
+	TABLE_LOG_ROW_START(RelationGetRelid(trigdata->tg_relation), changed_mode, changed_tuple);
+
+	if (info->shared == 1)
+	{
+		return __table_log_shared(trigdata, changed_mode, changed_tuple, tuple, info);
+	}
+
+	elog(DEBUG2, "build query");
+
+	/* allocate memory */
+	query = makeStringInfo();
+
+	/* build query */
+	appendStringInfo(query, "INSERT INTO %s (", __table_log_insert_target(info));
+
+	/* add colum names */
+	col_nr = 0;
+
+	for (i = 1; i <= number_columns; i++)
+	{
+		if (info->keys_only == 1)
+		{
+			/* only the primary key, independent of the width of the row */
+			col_nr = SPI_fnumber(trigdata->tg_relation->rd_att, (char *) list_nth(info->keys, i - 1));
+		}
+		else
+		{
+			col_nr++;
+			found_col = 0;
+
+			do
+			{
+				if (trigdata->tg_relation->rd_att->attrs[col_nr - 1]->attisdropped)
+				{
+					/* this column is dropped, skip it */
+					col_nr++;
+					continue;
+				}
+				else
+				{
+					found_col++;
+				}
+			}
+			while (found_col == 0);
+		}
+
+		appendStringInfo(query,
+						 "%s, ",
+						 do_quote_ident(SPI_fname(trigdata->tg_relation->rd_att, col_nr)));
+	}
+
+	/* add session user */
+	if (use_session_user == 1)
+		appendStringInfo(query, "trigger_user, ");
+
+	/* add the 3 extra colum names */
+	appendStringInfo(query, "%s, trigger_changed) VALUES (",
+					 (info->compact == 1 ? "trigger_op" : "trigger_mode, trigger_tuple"));
+
+	/* add values */
+	col_nr = 0;
+	for (i = 1; i <= number_columns; i++)
+	{
+		if (info->keys_only == 1)
+		{
+			/* only the primary key, independent of the width of the row */
+			col_nr = SPI_fnumber(trigdata->tg_relation->rd_att, (char *) list_nth(info->keys, i - 1));
+		}
+		else
+		{
+			col_nr++;
+			found_col = 0;
+
+			do
+			{
+				if (trigdata->tg_relation->rd_att->attrs[col_nr - 1]->attisdropped)
+				{
+					/* this column is dropped, skip it */
+					col_nr++;
+					continue;
+				}
+				else
+				{
+					found_col++;
+				}
+			}
+			while (found_col == 0);
+		}
+
+		before_char = SPI_getvalue(tuple, trigdata->tg_relation->rd_att, col_nr);
+		if (before_char == NULL)
+		{
+			appendStringInfo(query, "NULL, ");
+		}
+		else
+		{
+			__table_log_append_literal(query, before_char);
+			appendStringInfoString(query, ", ");
+			bytes += strlen(before_char);
+		}
+	}
+
+	/* add session user and the 3 extra values */
+	__table_log_append_extra(query, changed_mode, changed_tuple, info);
+	appendStringInfo(query, ");");
+
+	elog(DEBUG3, "query: %s", query->data);
+	elog(DEBUG2, "execute query");
+
+	TABLE_LOG_ROW_QUERY_DONE(RelationGetRelid(trigdata->tg_relation), changed_mode, changed_tuple, bytes);
+
+	/* execute insert */
+	ret = SPI_exec(query->data, 0);
+	if (ret != SPI_OK_INSERT)
+	{
+		elog(ERROR, "could not insert log information into relation %s (error: %d)", log_table, ret);
+	}
+
+	TABLE_LOG_ROW_DONE(RelationGetRelid(trigdata->tg_relation), changed_mode, changed_tuple, bytes);
+
+	/* clean up */
+	pfree(query->data);
+	pfree(query);
+
+	elog(DEBUG2, "done");
+
+	return bytes;
+}
+
+
+/*
+__table_log_shared()
+
+helper function for table_log(), for shared log tables
+
+the row is logged as a whole in text form (trigger_data), together
+with the oid of the table (trigger_relid)
+
+parameter:
+  - trigger data
+  - change mode (INSERT, UPDATE, DELETE)
+  - tuple to log (old, new)
+  - pointer to tuple
+  - trigger arguments
+return:
+  number of bytes in the logged values
+*/
+static int64 __table_log_shared (TriggerData *trigdata, char *changed_mode,
+								char *changed_tuple, HeapTuple tuple,
+								TableLogTriggerInfo *info)
+{
+	StringInfo query;
+	char      *row_data;
+	int        ret;
+
+	/* the row in the text form of the row type of the table */
+	row_data = OidOutputFunctionCall(F_RECORD_OUT,
+									 heap_copy_tuple_as_datum(tuple, trigdata->tg_relation->rd_att));
+
+	query = makeStringInfo();
+	appendStringInfo(query, "INSERT INTO %s.%s (trigger_relid, trigger_data, ",
+					 do_quote_ident(info->log_schema), do_quote_ident(info->log_table));
+
+	/* add session user */
+	if (info->use_session_user == 1)
+		appendStringInfo(query, "trigger_user, ");
+
+	appendStringInfo(query, "trigger_mode, trigger_tuple, trigger_changed) VALUES (%u, ",
+					 RelationGetRelid(trigdata->tg_relation));
+	__table_log_append_literal(query, row_data);
+	appendStringInfoString(query, ", ");
+
+	if (info->use_session_user == 1)
+		appendStringInfo(query, "SESSION_USER, ");
+
+	appendStringInfo(query, "%s, %s, NOW());",
+					 do_quote_literal(changed_mode), do_quote_literal(changed_tuple));
+
+	elog(DEBUG3, "query: %s", query->data);
+
+	TABLE_LOG_ROW_QUERY_DONE(RelationGetRelid(trigdata->tg_relation), changed_mode, changed_tuple,
+							 (int64) strlen(row_data));
+
+	ret = SPI_exec(query->data, 0);
+	if (ret != SPI_OK_INSERT)
+	{
+		elog(ERROR, "could not insert log information into relation %s (error: %d)", info->log_table, ret);
+	}
+
+	TABLE_LOG_ROW_DONE(RelationGetRelid(trigdata->tg_relation), changed_mode, changed_tuple,
+					   (int64) strlen(row_data));
+
+	pfree(query->data);
+	pfree(query);
+
+	return strlen(row_data);
+}
+
+/*
+__table_log_snapshot()
+
+log many rows of a table with a single statement, or a marker entry
+without data
+
+used for TRUNCATE: before the TRUNCATE all rows of the table are logged
+as 'old', the snapshot is needed to restore backwards over the TRUNCATE.
+After the TRUNCATE one 'new' entry without data marks the point where
+the table was emptied.
+
+used for the bulk mode: table_log_begin_bulk() logs the rows as 'old',
+table_log_end_bulk() logs them again as 'new'.
+
+parameter:
+  - the logged relation
+  - change mode (TRUNCATE, BULK)
+  - tuple to log (old, new)
+  - condition for the rows to log, or NULL for all rows
+  - 1: log the rows, 0: write a marker without data
+  - trigger arguments
+return:
+  number of logged rows
+*/
+static int64 __table_log_snapshot (Relation rel, char *changed_mode, char *changed_tuple,
+								  char *where, int with_data, TableLogTriggerInfo *info)
+{
+	StringInfo query;
+	StringInfo columns;
+	ListCell   *lc;
+	int        i;
+	int        ret;
+
+	query = makeStringInfo();
+	appendStringInfo(query, "INSERT INTO %s (", __table_log_insert_target(info));
+
+	columns = makeStringInfo();
+	if (with_data)
+	{
+		if (info->shared == 1)
+		{
+			appendStringInfo(columns, "trigger_relid, trigger_data, ");
+		}
+		else if (info->keys_only == 1)
+		{
+			foreach(lc, info->keys)
+			{
+				appendStringInfo(columns, "%s, ", do_quote_ident((char *) lfirst(lc)));
+			}
+		}
+		else
+		{
+			for (i = 0; i < rel->rd_att->natts; i++)
+			{
+				if (rel->rd_att->attrs[i]->attisdropped)
+				{
+					continue;
+				}
+				appendStringInfo(columns, "%s, ",
+								 do_quote_ident(NameStr(rel->rd_att->attrs[i]->attname)));
+			}
+		}
+	}
+	else if (info->shared == 1)
+	{
+		appendStringInfo(columns, "trigger_relid, ");
+	}
+
+	appendStringInfo(query, "%s", columns->data);
+
+	/* add session user */
+	if (info->use_session_user == 1)
+		appendStringInfo(query, "trigger_user, ");
+
+	appendStringInfo(query, "%s, trigger_changed) ",
+					 (info->compact == 1 ? "trigger_op" : "trigger_mode, trigger_tuple"));
+
+	if (with_data)
+	{
+		if (info->shared == 1)
+		{
+			appendStringInfo(query, "SELECT %u, t::text, ", RelationGetRelid(rel));
+		}
+		else
+		{
+			appendStringInfo(query, "SELECT %s", columns->data);
+		}
+	}
+	else if (info->shared == 1)
+	{
+		appendStringInfo(query, "VALUES (%u, ", RelationGetRelid(rel));
+	}
+	else
+	{
+		appendStringInfo(query, "VALUES (");
+	}
+
+	__table_log_append_extra(query, changed_mode, changed_tuple, info);
+
+	if (with_data)
+	{
+		appendStringInfo(query, " FROM ONLY %s t", __table_log_relation_name(rel));
+		if (where != NULL)
+		{
+			appendStringInfo(query, " WHERE (%s)", where);
+		}
+	}
+	else
+	{
+		appendStringInfo(query, ")");
+	}
 
 	elog(DEBUG3, "query: %s", query->data);
 
 	ret = SPI_exec(query->data, 0);
+	if (ret != SPI_OK_INSERT)
+	{
+		elog(ERROR, "could not insert log information into relation %s (error: %d)", info->log_table, ret);
+	}
+
+	pfree(query->data);
+	pfree(query);
+
+	return (with_data ? SPI_processed : 0);
+}
+
+/*
+__table_log_bulk_find()
+
+find a table in bulk mode
+
+parameter:
+  - oid of the table
+return:
+  - the entry, NULL if the table is not in bulk mode
+*/
+static TableLogBulk *__table_log_bulk_find(Oid relid)
+{
+	ListCell       *lc;
+
+	foreach(lc, table_log_bulk)
+	{
+		TableLogBulk   *bulk = (TableLogBulk *) lfirst(lc);
+
+		/* ended, but not yet committed */
+		if (bulk->end_subid != InvalidSubTransactionId)
+		{
+			continue;
+		}
+
+		if (bulk->relid == relid)
+		{
+			return bulk;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * __table_log_bulk_at_end()
+ * The bulk mode of a table starts and ends with the commit of the
+ * (sub)transaction which called table_log_begin_bulk() or
+ * table_log_end_bulk(), together with the snapshot written by the call:
+ * on abort a started bulk mode is dropped again and an ended one goes on,
+ * on commit of a subtransaction the parent takes over. The session lock
+ * of a table is released when the bulk mode is dropped.
+ * subid is InvalidSubTransactionId for the top transaction.
+ */
+static void __table_log_bulk_at_end(bool commit, SubTransactionId subid, SubTransactionId parent)
+{
+	bool           top = (subid == InvalidSubTransactionId);
+	MemoryContext  oldcontext;
+	List          *keep = NIL;
+	ListCell      *lc;
+
+	if (table_log_bulk == NIL)
+	{
+		return;
+	}
+
+	oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+
+	foreach(lc, table_log_bulk)
+	{
+		TableLogBulk   *bulk = (TableLogBulk *) lfirst(lc);
+		bool            drop;
+
+		if (commit && top)
+		{
+			drop = (bulk->end_subid != InvalidSubTransactionId);
+			bulk->begin_subid = InvalidSubTransactionId;
+		}
+		else if (commit)
+		{
+			drop = false;
+			if (bulk->begin_subid == subid)
+				bulk->begin_subid = parent;
+			if (bulk->end_subid == subid)
+				bulk->end_subid = parent;
+		}
+		else
+		{
+			drop = (bulk->begin_subid != InvalidSubTransactionId &&
+					(top || bulk->begin_subid == subid));
+			if (bulk->end_subid != InvalidSubTransactionId &&
+				(top || bulk->end_subid == subid))
+				bulk->end_subid = InvalidSubTransactionId;
+		}
+
+		if (drop)
+		{
+			UnlockRelationIdForSession(&bulk->lockid, ShareRowExclusiveLock);
+			if (bulk->where != NULL)
+				pfree(bulk->where);
+			pfree(bulk);
+			continue;
+		}
+
+		keep = lappend(keep, bulk);
+	}
+
+	list_free(table_log_bulk);
+	table_log_bulk = keep;
+
+	MemoryContextSwitchTo(oldcontext);
+}
+
+static void __table_log_bulk_xact_callback(XactEvent event, void *arg)
+{
+	ListCell      *lc;
+
+	switch (event)
+	{
+		case XACT_EVENT_PRE_PREPARE:
+			foreach(lc, table_log_bulk)
+			{
+				TableLogBulk   *bulk = (TableLogBulk *) lfirst(lc);
+
+				if (bulk->begin_subid != InvalidSubTransactionId ||
+					bulk->end_subid != InvalidSubTransactionId)
+				{
+					elog(ERROR, "cannot PREPARE a transaction which started or ended a bulk mode");
+				}
+			}
+			break;
+		case XACT_EVENT_COMMIT:
+			__table_log_bulk_at_end(true, InvalidSubTransactionId, InvalidSubTransactionId);
+			break;
+		case XACT_EVENT_ABORT:
+			__table_log_bulk_at_end(false, InvalidSubTransactionId, InvalidSubTransactionId);
+			break;
+		default:
+			break;
+	}
+}
+
+static void __table_log_bulk_subxact_callback(SubXactEvent event, SubTransactionId subid,
+											  SubTransactionId parent, void *arg)
+{
+	switch (event)
+	{
+		case SUBXACT_EVENT_COMMIT_SUB:
+			__table_log_bulk_at_end(true, subid, parent);
+			break;
+		case SUBXACT_EVENT_ABORT_SUB:
+			__table_log_bulk_at_end(false, subid, parent);
+			break;
+		default:
+			break;
+	}
+}
+
+/*
+ * __table_log_bulk_window()
+ * Record the start or the end of a bulk mode window in table_log_bulk,
+ * in the transaction which writes the snapshot. The restore functions
+ * need it to handle the 'old' and the 'new' snapshot as one change, see
+ * __table_log_append_bulk_open(). Needs SPI.
+ */
+static void __table_log_bulk_window(Relation rel, TableLogBulk *bulk, bool end)
+{
+	char          *bulk_table;
+	StringInfo     query;
+	Oid            argtypes[2] = { OIDOID, TIMESTAMPTZOID };
+	Datum          values[2];
+	int            ret;
+
+	bulk_table = __table_log_extension_table("table_log_bulk");
+	if (bulk_table == NULL)
+	{
+		elog(ERROR, "could not find table table_log_bulk, the bulk mode needs CREATE EXTENSION table_log");
+	}
+
+	query = makeStringInfo();
+	if (end)
+	{
+		appendStringInfo(query, "UPDATE %s SET ended = now() WHERE relid = $1 AND started = $2 AND ended IS NULL",
+						 bulk_table);
+	}
+	else
+	{
+		appendStringInfo(query, "INSERT INTO %s (relid, started) VALUES ($1, $2)", bulk_table);
+	}
+
+	elog(DEBUG3, "query: %s", query->data);
+
+	values[0] = ObjectIdGetDatum(bulk->relid);
+	values[1] = TimestampTzGetDatum(bulk->started);
+	ret = SPI_execute_with_args(query->data, 2, argtypes, values, NULL, false, 0);
+	if (ret != (end ? SPI_OK_UPDATE : SPI_OK_INSERT))
+	{
+		elog(ERROR, "could not record the bulk mode of table %s (error: %d)",
+			 RelationGetRelationName(rel), ret);
+	}
+
+	pfree(query->data);
+	pfree(query);
+}
+
+/*
+__table_log_append_bulk_open()
+
+a bulk mode window takes effect with table_log_end_bulk(): up to then
+the rows are the ones in the 'old' snapshot, the changes in between are
+not logged. Appends a condition which is true for the 'old' entries of a
+window still open at the timestamp: started before, and ended after it
+or not at all (the session ended without table_log_end_bulk()). A replay
+up to the timestamp skips these entries, a replay back to it needs them.
+
+parameter:
+  - query to append to, the log entry is in trigger_changed and in
+    trigger_mode and trigger_tuple (or trigger_op)
+  - oid of the logged table
+  - 1 for a compact log table with trigger_op
+  - the timestamp as SQL expression
+note:
+  - needs SPI
+*/
+static void __table_log_append_bulk_open(StringInfo query, Oid relid, int compact, const char *timestamp)
+{
+	char          *bulk_table;
+
+	bulk_table = __table_log_extension_table("table_log_bulk");
+	if (bulk_table == NULL)
+	{
+		/* without the extension there is no bulk mode */
+		appendStringInfoString(query, "false");
+		return;
+	}
+
+	appendStringInfo(query,
+					 "(%s AND EXISTS (SELECT 1 FROM %s w WHERE w.relid = %u "
+					 "AND w.started = trigger_changed AND w.started <= %s "
+					 "AND (w.ended IS NULL OR w.ended > %s)))",
+					 (compact == 1 ? "trigger_op = 'b'" : "trigger_mode = 'BULK' AND trigger_tuple = 'old'"),
+					 bulk_table, relid, timestamp, timestamp);
+}
+
+/*
+table_log_begin_bulk()
+
+switch a logged table into bulk mode for this session
+
+instead of logging every changed row, all rows of the table (or the rows
+matching a condition) are logged once as 'BULK'/'old'. Changes of this
+session are not logged until table_log_end_bulk(), which logs the rows
+again as 'BULK'/'new'. For the restore, the two snapshots replace the
+suppressed log entries: the 'old' rows are deleted and the 'new' rows
+are inserted again.
+
+Changes of other sessions in between would be lost by the restore: the
+table is locked in SHARE ROW EXCLUSIVE mode for the session, other
+sessions can read it but their changes wait until the end of the bulk
+mode.
+
+parameter:
+  - the logged table
+  - condition for the affected rows (optional), it must be true for all
+    rows changed in bulk mode, before and after the change
+return:
+  - number of rows in the snapshot
+*/
+Datum table_log_begin_bulk(PG_FUNCTION_ARGS)
+{
+	Oid                  relid;
+	char                *where = NULL;
+	Relation             rel;
+	TableLogTriggerInfo  info;
+	TableLogBulk        *bulk;
+	MemoryContext        oldcontext;
+	int64                rows;
+	int                  ret;
+
+	if (PG_ARGISNULL(0))
+	{
+		elog(ERROR, "table_log_begin_bulk: table must not be NULL");
+	}
+	relid = PG_GETARG_OID(0);
+	if (PG_NARGS() > 1 && !PG_ARGISNULL(1))
+	{
+		where = text_to_cstring(PG_GETARG_TEXT_PP(1));
+	}
+
+	if (__table_log_bulk_find(relid) != NULL)
+	{
+		elog(ERROR, "table_log_begin_bulk: table %s is already in bulk mode", get_rel_name(relid));
+	}
+
+	rel = heap_open(relid, AccessShareLock);
+
+	if (!__table_log_find_trigger(rel, &info))
+	{
+		elog(ERROR, "table_log_begin_bulk: table %s is not logged by table_log()",
+			 RelationGetRelationName(rel));
+	}
+
+	if (!table_log_bulk_callback_registered)
+	{
+		RegisterXactCallback(__table_log_bulk_xact_callback, NULL);
+		RegisterSubXactCallback(__table_log_bulk_subxact_callback, NULL);
+		table_log_bulk_callback_registered = true;
+	}
+
+	/*
+	 * no other writers until table_log_end_bulk(), before the snapshot;
+	 * the table is in the list before anything can fail, so an abort
+	 * releases the lock again
+	 */
+	LockRelationIdForSession(&rel->rd_lockInfo.lockRelId, ShareRowExclusiveLock);
+
+	oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+	bulk = (TableLogBulk *) palloc(sizeof(TableLogBulk));
+	bulk->relid = relid;
+	bulk->lockid = rel->rd_lockInfo.lockRelId;
+	bulk->where = (where != NULL ? pstrdup(where) : NULL);
+	/* the snapshot gets the same trigger_changed */
+	bulk->started = GetCurrentTransactionStartTimestamp();
+	bulk->begin_subid = GetCurrentSubTransactionId();
+	bulk->end_subid = InvalidSubTransactionId;
+	table_log_bulk = lappend(table_log_bulk, bulk);
+	MemoryContextSwitchTo(oldcontext);
+
+	ret = SPI_connect();
+	if (ret != SPI_OK_CONNECT)
+	{
+		elog(ERROR, "table_log_begin_bulk: SPI_connect returned %d", ret);
+	}
+
+	__table_log_bulk_window(rel, bulk, false);
+	rows = __table_log_snapshot(rel, "BULK", "old", where, 1, &info);
+
+	SPI_finish();
+	heap_close(rel, NoLock);
+
+	PG_RETURN_INT64(rows);
+}
+
+/*
+table_log_end_bulk()
+
+end the bulk mode of a table, see table_log_begin_bulk()
+
+parameter:
+  - the logged table
+return:
+  - number of rows in the snapshot
+*/
+Datum table_log_end_bulk(PG_FUNCTION_ARGS)
+{
+	Oid                  relid;
+	Relation             rel;
+	TableLogTriggerInfo  info;
+	TableLogBulk        *bulk;
+	int64                rows;
+	int                  ret;
+
+	if (PG_ARGISNULL(0))
+	{
+		elog(ERROR, "table_log_end_bulk: table must not be NULL");
+	}
+	relid = PG_GETARG_OID(0);
+
+	bulk = __table_log_bulk_find(relid);
+	if (bulk == NULL)
+	{
+		elog(ERROR, "table_log_end_bulk: table %s is not in bulk mode", get_rel_name(relid));
+	}
+
+	rel = heap_open(relid, AccessShareLock);
+
+	if (!__table_log_find_trigger(rel, &info))
+	{
+		elog(ERROR, "table_log_end_bulk: table %s is not logged by table_log()",
+			 RelationGetRelationName(rel));
+	}
+
+	ret = SPI_connect();
+	if (ret != SPI_OK_CONNECT)
+	{
+		elog(ERROR, "table_log_end_bulk: SPI_connect returned %d", ret);
+	}
+
+	rows = __table_log_snapshot(rel, "BULK", "new", bulk->where, 1, &info);
+	__table_log_bulk_window(rel, bulk, true);
+
+	SPI_finish();
+	heap_close(rel, NoLock);
+
+	/* the entry and the session lock go away with the commit */
+	bulk->end_subid = GetCurrentSubTransactionId();
+
+	PG_RETURN_INT64(rows);
+}
+
+/*
+ * __table_log_coalesce_hash_key() / __table_log_coalesce_match()
+ * Hash function and comparison for the rows remembered by
+ * __table_log_coalesce_remember(), the key is the table and the
+ * condition on the primary key.
+ */
+static uint32 __table_log_coalesce_hash_key(const void *key, Size keysize)
+{
+	const TableLogCoalesceKey *k = (const TableLogCoalesceKey *) key;
+	uint32         h = (uint32) k->relid;
+	const char    *p;
+
+	for (p = k->where; *p != '\0'; p++)
+	{
+		h = h * 31 + (unsigned char) *p;
+	}
+
+	return h;
+}
+
+static int __table_log_coalesce_match(const void *key1, const void *key2, Size keysize)
+{
+	const TableLogCoalesceKey *k1 = (const TableLogCoalesceKey *) key1;
+	const TableLogCoalesceKey *k2 = (const TableLogCoalesceKey *) key2;
+
+	if (k1->relid != k2->relid)
+	{
+		return 1;
+	}
+
+	return strcmp(k1->where, k2->where);
+}
+
+/*
+ * __table_log_coalesce_xact_callback()
+ * The changed rows live in TopTransactionContext and are gone at the end
+ * of the transaction. Before the commit the deferred table_log_flush()
+ * trigger has written them, on abort they are not needed.
+ */
+static void __table_log_coalesce_xact_callback(XactEvent event, void *arg)
+{
+	switch (event)
+	{
+		case XACT_EVENT_COMMIT:
+		case XACT_EVENT_ABORT:
+		case XACT_EVENT_PREPARE:
+			table_log_coalesce_hash = NULL;
+			table_log_coalesce_tables = NIL;
+			break;
+		default:
+			break;
+	}
+}
+
+/*
+__table_log_coalesce_table()
+
+find the rows of a table changed in this transaction
+
+parameter:
+  - oid of the table
+return:
+  - the entry, NULL if no row of the table was remembered
+*/
+static TableLogCoalesceTable *__table_log_coalesce_table(Oid relid)
+{
+	ListCell       *lc;
+
+	foreach(lc, table_log_coalesce_tables)
+	{
+		TableLogCoalesceTable *table = (TableLogCoalesceTable *) lfirst(lc);
+
+		if (table->relid == relid)
+		{
+			return table;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+__table_log_coalesce_where()
+
+condition on the primary key of a row
+
+parameter:
+  - the logged relation
+  - the row
+  - the primary key columns, see __table_log_key_columns()
+return:
+  - the condition, for the WHERE clause of __table_log_coalesce_flush()
+*/
+static char *__table_log_coalesce_where(Relation rel, HeapTuple tuple, TableLogKeyColumns *cols)
+{
+	StringInfo     where = makeStringInfo();
+	int            i;
+
+	for (i = 0; i < cols->nkeys; i++)
+	{
+		AttrNumber  attnum = cols->attnums[i];
+		char       *value = SPI_getvalue(tuple, rel->rd_att, attnum);
+
+		if (where->len > 0)
+		{
+			appendStringInfoString(where, " AND ");
+		}
+		appendStringInfo(where, "%s = ", do_quote_ident(NameStr(rel->rd_att->attrs[attnum - 1]->attname)));
+		__table_log_append_literal(where, value);
+	}
+
+	return where->data;
+}
+
+/*
+__table_log_coalesce_remember()
+
+remember a row changed in this transaction, only the first change of
+the row keeps its old image
+
+parameter:
+  - the logged relation
+  - condition on the primary key of the row
+  - the row before the change, NULL if it did not exist
+return:
+  none
+*/
+static void __table_log_coalesce_remember(Relation rel, char *where, HeapTuple old_tuple)
+{
+	TableLogCoalesceKey     key;
+	TableLogCoalesceEntry  *entry;
+	TableLogCoalesceTable  *table;
+	MemoryContext           oldcontext;
+	bool                    found;
+
+	if (!table_log_coalesce_callback_registered)
+	{
+		RegisterXactCallback(__table_log_coalesce_xact_callback, NULL);
+		table_log_coalesce_callback_registered = true;
+	}
+
+	if (table_log_coalesce_hash == NULL)
+	{
+		HASHCTL        ctl;
+
+		memset(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(TableLogCoalesceKey);
+		ctl.entrysize = sizeof(TableLogCoalesceEntry);
+		ctl.hash = __table_log_coalesce_hash_key;
+		ctl.match = __table_log_coalesce_match;
+		ctl.hcxt = TopTransactionContext;
+		table_log_coalesce_hash = hash_create("table_log coalesce", 256, &ctl,
+											  HASH_ELEM | HASH_FUNCTION | HASH_COMPARE | HASH_CONTEXT);
+	}
+
+	key.relid = RelationGetRelid(rel);
+	key.where = where;
+	entry = (TableLogCoalesceEntry *) hash_search(table_log_coalesce_hash, &key, HASH_ENTER, &found);
+	if (found)
+	{
+		/* changed before in this transaction, the first old image stays */
+		return;
+	}
+
+	oldcontext = MemoryContextSwitchTo(TopTransactionContext);
+
+	entry->key.where = pstrdup(where);
+	entry->old_tuple = (old_tuple != NULL ? heap_copytuple(old_tuple) : NULL);
+
+	table = __table_log_coalesce_table(key.relid);
+	if (table == NULL)
+	{
+		table = (TableLogCoalesceTable *) palloc(sizeof(TableLogCoalesceTable));
+		table->relid = key.relid;
+		table->entries = NIL;
+		table_log_coalesce_tables = lappend(table_log_coalesce_tables, table);
+	}
+	table->entries = lappend(table->entries, entry);
+
+	MemoryContextSwitchTo(oldcontext);
+}
+
+/*
+__table_log_coalesce_add()
+
+remember the rows of a trigger event for table_log_flush()
+
+a key seen for the first time in an INSERT, or as the new key of an
+UPDATE, did not exist before the transaction
+
+called by table_log() before it parses the trigger arguments, the
+primary key columns come from the cache of __table_log_key_columns()
+
+parameter:
+  - trigger data
+return:
+  none
+*/
+static void __table_log_coalesce_add(TriggerData *trigdata)
+{
+	Relation            rel = trigdata->tg_relation;
+	TableLogKeyColumns *cols;
+	char               *where;
+	char               *new_where;
+
+	cols = __table_log_key_columns(rel);
+	if (cols->nkeys == 0)
+	{
+		elog(ERROR, "table_log: option %s needs a primary key on table %s",
+			 "coalesce", RelationGetRelationName(rel));
+	}
+
+	if (TRIGGER_FIRED_BY_INSERT(trigdata->tg_event))
+	{
+		where = __table_log_coalesce_where(rel, trigdata->tg_trigtuple, cols);
+		__table_log_coalesce_remember(rel, where, NULL);
+	}
+	else if (TRIGGER_FIRED_BY_UPDATE(trigdata->tg_event))
+	{
+		where = __table_log_coalesce_where(rel, trigdata->tg_trigtuple, cols);
+		__table_log_coalesce_remember(rel, where, trigdata->tg_trigtuple);
+
+		new_where = __table_log_coalesce_where(rel, trigdata->tg_newtuple, cols);
+		if (strcmp(where, new_where) != 0)
+		{
+			__table_log_coalesce_remember(rel, new_where, NULL);
+		}
+	}
+	else if (TRIGGER_FIRED_BY_DELETE(trigdata->tg_event))
+	{
+		where = __table_log_coalesce_where(rel, trigdata->tg_trigtuple, cols);
+		__table_log_coalesce_remember(rel, where, trigdata->tg_trigtuple);
+	}
+	else
+	{
+		elog(ERROR, "trigger fired by unknown event");
+	}
+}
+
+/*
+__table_log_coalesce_equal()
+
+compare the values of two rows of a table
+
+parameter:
+  - the logged relation
+  - the rows
+return:
+  - true, if all columns have the same value
+*/
+static bool __table_log_coalesce_equal(Relation rel, HeapTuple tuple1, HeapTuple tuple2)
+{
+	int            i;
+
+	for (i = 1; i <= rel->rd_att->natts; i++)
+	{
+		char       *value1;
+		char       *value2;
+
+		if (rel->rd_att->attrs[i - 1]->attisdropped)
+		{
+			continue;
+		}
+
+		value1 = SPI_getvalue(tuple1, rel->rd_att, i);
+		value2 = SPI_getvalue(tuple2, rel->rd_att, i);
+		if ((value1 == NULL) != (value2 == NULL) ||
+			(value1 != NULL && strcmp(value1, value2) != 0))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+__table_log_coalesce_flush()
+
+write the net change of every row of a table changed in this transaction,
+from the first old image and the row as it is now: an INSERT, an UPDATE
+or a DELETE, nothing for a row inserted and deleted again or changed back
+to its old values
+
+parameter:
+  - trigger data
+  - number columns in table
+  - trigger arguments
+  - statistics of the call
+return:
+  none
+*/
+static void __table_log_coalesce_flush(TriggerData *trigdata, int number_columns,
+									   TableLogTriggerInfo *info, TableLogCounters *delta)
+{
+	Relation                rel = trigdata->tg_relation;
+	TableLogCoalesceTable  *table;
+	StringInfo              query;
+	char                   *relname;
+	ListCell               *lc;
+	int                     ret;
+
+	table = __table_log_coalesce_table(RelationGetRelid(rel));
+	if (table == NULL || table->entries == NIL)
+	{
+		return;
+	}
+
+	query = makeStringInfo();
+	relname = __table_log_relation_name(rel);
+
+	foreach(lc, table->entries)
+	{
+		TableLogCoalesceEntry *entry = (TableLogCoalesceEntry *) lfirst(lc);
+		HeapTuple       new_tuple = NULL;
+		HeapTupleData   tmptup;
+
+		/* the row as it is now, as whole row with the layout of the table */
+		resetStringInfo(query);
+		appendStringInfo(query, "SELECT t FROM ONLY %s t WHERE %s", relname, entry->key.where);
+		ret = SPI_exec(query->data, 1);
+		if (ret != SPI_OK_SELECT)
+		{
+			elog(ERROR, "table_log_flush: could not read table %s (error: %d)", relname, ret);
+		}
+
+		if (SPI_processed > 0)
+		{
+			HeapTupleHeader td;
+			bool            isnull;
+
+			td = DatumGetHeapTupleHeader(SPI_getbinval(SPI_tuptable->vals[0],
+													   SPI_tuptable->tupdesc, 1, &isnull));
+			tmptup.t_len = HeapTupleHeaderGetDatumLength(td);
+			ItemPointerSetInvalid(&(tmptup.t_self));
+			tmptup.t_tableOid = RelationGetRelid(rel);
+			tmptup.t_data = td;
+			new_tuple = &tmptup;
+		}
+
+		if (entry->old_tuple == NULL && new_tuple != NULL)
+		{
+			delta->bytes_logged += __table_log(trigdata, "INSERT", "new", new_tuple, number_columns, info);
+			delta->rows_insert++;
+		}
+		else if (entry->old_tuple != NULL && new_tuple == NULL)
+		{
+			delta->bytes_logged += __table_log(trigdata, "DELETE", "old", entry->old_tuple, number_columns, info);
+			delta->rows_delete++;
+		}
+		else if (entry->old_tuple != NULL &&
+				 !__table_log_coalesce_equal(rel, entry->old_tuple, new_tuple))
+		{
+			delta->bytes_logged += __table_log(trigdata, "UPDATE", "old", entry->old_tuple, number_columns, info);
+			delta->bytes_logged += __table_log(trigdata, "UPDATE", "new", new_tuple, number_columns, info);
+			delta->rows_update++;
+		}
+
+		/* later changes in this transaction start from the current row */
+		hash_search(table_log_coalesce_hash, &(entry->key), HASH_REMOVE, NULL);
+	}
+
+	table->entries = NIL;
+
+	pfree(query->data);
+	pfree(query);
+}
+
+/*
+table_log_flush()
+
+deferred trigger of a table with the option coalesce, created by
+table_log_init(): table_log() only remembers the changed rows, the first
+event of the table at the end of the transaction writes the net changes
+of all of them, the other events find nothing to do
+
+parameter:
+  none, the log table is taken from the table_log() trigger
+return:
+  - trigger data (for Pg)
+*/
+Datum table_log_flush(PG_FUNCTION_ARGS)
+{
+	TriggerData          *trigdata = (TriggerData *) fcinfo->context;
+	TableLogTriggerInfo   info;
+	TableLogCounters      delta;
+	TableLogCoalesceTable *table;
+	Oid                   relid;
+	int                   number_columns;
+	int                   ret;
+
+	if (!CALLED_AS_TRIGGER(fcinfo))
+	{
+		elog(ERROR, "table_log_flush: not fired by trigger manager");
+	}
+
+	relid = RelationGetRelid(trigdata->tg_relation);
+	table = __table_log_coalesce_table(relid);
+	if (table == NULL || table->entries == NIL)
+	{
+		return PointerGetDatum(trigdata->tg_trigtuple);
+	}
+
+	if (!__table_log_find_trigger(trigdata->tg_relation, &info) || info.coalesce != 1)
+	{
+		elog(ERROR, "table_log_flush: table %s is not logged by table_log() with the option coalesce",
+			 RelationGetRelationName(trigdata->tg_relation));
+	}
+
+	if (info.keys_only == 1)
+	{
+		number_columns = list_length(info.keys);
+	}
+	else
+	{
+		number_columns = count_columns(trigdata->tg_relation->rd_att);
+	}
+
+	memset(&delta, 0, sizeof(delta));
+
+	ret = SPI_connect();
+	if (ret != SPI_OK_CONNECT)
+	{
+		elog(ERROR, "table_log_flush: SPI_connect returned %d", ret);
+	}
+
+	__table_log_coalesce_flush(trigdata, number_columns, &info, &delta);
+
+	SPI_finish();
+
+	__table_log_stats_add(relid, &delta);
+
+	return PointerGetDatum(trigdata->tg_trigtuple);
+}
+
+/*
+table_log_local_id()
+
+generate an ordering key for the log table without a shared sequence
+
+The key is built from the current time, the backend id and a counter,
+see TABLE_LOG_LOCAL_ID_*. Keys of one backend are strictly increasing,
+keys of different backends are ordered by time. Two changes of the same
+row are ordered correctly, since the second change has to wait for the
+commit of the first one.
+
+All this relies on the system clock: there is no shared state to clamp
+against, if the clock is set back, a new backend can generate keys lower
+than the keys already in the log (wrong order) or the same keys as an
+earlier backend with the same backend id (unique violation). Step the
+clock only with table_log stopped, or let the time be slewed (ntpd, chrony).
+
+The backend id takes TABLE_LOG_LOCAL_ID_BACKEND_BITS bits, a server with
+more backends cannot use the keys.
+
+A unique index on (((trigger_id >> 2) & 1023), trigger_id) gives every
+backend its own insert position in the index, instead of one rightmost
+page shared by all backends.
+
+parameter:
+  none
+return:
+  the new key
+*/
+Datum table_log_local_id(PG_FUNCTION_ARGS)
+{
+	/* last key of this backend */
+	static int64 last_time = 0;
+	static int   counter = 0;
+	int64        now;
+
+	/* backend ids above the mask would share keys with lower ones */
+	if (MaxBackends > (1 << TABLE_LOG_LOCAL_ID_BACKEND_BITS))
+	{
+		elog(ERROR, "table_log_local_id: max. %d backends are supported, the server has %d",
+			 (1 << TABLE_LOG_LOCAL_ID_BACKEND_BITS), MaxBackends);
+	}
+
+	now = (int64) GetCurrentTimestamp();
+
+	if (now > last_time)
+	{
+		last_time = now;
+		counter = 0;
+	}
+	else if (++counter >= (1 << TABLE_LOG_LOCAL_ID_COUNTER_BITS))
+	{
+		/* counter exhausted (or the clock went backwards), use the next microsecond */
+		last_time++;
+		counter = 0;
+	}
+
+	PG_RETURN_INT64((last_time << (TABLE_LOG_LOCAL_ID_BACKEND_BITS + TABLE_LOG_LOCAL_ID_COUNTER_BITS))
+					| ((int64) (MyBackendId & ((1 << TABLE_LOG_LOCAL_ID_BACKEND_BITS) - 1))
+					   << TABLE_LOG_LOCAL_ID_COUNTER_BITS)
+					| counter);
+}
+
+
+#ifdef FUNCAPI_H_not_implemented
+/*
+table_log_show_column()
+
+show a single column on a date in the past
+
+parameter:
+  not yet defined
+return:
+  not yet defined
+*/
+Datum table_log_show_column(PG_FUNCTION_ARGS)
+{
+	TriggerData    *trigdata = (TriggerData *) fcinfo->context;
+	int            ret;
+
+	/*
+	 * Some checks first...
+	 */
+	elog(DEBUG2, "start table_log_show_column()");
+
+	/* Connect to SPI manager */
+	ret = SPI_connect();
+	if (ret != SPI_OK_CONNECT)
+	{
+		elog(ERROR, "table_log_show_column: SPI_connect returned %d", ret);
+	}
+
+	elog(DEBUG2, "this function isnt available yet");
+
+	/* close SPI connection */
+	SPI_finish();
+	return PG_RETURN_NULL;
+}
+#endif /* FUNCAPI_H */
+
+
+/*
+ * __table_log_restore_args()
+ * Fetch the arguments of table_log_restore_table() and friends, the
+ * argument list is the same for all of them, only the key filter
+ * (see TABLE_LOG_FILTER_*) differs.
+ */
+static void __table_log_restore_args(FunctionCallInfo fcinfo, TableLogRestoreArgs *args, int key_filter)
+{
+	memset(args, 0, sizeof(TableLogRestoreArgs));
+	args->search_pkey = "";
+	args->method = 0;
+	args->not_temporarly = 0;
+
+	/* does we have all arguments? */
+	if (PG_ARGISNULL(0))
+	{
+		elog(ERROR, "table_log_restore_table: missing original table name");
+	}
+	if (PG_ARGISNULL(1))
+	{
+		elog(ERROR, "table_log_restore_table: missing primary key name for original table");
+	}
+	if (PG_ARGISNULL(2))
+	{
+		elog(ERROR, "table_log_restore_table: missing log table name");
+	}
+	if (PG_ARGISNULL(3))
+	{
+		elog(ERROR, "table_log_restore_table: missing primary key name for log table");
+	}
+	if (PG_ARGISNULL(4))
+	{
+		elog(ERROR, "table_log_restore_table: missing copy table name");
+	}
+	if (PG_ARGISNULL(5))
+	{
+		elog(ERROR, "table_log_restore_table: missing timestamp");
+	}
+
+	args->timestamp = PG_GETARG_DATUM(5);
+
+	/* first check number arguments to avoid an segfault */
+	if (PG_NARGS() >= 7)
+	{
+		/* if argument is given, check if not null */
+		if (!PG_ARGISNULL(6) && key_filter == TABLE_LOG_FILTER_KEYS)
+		{
+			args->search_keys = OidOutputFunctionCall(F_ARRAY_OUT, PG_GETARG_DATUM(6));
+			elog(DEBUG2, "table_log_restore_table: will restore the keys %s", args->search_keys);
+		}
+		else if (!PG_ARGISNULL(6) && key_filter == TABLE_LOG_FILTER_WHERE)
+		{
+			args->search_where = text_to_cstring(PG_GETARG_TEXT_PP(6));
+			elog(DEBUG2, "table_log_restore_table: will restore the keys where %s", args->search_where);
+		}
+		else if (!PG_ARGISNULL(6))
+		{
+			/* yes, fetch it */
+			args->search_pkey = __table_log_varcharout((VarChar *)PG_GETARG_VARCHAR_P(6));
+
+			/* and check, if we have an argument */
+			if (strlen(args->search_pkey) > 0)
+			{
+				elog(DEBUG2, "table_log_restore_table: will restore a single key");
+			}
+		}
+	} /* nargs >= 7 */
+
+	/* same procedere here */
+	if (PG_NARGS() >= 8)
+	{
+		if (!PG_ARGISNULL(7))
+		{
+			args->method = PG_GETARG_INT32(7);
+
+			if (args->method == TABLE_LOG_METHOD_AUTO)
+			{
+				/* decided later, see __table_log_restore_choose() */
+			}
+			else if (args->method > 0)
+			{
+				args->method = TABLE_LOG_METHOD_BACKWARD;
+			}
+			else
+			{
+				args->method = TABLE_LOG_METHOD_FORWARD;
+			}
+		}
+	} /* nargs >= 8 */
+
+	if (args->method == TABLE_LOG_METHOD_AUTO)
+		elog(DEBUG2, "table_log_restore_table: will choose the restore method");
+	else if (args->method == 1)
+		elog(DEBUG2, "table_log_restore_table: will restore from actual state backwards");
+	else
+		elog(DEBUG2, "table_log_restore_table: will restore from begin forward");
+
+	if (PG_NARGS() >= 9)
+	{
+		if (!PG_ARGISNULL(8))
+		{
+			args->not_temporarly = PG_GETARG_INT32(8);
+
+			if (args->not_temporarly > 0)
+			{
+				args->not_temporarly = 1;
+				elog(DEBUG2, "table_log_restore_table: dont create restore table temporarly");
+			}
+			else
+			{
+				args->not_temporarly = 0;
+			}
+		}
+ 	} /* nargs >= 9 */
+
+	/* get parameter */
+	args->table_orig = __table_log_varcharout((VarChar *)PG_GETARG_VARCHAR_P(0));
+	args->table_orig_pkey = __table_log_varcharout((VarChar *)PG_GETARG_VARCHAR_P(1));
+	args->table_log = __table_log_varcharout((VarChar *)PG_GETARG_VARCHAR_P(2));
+	args->table_log_pkey = __table_log_varcharout((VarChar *)PG_GETARG_VARCHAR_P(3));
+	args->table_restore = __table_log_varcharout((VarChar *)PG_GETARG_VARCHAR_P(4));
+}
+
+
+/*
+table_log_restore_table()
+
+restore a complete table based on the logging table
+
+parameter:
+  - original table name
+  - name of primary key in original table
+  - logging table
+  - name of primary key in logging table
+  - restore table name
+  - timestamp for restoring data
+  - primary key to restore (only this key will be restored) (optional)
+  - restore mode
+    0: restore from blank table (default)
+       needs a complete logging table
+    1: restore from actual table backwards
+    2: choose 0 or 1 by the estimated cost
+  - dont create table temporarly
+    0: create restore table temporarly (default)
+    1: create restore table not temporarly
+  return:
+    name of the restore table
+*/
+Datum table_log_restore_table(PG_FUNCTION_ARGS)
+{
+	TableLogRestoreArgs   args;
+	TableLogRestoreState  state;
+	VarChar              *return_name;
+
+	__table_log_restore_args(fcinfo, &args, TABLE_LOG_FILTER_KEY);
+
+	__table_log_restore(&args, &state);
+
+	/* convert string to VarChar for result */
+	return_name = DatumGetVarCharP(DirectFunctionCall2(varcharin, CStringGetDatum(args.table_restore), Int32GetDatum(strlen(args.table_restore) + VARHDRSZ)));
+
+	/* and return the name of the restore table */
+	PG_RETURN_VARCHAR_P(return_name);
+}
+
+
+/*
+table_log_restore_table_keys()
+
+same as table_log_restore_table(), but restores all keys in an array
+with one scan of the log table
+
+parameter:
+  - see table_log_restore_table(), the keys to restore are a text array
+return:
+  - name of the restore table
+*/
+Datum table_log_restore_table_keys(PG_FUNCTION_ARGS)
+{
+	TableLogRestoreArgs   args;
+	TableLogRestoreState  state;
+
+	__table_log_restore_args(fcinfo, &args, TABLE_LOG_FILTER_KEYS);
+
+	__table_log_restore(&args, &state);
+
+	PG_RETURN_DATUM(DirectFunctionCall3(varcharin,
+										CStringGetDatum(args.table_restore),
+										ObjectIdGetDatum(InvalidOid),
+										Int32GetDatum(-1)));
+}
+
+
+/*
+table_log_restore_table_where()
+
+same as table_log_restore_table(), but restores all keys matching
+a predicate with one scan of the log table
+
+parameter:
+  - see table_log_restore_table(), the keys to restore are given by a
+    predicate (SQL expression) on the columns of the original table
+return:
+  - name of the restore table
+*/
+Datum table_log_restore_table_where(PG_FUNCTION_ARGS)
+{
+	TableLogRestoreArgs   args;
+	TableLogRestoreState  state;
+
+	__table_log_restore_args(fcinfo, &args, TABLE_LOG_FILTER_WHERE);
+
+	__table_log_restore(&args, &state);
+
+	PG_RETURN_DATUM(DirectFunctionCall3(varcharin,
+										CStringGetDatum(args.table_restore),
+										ObjectIdGetDatum(InvalidOid),
+										Int32GetDatum(-1)));
+}
+
+
+/*
+table_log_restore_table_timing()
+
+same as table_log_restore_table(), but returns the time spent
+in every phase of the restore
+
+parameter:
+  - see table_log_restore_table()
+return:
+  - one row per phase: restore table name, phase, duration in msec,
+    the restore method used and, for method 2, the estimate it was
+    chosen by (log entries before and after the timestamp, rows in
+    the original table)
+*/
+Datum table_log_restore_table_timing(PG_FUNCTION_ARGS)
+{
+	TableLogRestoreArgs   args;
+	TableLogRestoreState  state;
+	Tuplestorestate      *tupstore;
+	TupleDesc             tupdesc;
+	Datum                 values[7];
+	bool                  nulls[7];
+	double                total = 0;
+	int                   phase;
+
+	__table_log_restore_args(fcinfo, &args, TABLE_LOG_FILTER_KEY);
+
+	tupstore = __table_log_materialize(fcinfo, &tupdesc);
+
+	__table_log_restore(&args, &state);
+
+	memset(nulls, 0, sizeof(nulls));
+	values[0] = DirectFunctionCall3(varcharin,
+									CStringGetDatum(args.table_restore),
+									ObjectIdGetDatum(InvalidOid),
+									Int32GetDatum(-1));
+	values[3] = Int32GetDatum(state.method);
+	values[4] = Float8GetDatum(state.est_log_before);
+	values[5] = Float8GetDatum(state.est_log_after);
+	values[6] = Float8GetDatum(state.est_live_rows);
+	nulls[4] = nulls[5] = nulls[6] = !state.estimated;
+
+	for (phase = TABLE_LOG_PHASE_CATALOG; phase < TABLE_LOG_NUM_PHASES; phase++)
+	{
+		values[1] = CStringGetTextDatum(table_log_phase_names[phase]);
+		values[2] = Float8GetDatum(state.phase_time[phase]);
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+
+		total += state.phase_time[phase];
+	}
+
+	values[1] = CStringGetTextDatum("total");
+	values[2] = Float8GetDatum(total);
+	tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+
+	return (Datum) 0;
+}
+
+
+/*
+ * __table_log_restore()
+ * Do the work for table_log_restore_table(), see there.
+ * The restore reports its progress in shared memory (if available),
+ * the time spent in each phase is returned in state.
+ */
+static void __table_log_restore(TableLogRestoreArgs *args, TableLogRestoreState *state)
+{
+	TableLogCounters  delta;
+	Oid               relid;
+
+	memset(state, 0, sizeof(TableLogRestoreState));
+	memset(&delta, 0, sizeof(delta));
+	state->method = -1;
+
+	INSTR_TIME_SET_CURRENT(state->phase_start);
+	state->phase = TABLE_LOG_PHASE_INIT;
+
+	relid = __table_log_relname_relid(args->table_orig);
+	state->relid = relid;
+
+	TABLE_LOG_RESTORE_START(relid, args->method);
+
+	__table_log_progress_begin(state, relid);
+
+	PG_TRY();
+	{
+		__table_log_restore_internal(args, state);
+	}
+	PG_CATCH();
+	{
+		__table_log_progress_end(state);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	__table_log_restore_phase(state, TABLE_LOG_PHASE_INIT);
+	__table_log_progress_end(state);
+
+	/* account the restore in shared memory */
+	delta.restores = 1;
+	delta.restore_time = state->phase_time[TABLE_LOG_PHASE_CATALOG]
+		+ state->phase_time[TABLE_LOG_PHASE_COPY]
+		+ state->phase_time[TABLE_LOG_PHASE_SCAN]
+		+ state->phase_time[TABLE_LOG_PHASE_REPLAY];
+	delta.restore_max_time = delta.restore_time;
+	__table_log_stats_add(relid, &delta);
+
+	TABLE_LOG_RESTORE_DONE(relid, state->log_rows_processed, state->rows_written);
+
+	elog(DEBUG2, "table_log_restore_table() done, results in: %s", args->table_restore);
+}
+
+
+/*
+ * __table_log_restore_choose()
+ * Pick the restore method for TABLE_LOG_METHOD_AUTO: estimate the number
+ * of log entries before and after the timestamp from the position of the
+ * timestamp in the range of the log table pkey, and compare the replay
+ * of the entries before it (forward) with a copy of the live table plus
+ * the replay of the entries after it (backwards).
+ * Only the statistics and the pkey index are used, the log is never
+ * counted: the number of entries is reltuples of the log table and its
+ * child tables (partitions=N), or the span of the pkey if there are no
+ * statistics yet. For a shared log table the span of the pkey of the
+ * table is also an upper bound of its entries.
+ * The estimate is returned in state, for table_log_restore_table_timing()
+ * and the restore jobs.
+ */
+static int __table_log_restore_choose(char *table_orig, char *table_log, char *table_log_pkey,
+									  int log_shared, Datum timestamp, TableLogRestoreState *state)
+{
+	StringInfo     query;
+	StringInfo     filter;
+	Oid            orig_relid;
+	Oid            log_relid;
+	Oid            argtypes[1] = { TIMESTAMPTZOID };
+	Datum          values[1];
+	bool           isnull;
+	double         log_min, log_max, log_boundary;
+	double         log_rows, live_rows;
+	double         log_before, log_after;
+	double         cost_forward, cost_backward;
+	int            method;
+	int            ret;
+
+	orig_relid = __table_log_relname_relid(table_orig);
+	if (!OidIsValid(orig_relid))
+	{
+		elog(ERROR, "could not estimate size of relation: %s", table_orig);
+	}
+	log_relid = __table_log_relname_relid(table_log);
+	if (!OidIsValid(log_relid))
+	{
+		elog(ERROR, "could not estimate size of relation: %s", table_log);
+	}
+
+	query = makeStringInfo();
+	filter = makeStringInfo();
+
+	/* a shared log table has the entries of many tables */
+	if (log_shared == 1)
+	{
+		appendStringInfo(filter, "trigger_relid = %u AND ", orig_relid);
+	}
+
+	/* size of the live table, from the pages if it was never analyzed */
+	appendStringInfo(query,
+					 "SELECT CASE WHEN reltuples > 0 THEN reltuples::float8 "
+					 "ELSE pg_relation_size(oid)::float8 / %d END FROM pg_class WHERE oid = %u",
+					 TABLE_LOG_ROW_WIDTH, orig_relid);
+
+	elog(DEBUG3, "query: %s", query->data);
+
+	ret = SPI_exec(query->data, 0);
+	if (ret != SPI_OK_SELECT || SPI_processed != 1)
+	{
+		elog(ERROR, "could not estimate size of relation: %s", table_orig);
+	}
+	live_rows = DatumGetFloat8(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull));
+
+	/* the range of the log, and the statistics of the log and its child tables */
+	resetStringInfo(query);
+	appendStringInfo(query,
+					 "SELECT min(%s)::float8, max(%s)::float8, "
+					 "(SELECT sum(reltuples)::float8 FROM pg_class WHERE reltuples > 0 "
+					 "AND (oid = %u OR oid IN (SELECT inhrelid FROM pg_inherits WHERE inhparent = %u))) "
+					 "FROM %s",
+					 do_quote_ident(table_log_pkey), do_quote_ident(table_log_pkey),
+					 log_relid, log_relid, do_quote_ident(table_log));
+	if (log_shared == 1)
+	{
+		appendStringInfo(query, " WHERE trigger_relid = %u", orig_relid);
+	}
+
+	elog(DEBUG3, "query: %s", query->data);
+
+	ret = SPI_exec(query->data, 0);
+	if (ret != SPI_OK_SELECT || SPI_processed != 1)
+	{
+		elog(ERROR, "could not estimate size of relation: %s", table_log);
+	}
+
+	log_min = DatumGetFloat8(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull));
+	if (isnull)
+	{
+		/* empty log, both methods have nothing to replay */
+		elog(DEBUG1, "table_log_restore_table: log table %s is empty, using method 1", table_log);
+		log_before = 0;
+		log_after = 0;
+		method = 1;
+	}
+	else
+	{
+		log_max = DatumGetFloat8(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 2, &isnull));
+		log_rows = DatumGetFloat8(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 3, &isnull));
+		if (isnull || log_rows > log_max - log_min + 1)
+		{
+			/* never analyzed, or a shared log: the pkey has no gaps at most */
+			log_rows = log_max - log_min + 1;
+		}
+
+		/* the newest entry up to the timestamp, found with the index on trigger_changed */
+		resetStringInfo(query);
+		appendStringInfo(query,
+						 "SELECT %s::float8 FROM %s WHERE %strigger_changed <= $1 "
+						 "ORDER BY trigger_changed DESC, %s DESC LIMIT 1",
+						 do_quote_ident(table_log_pkey), do_quote_ident(table_log), filter->data,
+						 do_quote_ident(table_log_pkey));
+
+		elog(DEBUG3, "query: %s", query->data);
+
+		values[0] = timestamp;
+		ret = SPI_execute_with_args(query->data, 1, argtypes, values, NULL, true, 1);
+		if (ret != SPI_OK_SELECT)
+		{
+			elog(ERROR, "could not estimate size of relation: %s", table_log);
+		}
+
+		if (SPI_processed == 0)
+		{
+			log_before = 0;
+		}
+		else
+		{
+			/* the pkey grows with the time, assume the entries are spread evenly */
+			log_boundary = DatumGetFloat8(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull));
+			log_before = log_rows * (log_boundary - log_min + 1) / (log_max - log_min + 1);
+		}
+		log_after = log_rows - log_before;
+
+		cost_forward = log_before;
+		cost_backward = log_after + live_rows * TABLE_LOG_COPY_ROW_COST;
+		method = (cost_backward < cost_forward) ? 1 : 0;
+
+		elog(DEBUG1, "table_log_restore_table: using method %d (estimated %.0f log entries before and %.0f after the timestamp, %.0f rows in %s)",
+			 method, log_before, log_after, live_rows, table_orig);
+	}
+
+	state->method = method;
+	state->estimated = true;
+	state->est_log_before = log_before;
+	state->est_log_after = log_after;
+	state->est_live_rows = live_rows;
+
+	pfree(filter->data);
+	pfree(filter);
+	pfree(query->data);
+	pfree(query);
+
+	return method;
+}
+
+/*
+ * __table_log_restore_internal()
+ * The restore itself, called by __table_log_restore() which takes care
+ * of the progress reporting.
+ */
+static void __table_log_restore_internal(TableLogRestoreArgs *args, TableLogRestoreState *state)
+{
+	/* the original table name */
+	char  *table_orig = args->table_orig;
+	/* the primary key in the original table */
+	char  *table_orig_pkey = args->table_orig_pkey;
+	/* number columns in original table */
+	int  table_orig_columns = 0;
+	/* the log table name */
+	char  *table_log = args->table_log;
+	/* the primary key in the log table (usually trigger_id) */
+	/* cannot be the same then then the pkey in the original table */
+	char  *table_log_pkey = args->table_log_pkey;
+	/* number columns in log table */
+	int  table_log_columns = 0;
+	/* 1: shared log table for many tables */
+	int  log_shared = 0;
+	/* 1: compact log table, trigger_op instead of trigger_mode and trigger_tuple */
+	int  log_compact = 0;
+	/* the restore table name */
+	char  *table_restore = args->table_restore;
+	/* the timestamp in past */
+	Datum      timestamp = args->timestamp;
+	/* the single pkey, can be empty (then all keys will be restored) */
+	char  *search_pkey = args->search_pkey;
+	/* the restore method
+	   - 0: restore from blank table (default)
+	   needs a complete log table!
+	   - 1: restore from actual table backwards
+	   - 2: choose one of them by the estimated cost
+	*/
+	int            method = args->method;
+	/* dont create restore table temporarly
+	   - 0: create restore table temporarly (default)
+	   - 1: dont create restore table temporarly
+	*/
+	int            not_temporarly = args->not_temporarly;
+	int            ret, results, i, number_columns;
+	int64          rows_written = 0;
+
+    /*
+	 * for getting table infos
+	 */
+	StringInfo     query;
+
+	int            need_search_pkey = 0;          /* does we have a single key (or some keys) to restore? */
+	char           *tmp, *timestamp_string, *old_pkey_string = "";
+	char           trigger_op;                    /* see __table_log_op_code() */
+	char           trigger_mode;                  /* first letter of the mode */
+	bool           tuple_new;                     /* 'new' entry */
+	bool           isnull;
+	char           *trigger_changed;
+	SPITupleTable  *spi_tuptable = NULL;          /* for saving query results */
+
+	/* memory for dynamic query */
+	StringInfo      d_query;
+
+	/* memory for column names */
+	StringInfo      col_query;
+
+	/* the keys to restore */
+	StringInfo      key_filter;
+
+	int      col_pkey = 0;
+	char    *pkey_type = NULL;
+
+	/*
+	 * Some checks first...
+	 */
+	elog(DEBUG2, "start table_log_restore_table()");
+
+	if (strlen(search_pkey) > 0 || args->search_keys != NULL || args->search_where != NULL)
+	{
+		need_search_pkey = 1;
+	}
+
+	/* pkey of original table cannot be the same as of log table */
+	if (strcmp((const char *)table_orig_pkey, (const char *)table_log_pkey) == 0)
+	{
+		elog(ERROR, "pkey of logging table cannot be the pkey of the original table: %s <-> %s",
+			 table_orig_pkey, table_log_pkey);
+	}
+
+	/* Connect to SPI manager */
+	ret = SPI_connect();
+
+	if (ret != SPI_OK_CONNECT)
+	{
+		elog(ERROR, "table_log_restore_table: SPI_connect returned %d", ret);
+	}
+
+	__table_log_restore_phase(state, TABLE_LOG_PHASE_CATALOG);
+
+	/* check original table */
+	query = makeStringInfo();
+	appendStringInfo(query,
+					 "SELECT a.attname FROM pg_class c, pg_attribute a WHERE c.relname = %s AND a.attnum > 0 AND a.attrelid = c.oid ORDER BY a.attnum",
+					 do_quote_literal(table_orig));
+
+	elog(DEBUG3, "query: %s", query->data);
+
+	ret = SPI_exec(query->data, 0);
+
+	if (ret != SPI_OK_SELECT)
+	{
+		elog(ERROR, "could not check relation: %s", table_orig);
+	}
+
+	if (SPI_processed > 0)
+	{
+		table_orig_columns = SPI_processed;
+	} else {
+		elog(ERROR, "could not check relation: %s", table_orig);
+	}
+
+	/* check pkey in original table */
+	resetStringInfo(query);
+	appendStringInfo(query,
+					 "SELECT a.attname FROM pg_class c, pg_attribute a WHERE c.relname=%s AND c.relkind='r' AND a.attname=%s AND a.attnum > 0 AND a.attrelid = c.oid",
+					 do_quote_literal(table_orig), do_quote_literal(table_orig_pkey));
+
+	elog(DEBUG3, "query: %s", query->data);
+
+	ret = SPI_exec(query->data, 0);
+
+	if (ret != SPI_OK_SELECT)
+	{
+		elog(ERROR, "could not check relation: %s", table_orig);
+	}
+
+	if (SPI_processed == 0)
+	{
+		elog(ERROR, "could not check relation: %s", table_orig);
+	}
+
+	elog(DEBUG2, "original table: OK (%i columns)", table_orig_columns);
+
+	/* check log table */
+	resetStringInfo(query);
+	appendStringInfo(query,
+					 "SELECT a.attname FROM pg_class c, pg_attribute a WHERE c.relname = %s AND a.attnum > 0 AND a.attrelid = c.oid ORDER BY a.attnum",
+					 do_quote_literal(table_log));
+
+	elog(DEBUG3, "query: %s", query->data);
+
+	ret = SPI_exec(query->data, 0);
+
+	if (ret != SPI_OK_SELECT)
+	{
+		elog(ERROR, "could not check relation [1]: %s", table_log);
+	}
+
+	if (SPI_processed > 0)
+	{
+		table_log_columns = SPI_processed;
+	} else {
+		elog(ERROR, "could not check relation [2]: %s", table_log);
+	}
+
+	/* a shared log table has the logged rows in trigger_data */
+	for (i = 0; i < table_log_columns; i++)
+	{
+		if (strcmp(SPI_getvalue(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 1), "trigger_relid") == 0)
+		{
+			log_shared = 1;
+		}
+		if (strcmp(SPI_getvalue(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 1), "trigger_op") == 0)
+		{
+			log_compact = 1;
+		}
+	}
+
+	/* check pkey in log table */
+	resetStringInfo(query);
+	appendStringInfo(query,
+					 "SELECT a.attname FROM pg_class c, pg_attribute a WHERE c.relname=%s AND c.relkind='r' AND a.attname=%s AND a.attnum > 0 AND a.attrelid = c.oid",
+					 do_quote_literal(table_log), do_quote_literal(table_log_pkey));
+
+	elog(DEBUG3, "query: %s", query->data);
+
+	ret = SPI_exec(query->data, 0);
+
+	if (ret != SPI_OK_SELECT)
+	{
+		elog(ERROR, "could not check relation [3]: %s", table_log);
+	}
+
+	if (SPI_processed == 0)
+	{
+		elog(ERROR, "could not check relation [4]: %s", table_log);
+	}
+
+	/* a keys_only log table does not have the other columns of the table */
+	if (log_shared == 0)
+	{
+		resetStringInfo(query);
+		appendStringInfo(query,
+						 "SELECT a.attname FROM pg_class c, pg_attribute a WHERE c.relname = %s AND a.attnum > 0 AND a.attrelid = c.oid AND NOT a.attisdropped "
+						 "AND NOT EXISTS (SELECT 1 FROM pg_class lc, pg_attribute l WHERE lc.relname = %s AND l.attrelid = lc.oid AND l.attname = a.attname)",
+						 do_quote_literal(table_orig), do_quote_literal(table_log));
+
+		elog(DEBUG3, "query: %s", query->data);
+
+		ret = SPI_exec(query->data, 1);
+
+		if (ret != SPI_OK_SELECT)
+		{
+			elog(ERROR, "could not check relation [5]: %s", table_log);
+		}
+
+		if (SPI_processed > 0)
+		{
+			elog(ERROR, "log table %s has no column %s, a keys_only log table cannot be restored",
+				 table_log, SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1));
+		}
+	}
+
+	elog(DEBUG3, "log table: OK (%i columns)", table_log_columns);
+
+	if (method == TABLE_LOG_METHOD_AUTO)
+	{
+		method = __table_log_restore_choose(table_orig, table_log, table_log_pkey, log_shared, timestamp, state);
+	}
+	state->method = method;
+
+	/* method 0 replays the log from the start, method 1 back to the timestamp */
+	__table_log_check_archive(__table_log_relname_relid(table_log), timestamp, (method == 0), "table_log_restore_table");
+
+	/* check restore table */
+	resetStringInfo(query);
+	appendStringInfo(query,
+					 "SELECT pg_attribute.attname AS a FROM pg_class, pg_attribute WHERE pg_class.relname=%s AND pg_attribute.attnum > 0 AND pg_attribute.attrelid=pg_class.oid",
+					 do_quote_literal(table_restore));
+
+	elog(DEBUG3, "query: %s", query->data);
+
+	ret = SPI_exec(query->data, 0);
+
+	if (ret != SPI_OK_SELECT)
+	{
+		elog(ERROR, "could not check relation: %s", table_restore);
+	}
+
+	if (SPI_processed > 0)
+	{
+		elog(ERROR, "restore table already exists: %s", table_restore);
+	}
+
+	elog(DEBUG2, "restore table: OK (doesnt exists)");
+
+	/* now get all columns from original table */
+	resetStringInfo(query);
+	appendStringInfo(query,
+					 "SELECT a.attname, format_type(a.atttypid, a.atttypmod), a.attnum FROM pg_class c, pg_attribute a WHERE c.relname = %s AND a.attnum > 0 AND a.attrelid = c.oid ORDER BY a.attnum",
+					 do_quote_literal(table_orig));
+
+	elog(DEBUG3, "query: %s", query->data);
+
+	ret = SPI_exec(query->data, 0);
+
+	if (ret != SPI_OK_SELECT)
+	{
+		elog(ERROR, "could not get columns from relation: %s", table_orig);
+	}
+
+	if (SPI_processed == 0)
+	{
+		elog(ERROR, "could not check relation: %s", table_orig);
+	}
+
+	results = SPI_processed;
+
+	/* store number columns for later */
+	number_columns = SPI_processed;
+
+	elog(DEBUG2, "number columns: %i", results);
+
+	for (i = 0; i < results; i++)
+	{
+		/* the column name */
+		tmp = SPI_getvalue(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 1);
+
+		/* now check, if this is the pkey */
+		if (strcmp((const char *)tmp, (const char *)table_orig_pkey) == 0)
+		{
+			/* remember the (real) number and the type */
+			col_pkey = i + 1;
+			pkey_type = SPI_getvalue(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 2);
+		}
+	}
+
+	/* check if we have found the pkey */
+	if (col_pkey == 0)
+	{
+		elog(ERROR, "cannot find pkey (%s) in table %s", table_orig_pkey, table_orig);
+	}
+
+	/* the keys to restore, for the copy and for the log scan */
+	key_filter = makeStringInfo();
+	if (args->search_keys != NULL)
+	{
+		appendStringInfo(key_filter, "%s = ANY(%s::%s[])",
+						 do_quote_ident(table_orig_pkey),
+						 do_quote_literal(args->search_keys), pkey_type);
+	}
+	else if (args->search_where != NULL)
+	{
+		appendStringInfo(key_filter, "(%s)", args->search_where);
+	}
+	else if (need_search_pkey == 1)
+	{
+		appendStringInfo(key_filter, "%s = %s",
+						 do_quote_ident(table_orig_pkey),
+						 do_quote_literal(search_pkey));
+	}
+
+	/* allocate memory for string */
+	col_query = makeStringInfo();
+
+	for (i = 0; i < results; i++)
+	{
+		if (i > 0)
+			appendStringInfo(col_query, ", ");
+
+		appendStringInfo(col_query, "%s",
+						 do_quote_ident(SPI_getvalue(SPI_tuptable->vals[i],
+													 SPI_tuptable->tupdesc, 1)));
+	}
+
+	__table_log_restore_phase(state, TABLE_LOG_PHASE_COPY);
+
+	/* create restore table */
+	elog(DEBUG2, "string for columns: %s", col_query->data);
+	elog(DEBUG2, "create restore table: %s", table_restore);
+	resetStringInfo(query);
+	appendStringInfo(query, "SELECT * INTO ");
+
+	/* per default create a temporary table */
+	if (not_temporarly == 0)
+	{
+		appendStringInfo(query, "TEMPORARY ");
+	}
+
+	/* from which table? */
+	appendStringInfo(query, "TABLE %s FROM %s ", table_restore, table_orig);
+
+	if (need_search_pkey == 1)
+	{
+		/* only extract the specific keys */
+		appendStringInfo(query, "WHERE %s ", key_filter->data);
+	}
+
+	if (method == 0)
+	{
+		/* restore from begin (blank table) */
+		appendStringInfo(query, "LIMIT 0");
+	}
+
+	elog(DEBUG3, "query: %s", query->data);
+
+	ret = SPI_exec(query->data, 0);
+
+	if (ret != SPI_OK_SELINTO)
+	{
+		elog(ERROR, "could not check relation: %s", table_restore);
+	}
+
+	if (method == 1)
+	{
+		elog(DEBUG2, "%i rows copied", SPI_processed);
+		rows_written = SPI_processed;
+		__table_log_progress_update(state, 0, rows_written);
+	}
+
+	__table_log_restore_phase(state, TABLE_LOG_PHASE_SCAN);
+
+	/* get timestamp as string */
+	timestamp_string = DatumGetCString(DirectFunctionCall1(timestamptz_out, timestamp));
+
+	if (method == 0)
+		elog(DEBUG2, "need logs from start to timestamp: %s", timestamp_string);
+	else
+		elog(DEBUG2, "need logs from end to timestamp: %s", timestamp_string);
+
+	/* now build query for getting logs */
+	elog(DEBUG2, "build query for getting logs");
+
+	/* allocate memory for string and build query */
+	d_query = makeStringInfo();
+	if (log_shared == 1)
+	{
+		/* only the entries of the original table, expanded to its columns */
+		appendStringInfo(d_query,
+						 "SELECT %s, %s, trigger_changed FROM "
+						 "(SELECT (l.trigger_data::%s).*, l.trigger_mode, l.trigger_tuple, l.trigger_changed, l.%s "
+						 "FROM %s l WHERE l.trigger_relid = %s::regclass) AS log WHERE ",
+						 col_query->data, TABLE_LOG_OP_CODE_EXPR,
+						 do_quote_ident(table_orig), do_quote_ident(table_log_pkey),
+						 do_quote_ident(table_log), do_quote_literal(do_quote_ident(table_orig)));
+	}
+	else
+	{
+		/* mode and tuple as one code, compared as a single character below */
+		appendStringInfo(d_query,
+						 "SELECT %s, %s, trigger_changed FROM %s WHERE ",
+						 col_query->data, (log_compact == 1 ? "trigger_op" : TABLE_LOG_OP_CODE_EXPR),
+						 do_quote_ident(table_log));
+	}
+
+	/*
+	 * the 'old' snapshot of a bulk mode window open at the timestamp is
+	 * the state at the timestamp: a replay forward skips it, a replay
+	 * backwards needs it also if it is older
+	 */
+	if (method == 0)
+	{
+		/* from start to timestamp */
+		appendStringInfo(d_query, "trigger_changed <= %s AND NOT ",
+						 do_quote_literal(timestamp_string));
+		__table_log_append_bulk_open(d_query, __table_log_relname_relid(table_orig), log_compact,
+									 do_quote_literal(timestamp_string));
+		appendStringInfoString(d_query, " ");
+	}
+	else
+	{
+		/* from now() backwards to timestamp */
+		appendStringInfo(d_query, "(trigger_changed >= %s OR ",
+						 do_quote_literal(timestamp_string));
+		__table_log_append_bulk_open(d_query, __table_log_relname_relid(table_orig), log_compact,
+									 do_quote_literal(timestamp_string));
+		appendStringInfoString(d_query, ") ");
+	}
+
+	if (need_search_pkey == 1)
+	{
+		/* the TRUNCATE marker has no key */
+		appendStringInfo(d_query, "AND (%s OR %s) ",
+						 key_filter->data,
+						 (log_compact == 1 ? "trigger_op = 'T'" : "(trigger_mode = 'TRUNCATE' AND trigger_tuple = 'new')"));
+	}
+
+	if (method == 0)
+	{
+		appendStringInfo(d_query, "ORDER BY %s ASC",
+						 do_quote_ident(table_log_pkey));
+	}
+	else
+	{
+		appendStringInfo(d_query, "ORDER BY %s DESC",
+						 do_quote_ident(table_log_pkey));
+	}
+
+	elog(DEBUG3, "query: %s", d_query->data);
+
+	ret = SPI_exec(d_query->data, 0);
+
+	if (ret != SPI_OK_SELECT)
+	{
+		elog(ERROR, "could not get log data from table: %s", table_log);
+	}
+
+	elog(DEBUG2, "number log entries to restore: %i", SPI_processed);
+
+	results = SPI_processed;
+	/* save results */
+	spi_tuptable = SPI_tuptable;
+
+	__table_log_restore_phase(state, TABLE_LOG_PHASE_REPLAY);
+	__table_log_progress_total(state, results);
+
+	/* go through all results */
+	for (i = 0; i < results; i++)
+	{
+		__table_log_progress_update(state, i, rows_written);
+
+		/* get tuple data */
+		trigger_op = DatumGetChar(SPI_getbinval(spi_tuptable->vals[i], spi_tuptable->tupdesc, number_columns + 1, &isnull));
+		trigger_mode = toupper((unsigned char) trigger_op);
+		tuple_new = (trigger_op == trigger_mode);
+		trigger_changed = SPI_getvalue(spi_tuptable->vals[i], spi_tuptable->tupdesc, number_columns + 2);
+
+		/* bulk mode: the 'old' rows are deleted, the 'new' rows inserted again */
+		if (trigger_mode == 'B')
+		{
+			elog(DEBUG2, "tuple: %c  %s", trigger_op, trigger_changed);
+
+			if (method == 0 && tuple_new)
+			{
+				rows_written += __table_log_restore_table_insert(spi_tuptable, table_restore, table_orig_pkey, col_query->data, col_pkey, number_columns, i);
+			}
+			else if (method == 0 || tuple_new)
+			{
+				rows_written += __table_log_restore_table_delete(spi_tuptable, table_restore, table_orig_pkey, col_query->data, col_pkey, number_columns, i);
+			}
+			else
+			{
+				/*
+				 * back to the 'old' rows: without the 'new' snapshot (the
+				 * window is still open) the rows are still in the table
+				 */
+				__table_log_restore_table_delete(spi_tuptable, table_restore, table_orig_pkey, col_query->data, col_pkey, number_columns, i);
+				rows_written += __table_log_restore_table_insert(spi_tuptable, table_restore, table_orig_pkey, col_query->data, col_pkey, number_columns, i);
+			}
+
+			continue;
+		}
+
+		/* TRUNCATE: snapshot of all rows ('old'), then a marker ('new') */
+		if (trigger_mode == 'T')
+		{
+			elog(DEBUG2, "tuple: %c  %s", trigger_op, trigger_changed);
+
+			if (method == 0 && tuple_new)
+			{
+				/* roll forward: the table was emptied */
+				rows_written += __table_log_restore_table_truncate(table_restore);
+			}
+			else if (method == 1 && !tuple_new)
+			{
+				/* roll back: the rows from before the TRUNCATE come back */
+				rows_written += __table_log_restore_table_insert(spi_tuptable, table_restore, table_orig_pkey, col_query->data, col_pkey, number_columns, i);
+			}
+
+			continue;
+		}
+
+		/* check for update tuples we doesnt need */
+		if (trigger_mode == 'U')
+		{
+			if (method == 0 && !tuple_new)
+			{
+				/* we need the old value of the pkey for the update */
+				old_pkey_string = SPI_getvalue(spi_tuptable->vals[i], spi_tuptable->tupdesc, col_pkey);
+				elog(DEBUG2, "tuple old pkey: %s", old_pkey_string);
+
+				/* then skip this tuple */
+				continue;
+			}
+
+			if (method == 1 && tuple_new)
+			{
+				/* we need the old value of the pkey for the update */
+				old_pkey_string = SPI_getvalue(spi_tuptable->vals[i], spi_tuptable->tupdesc, col_pkey);
+				elog(DEBUG2, "tuple: old pkey: %s", old_pkey_string);
+
+				/* then skip this tuple */
+				continue;
+			}
+		}
+
+		if (method == 0)
+		{
+			/* roll forward */
+			elog(DEBUG2, "tuple: %c  %s", trigger_op, trigger_changed);
+
+			if (trigger_mode == 'I')
+			{
+				rows_written += __table_log_restore_table_insert(spi_tuptable, table_restore, table_orig_pkey, col_query->data, col_pkey, number_columns, i);
+			}
+			else if (trigger_mode == 'U')
+			{
+				rows_written += __table_log_restore_table_update(spi_tuptable, table_restore, table_orig_pkey, col_query->data, col_pkey, number_columns, i, old_pkey_string);
+			}
+			else if (trigger_mode == 'D')
+			{
+				rows_written += __table_log_restore_table_delete(spi_tuptable, table_restore, table_orig_pkey, col_query->data, col_pkey, number_columns, i);
+			}
+			else
+			{
+				elog(ERROR, "unknown trigger_op: %c", trigger_op);
+			}
+
+		}
+		else
+		{
+			/* roll back */
+			char rb_mode[10]; /* reverse the method */
+
+			if (trigger_mode == 'I')
+			{
+				sprintf(rb_mode, "DELETE");
+			}
+			else if (trigger_mode == 'U')
+			{
+				sprintf(rb_mode, "UPDATE");
+			}
+			else if (trigger_mode == 'D')
+			{
+				sprintf(rb_mode, "INSERT");
+			}
+			else
+			{
+				elog(ERROR, "unknown trigger_op: %c", trigger_op);
+			}
+
+			elog(DEBUG2, "tuple: %s  %c  %s", rb_mode, trigger_op, trigger_changed);
+
+			if (trigger_mode == 'I')
+			{
+				rows_written += __table_log_restore_table_delete(spi_tuptable, table_restore, table_orig_pkey, col_query->data, col_pkey, number_columns, i);
+			}
+			else if (trigger_mode == 'U')
+			{
+				rows_written += __table_log_restore_table_update(spi_tuptable, table_restore, table_orig_pkey, col_query->data, col_pkey, number_columns, i, old_pkey_string);
+			}
+			else if (trigger_mode == 'D')
+			{
+				rows_written += __table_log_restore_table_insert(spi_tuptable, table_restore, table_orig_pkey, col_query->data, col_pkey, number_columns, i);
+			}
+		}
+	}
+
+	__table_log_progress_update(state, results, rows_written);
+
+	/* close SPI connection */
+	SPI_finish();
+}
+
+int __table_log_restore_table_insert(SPITupleTable *spi_tuptable, char *table_restore,
+									  char *table_orig_pkey, char *col_query_start,
+									  int col_pkey, int number_columns, int i) {
+	int            j;
+	int            ret;
+	char          *tmp;
+
+	/* memory for dynamic query */
+	StringInfo     d_query;
+
+	d_query = makeStringInfo();
+
+	/* build query */
+	appendStringInfo(d_query, "INSERT INTO %s (%s) VALUES (",
+					 do_quote_ident(table_restore),
+					 col_query_start);
+
+	for (j = 1; j <= number_columns; j++)
+	{
+		if (j > 1)
+		{
+			appendStringInfoString(d_query, ", ");
+		}
+
+		tmp = SPI_getvalue(spi_tuptable->vals[i], spi_tuptable->tupdesc, j);
+
+		if (tmp == NULL)
+		{
+			appendStringInfoString(d_query, "NULL");
+		}
+		else
+		{
+			__table_log_append_literal(d_query, tmp);
+		}
+	}
+
+	appendStringInfoString(d_query, ")");
+	elog(DEBUG3, "query: %s", d_query->data);
+
+	ret = SPI_exec(d_query->data, 0);
+
+	if (ret != SPI_OK_INSERT) {
+		elog(ERROR, "could not insert data into: %s", table_restore);
+	}
+
+	/* done */
+	return SPI_processed;
+}
+
+int __table_log_restore_table_update(SPITupleTable *spi_tuptable, char *table_restore,
+									  char *table_orig_pkey, char *col_query_start,
+									  int col_pkey, int number_columns,
+									  int i, char *old_pkey_string) {
+	int   j;
+	int   ret;
+	char *tmp;
+	char *tmp2;
+
+	/* memory for dynamic query */
+	StringInfo d_query;
+
+	d_query = makeStringInfo();
+
+	/* build query */
+	appendStringInfo(d_query, "UPDATE %s SET ",
+					 do_quote_ident(table_restore));
+
+	for (j = 1; j <= number_columns; j++)
+	{
+		if (j > 1)
+		{
+			appendStringInfoString(d_query, ", ");
+		}
+
+		tmp = SPI_getvalue(spi_tuptable->vals[i], spi_tuptable->tupdesc, j);
+		tmp2 = SPI_fname(spi_tuptable->tupdesc, j);
+
+		if (tmp == NULL)
+		{
+			appendStringInfo(d_query, "%s=NULL", do_quote_ident(tmp2));
+		}
+		else
+		{
+			appendStringInfo(d_query, "%s=", do_quote_ident(tmp2));
+			__table_log_append_literal(d_query, tmp);
+		}
+	}
+
+	appendStringInfo(d_query,
+			 " WHERE %s=%s",
+			 do_quote_ident(table_orig_pkey),
+			 do_quote_literal(old_pkey_string));
+
+	elog(DEBUG3, "query: %s", d_query->data);
+
+	ret = SPI_exec(d_query->data, 0);
+
+  if (ret != SPI_OK_UPDATE)
+  {
+	  elog(ERROR, "could not update data in: %s", table_restore);
+  }
+
+  /* done */
+  return SPI_processed;
+}
+
+int __table_log_restore_table_delete(SPITupleTable *spi_tuptable, char *table_restore,
+									  char *table_orig_pkey, char *col_query_start,
+									  int col_pkey, int number_columns, int i) {
+	int   ret;
+	char *tmp;
+
+	/* memory for dynamic query */
+	StringInfo d_query;
+
+	/* get the size of value */
+	tmp = SPI_getvalue(spi_tuptable->vals[i], spi_tuptable->tupdesc, col_pkey);
+
+	if (tmp == NULL)
+	{
+		elog(ERROR, "pkey cannot be NULL");
+	}
+
+	/* initalize StringInfo structure */
+	d_query = makeStringInfo();
+
+	/* build query */
+	appendStringInfo(d_query,
+					 "DELETE FROM %s WHERE %s=%s",
+					 do_quote_ident(table_restore),
+					 do_quote_ident(table_orig_pkey),
+					 do_quote_literal(tmp));
+
+	elog(DEBUG3, "query: %s", d_query->data);
+
+	ret = SPI_exec(d_query->data, 0);
+
+	if (ret != SPI_OK_DELETE)
+	{
+		elog(ERROR, "could not delete data from: %s", table_restore);
+	}
+
+  /* done */
+  return SPI_processed;
+}
+
+int __table_log_restore_table_truncate(char *table_restore) {
+	int   ret;
+
+	/* memory for dynamic query */
+	StringInfo d_query;
+
+	/* initalize StringInfo structure */
+	d_query = makeStringInfo();
+
+	/* build query, a single key restore contains only this key anyway */
+	appendStringInfo(d_query,
+					 "DELETE FROM %s",
+					 do_quote_ident(table_restore));
+
+	elog(DEBUG3, "query: %s", d_query->data);
+
+	ret = SPI_exec(d_query->data, 0);
+
+	if (ret != SPI_OK_DELETE)
+	{
+		elog(ERROR, "could not delete data from: %s", table_restore);
+	}
+
+  /* done */
+  return SPI_processed;
+}
+
+/*
+ * table_log_shmem_size()
+ * Size of the shared memory needed for the statistics.
+ */
+static Size table_log_shmem_size(void)
+{
+	Size size;
+
+	size = MAXALIGN(sizeof(TableLogSharedState));
+	size = add_size(size, hash_estimate_size(table_log_stats_max,
+											 sizeof(TableLogStatsEntry)));
+	size = add_size(size, mul_size(table_log_max_restores,
+								   sizeof(TableLogRestoreProgress)));
+
+	return size;
+}
+
+/*
+ * table_log_shmem_request()
+ * Request the shared memory and the lock for the statistics.
+ */
+static void table_log_shmem_request(void)
+{
+#if PG_VERSION_NUM >= 150000
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+#endif
+
+	RequestAddinShmemSpace(table_log_shmem_size());
+#if PG_VERSION_NUM >= 90600
+	RequestNamedLWLockTranche("table_log", 1);
+#else
+	RequestAddinLWLocks(1);
+#endif
+}
+
+/*
+ * table_log_shmem_startup()
+ * Allocate or attach to the shared memory for the statistics.
+ */
+static void table_log_shmem_startup(void)
+{
+	bool     found;
+	HASHCTL  info;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	table_log_shared = NULL;
+	table_log_stats_hash = NULL;
+	table_log_progress = NULL;
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	table_log_shared = ShmemInitStruct("table_log",
+									   sizeof(TableLogSharedState),
+									   &found);
+
+	if (!found)
+	{
+#if PG_VERSION_NUM >= 90600
+		table_log_shared->lock = &(GetNamedLWLockTranche("table_log"))->lock;
+#else
+		table_log_shared->lock = LWLockAssign();
+#endif
+	}
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(TableLogStatsKey);
+	info.entrysize = sizeof(TableLogStatsEntry);
+	table_log_stats_hash = ShmemInitHash("table_log stats",
+										 table_log_stats_max,
+										 table_log_stats_max,
+										 &info,
+										 HASH_ELEM | HASH_BLOBS);
+
+	table_log_progress = ShmemInitStruct("table_log progress",
+										 mul_size(table_log_max_restores,
+												  sizeof(TableLogRestoreProgress)),
+										 &found);
+
+	if (!found)
+	{
+		int i;
+
+		for (i = 0; i < table_log_max_restores; i++)
+		{
+			SpinLockInit(&table_log_progress[i].mutex);
+			table_log_progress[i].pid = 0;
+		}
+	}
+
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * __table_log_stats_entry()
+ * Find or create the statistics entry of relation relid. Returns with
+ * table_log_shared->lock held (exclusive for a new entry), the caller
+ * updates the entry under its spinlock and releases the lock. If the
+ * hash table is full, the relation with the fewest events makes room,
+ * see __table_log_stats_evict(); NULL is only returned (without the
+ * lock) if the shared memory runs out anyway.
+ */
+static TableLogStatsEntry *__table_log_stats_entry(Oid relid)
+{
+	TableLogStatsKey    key;
+	TableLogStatsEntry *entry;
+
+	memset(&key, 0, sizeof(key));
+	key.dbid = MyDatabaseId;
+	key.relid = relid;
+
+	LWLockAcquire(table_log_shared->lock, LW_SHARED);
+
+	entry = (TableLogStatsEntry *) hash_search(table_log_stats_hash, &key, HASH_FIND, NULL);
+
+	if (entry == NULL)
+	{
+		bool found;
+
+		/* need the exclusive lock to create a new entry */
+		LWLockRelease(table_log_shared->lock);
+		LWLockAcquire(table_log_shared->lock, LW_EXCLUSIVE);
+
+		/* another backend may have created it meanwhile */
+		entry = (TableLogStatsEntry *) hash_search(table_log_stats_hash, &key, HASH_FIND, NULL);
+		if (entry == NULL && hash_get_num_entries(table_log_stats_hash) >= table_log_stats_max)
+		{
+			__table_log_stats_evict();
+		}
+
+		entry = (TableLogStatsEntry *) hash_search(table_log_stats_hash, &key, HASH_ENTER_NULL, &found);
+
+		if (entry == NULL)
+		{
+			LWLockRelease(table_log_shared->lock);
+			elog(DEBUG2, "table_log: out of shared memory, relation %u not tracked", relid);
+			return NULL;
+		}
+
+		if (!found)
+		{
+			memset(&entry->counters, 0, sizeof(TableLogCounters));
+			memset(entry->hot_keys, 0, sizeof(entry->hot_keys));
+			memset(entry->rate, 0, sizeof(entry->rate));
+			SpinLockInit(&entry->mutex);
+		}
+	}
+
+	return entry;
+}
+
+/*
+ * __table_log_stats_evict()
+ * Discard the statistics entry with the fewest logged events and restores,
+ * like pg_stat_statements does with its least used entries, so that a new
+ * table is always tracked. Called with table_log_shared->lock held
+ * exclusively.
+ */
+static void __table_log_stats_evict(void)
+{
+	HASH_SEQ_STATUS     hash_seq;
+	TableLogStatsEntry *entry;
+	TableLogStatsEntry *victim = NULL;
+	int64               victim_usage = 0;
+
+	hash_seq_init(&hash_seq, table_log_stats_hash);
+	while ((entry = hash_seq_search(&hash_seq)) != NULL)
+	{
+		volatile TableLogStatsEntry *e = (volatile TableLogStatsEntry *) entry;
+		int64       usage;
+
+		SpinLockAcquire(&e->mutex);
+		usage = e->counters.rows_insert + e->counters.rows_update +
+			e->counters.rows_delete + e->counters.rows_skipped +
+			e->counters.restores;
+		SpinLockRelease(&e->mutex);
+
+		if (victim == NULL || usage < victim_usage)
+		{
+			victim = entry;
+			victim_usage = usage;
+		}
+	}
+
+	if (victim != NULL)
+	{
+		elog(DEBUG2, "table_log: statistics table full, discarding relation %u", victim->key.relid);
+		hash_search(table_log_stats_hash, &victim->key, HASH_REMOVE, NULL);
+	}
+}
+
+/*
+ * __table_log_stats_add()
+ * Add the counters in delta to the statistics of relation relid, and the
+ * logged events to the current bucket of the change rate.
+ * Does nothing if the module is not preloaded or tracking is off.
+ */
+static void __table_log_stats_add(Oid relid, TableLogCounters *delta)
+{
+	TableLogStatsEntry *entry;
+	int64               changes;
+	int64               bucket = 0;
+
+	if (!table_log_shared || !table_log_stats_hash || !table_log_track_stats)
+		return;
+
+	if (!OidIsValid(relid))
+		return;
+
+	changes = delta->rows_insert + delta->rows_update + delta->rows_delete;
+	if (changes > 0 || delta->bytes_logged > 0)
+	{
+		bucket = GetCurrentTimestamp() / (USECS_PER_SEC * table_log_change_rate_interval);
+	}
+
+	entry = __table_log_stats_entry(relid);
+	if (entry == NULL)
+		return;
+
+	{
+		volatile TableLogStatsEntry *e = (volatile TableLogStatsEntry *) entry;
+
+		SpinLockAcquire(&e->mutex);
+		e->counters.rows_insert += delta->rows_insert;
+		e->counters.rows_update += delta->rows_update;
+		e->counters.rows_delete += delta->rows_delete;
+		e->counters.rows_skipped += delta->rows_skipped;
+		e->counters.bytes_logged += delta->bytes_logged;
+		e->counters.log_time += delta->log_time;
+		if (e->counters.log_max_time < delta->log_max_time)
+			e->counters.log_max_time = delta->log_max_time;
+		e->counters.restores += delta->restores;
+		e->counters.restore_time += delta->restore_time;
+		if (e->counters.restore_max_time < delta->restore_max_time)
+			e->counters.restore_max_time = delta->restore_max_time;
+		if (bucket > 0)
+		{
+			volatile TableLogRateBucket *b = &e->rate[bucket % TABLE_LOG_RATE_BUCKETS];
+
+			if (b->bucket != bucket)
+			{
+				/* the slot still holds an older bucket, start over */
+				b->bucket = bucket;
+				b->changes = 0;
+				b->bytes_logged = 0;
+			}
+			b->changes += changes;
+			b->bytes_logged += delta->bytes_logged;
+		}
+		SpinLockRelease(&e->mutex);
+	}
+
+	LWLockRelease(table_log_shared->lock);
+}
+
+/*
+ * __table_log_key_columns_invalidate()
+ * Relcache invalidation callback: forget the primary key columns of the
+ * table (of all tables for InvalidOid), the next change looks them up
+ * again.
+ */
+static void __table_log_key_columns_invalidate(Datum arg, Oid relid)
+{
+	HASH_SEQ_STATUS     status;
+	TableLogKeyColumns *cols;
+
+	if (table_log_key_columns == NULL)
+		return;
+
+	if (OidIsValid(relid))
+	{
+		hash_search(table_log_key_columns, &relid, HASH_REMOVE, NULL);
+		return;
+	}
+
+	hash_seq_init(&status, table_log_key_columns);
+	while ((cols = (TableLogKeyColumns *) hash_seq_search(&status)) != NULL)
+	{
+		hash_search(table_log_key_columns, &cols->relid, HASH_REMOVE, NULL);
+	}
+}
+
+/*
+ * __table_log_key_columns()
+ * The primary key columns of a relation, looked up once per backend and
+ * kept until the relation changes, instead of scanning the indexes of
+ * the relation for every logged row.
+ */
+static TableLogKeyColumns *__table_log_key_columns(Relation rel)
+{
+	TableLogKeyColumns *cols;
+	Oid                 relid = RelationGetRelid(rel);
+	List               *keys;
+	ListCell           *lc;
+	bool                found;
+
+	if (table_log_key_columns == NULL)
+	{
+		HASHCTL        ctl;
+
+		memset(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(Oid);
+		ctl.entrysize = sizeof(TableLogKeyColumns);
+		table_log_key_columns = hash_create("table_log key columns", 64, &ctl,
+											HASH_ELEM | HASH_BLOBS);
+		CacheRegisterRelcacheCallback(__table_log_key_columns_invalidate, (Datum) 0);
+	}
+
+	cols = (TableLogKeyColumns *) hash_search(table_log_key_columns, &relid, HASH_FIND, NULL);
+	if (cols != NULL)
+		return cols;
+
+	/* look up before the entry exists, an error leaves nothing behind */
+	keys = __table_log_pkey_columns(rel);
+
+	cols = (TableLogKeyColumns *) hash_search(table_log_key_columns, &relid, HASH_ENTER, &found);
+	cols->nkeys = 0;
+	foreach(lc, keys)
+	{
+		cols->attnums[cols->nkeys++] = SPI_fnumber(rel->rd_att, (char *) lfirst(lc));
+	}
+	list_free_deep(keys);
+
+	return cols;
+}
+
+/*
+ * __table_log_stats_key()
+ * Count a change of the row tuple in the hot keys of its relation, see
+ * TableLogHotKey. Rows of tables without a primary key are not counted.
+ */
+static void __table_log_stats_key(Relation rel, HeapTuple tuple)
+{
+	TableLogStatsEntry *entry;
+	TableLogKeyColumns *cols;
+	StringInfoData      buf;
+	uint32              hash;
+	const char         *p;
+	int                 i;
+
+	if (!table_log_shared || !table_log_stats_hash || !table_log_track_stats)
+		return;
+
+	cols = __table_log_key_columns(rel);
+	if (cols->nkeys == 0)
+		return;
+
+	/* the key as text, like the pkey column of table_log_diff() */
+	initStringInfo(&buf);
+	if (cols->nkeys > 1)
+		appendStringInfoChar(&buf, '(');
+	for (i = 0; i < cols->nkeys; i++)
+	{
+		char       *value = SPI_getvalue(tuple, rel->rd_att, cols->attnums[i]);
+
+		if (i > 0)
+			appendStringInfoChar(&buf, ',');
+		appendStringInfoString(&buf, (value != NULL ? value : ""));
+	}
+	if (cols->nkeys > 1)
+		appendStringInfoChar(&buf, ')');
+	if (buf.len >= TABLE_LOG_HOT_KEY_LEN)
+	{
+		buf.len = pg_mbcliplen(buf.data, buf.len, TABLE_LOG_HOT_KEY_LEN - 1);
+		buf.data[buf.len] = '\0';
+	}
+
+	hash = 5381;
+	for (p = buf.data; *p != '\0'; p++)
+		hash = hash * 33 + (unsigned char) *p;
+	if (hash == 0)
+		hash = 1;
+
+	entry = __table_log_stats_entry(RelationGetRelid(rel));
+	if (entry == NULL)
+	{
+		pfree(buf.data);
+		return;
+	}
+
+	{
+		volatile TableLogStatsEntry *e = (volatile TableLogStatsEntry *) entry;
+		int         min_slot = 0;
+
+		SpinLockAcquire(&e->mutex);
+		for (i = 0; i < TABLE_LOG_HOT_KEYS; i++)
+		{
+			if (e->hot_keys[i].hash == hash &&
+				strcmp((const char *) e->hot_keys[i].key, buf.data) == 0)
+				break;
+			if (e->hot_keys[i].count < e->hot_keys[min_slot].count)
+				min_slot = i;
+		}
+
+		if (i < TABLE_LOG_HOT_KEYS)
+		{
+			e->hot_keys[i].count++;
+		}
+		else
+		{
+			/* an unused slot has count 0 and is the minimum */
+			volatile TableLogHotKey *hot = &e->hot_keys[min_slot];
+
+			hot->hash = hash;
+			hot->error = hot->count;
+			hot->count++;
+			strlcpy((char *) hot->key, buf.data, TABLE_LOG_HOT_KEY_LEN);
+		}
+		SpinLockRelease(&e->mutex);
+	}
+
+	LWLockRelease(table_log_shared->lock);
+
+	pfree(buf.data);
+}
+
+/*
+ * __table_log_materialize()
+ * Prepare a set returning function for materialize mode and return the
+ * tuplestore to fill, the result row type is returned in tupdesc.
+ */
+static Tuplestorestate *__table_log_materialize(FunctionCallInfo fcinfo, TupleDesc *tupdesc)
+{
+	ReturnSetInfo   *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	Tuplestorestate *tupstore;
+	MemoryContext    oldcontext;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		elog(ERROR, "set-valued function called in context that cannot accept a set");
+
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		elog(ERROR, "materialize mode required, but it is not allowed in this context");
+
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+
+	if (get_call_result_type(fcinfo, NULL, tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = *tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	return tupstore;
+}
+
+/*
+table_log_stats()
+
+show the statistics collected in shared memory
+
+parameter:
+  none
+return:
+  one row per tracked table
+*/
+Datum table_log_stats(PG_FUNCTION_ARGS)
+{
+	Tuplestorestate    *tupstore;
+	TupleDesc           tupdesc;
+	HASH_SEQ_STATUS     hash_seq;
+	TableLogStatsEntry *entry;
+
+	if (!table_log_shared || !table_log_stats_hash)
+		elog(ERROR, "table_log_stats: table_log must be loaded via shared_preload_libraries");
+
+	tupstore = __table_log_materialize(fcinfo, &tupdesc);
+
+	LWLockAcquire(table_log_shared->lock, LW_SHARED);
+
+	hash_seq_init(&hash_seq, table_log_stats_hash);
+	while ((entry = hash_seq_search(&hash_seq)) != NULL)
+	{
+		Datum            values[12];
+		bool             nulls[12];
+		TableLogCounters tmp;
+		int              i = 0;
+
+		/* copy the counters, so we don't hold the spinlock too long */
+		{
+			volatile TableLogStatsEntry *e = (volatile TableLogStatsEntry *) entry;
+
+			SpinLockAcquire(&e->mutex);
+			tmp = e->counters;
+			SpinLockRelease(&e->mutex);
+		}
+
+		memset(nulls, 0, sizeof(nulls));
+		values[i++] = ObjectIdGetDatum(entry->key.dbid);
+		values[i++] = ObjectIdGetDatum(entry->key.relid);
+		values[i++] = Int64GetDatum(tmp.rows_insert);
+		values[i++] = Int64GetDatum(tmp.rows_update);
+		values[i++] = Int64GetDatum(tmp.rows_delete);
+		values[i++] = Int64GetDatum(tmp.rows_skipped);
+		values[i++] = Int64GetDatum(tmp.bytes_logged);
+		values[i++] = Float8GetDatum(tmp.log_time);
+		values[i++] = Float8GetDatum(tmp.log_max_time);
+		values[i++] = Int64GetDatum(tmp.restores);
+		values[i++] = Float8GetDatum(tmp.restore_time);
+		values[i++] = Float8GetDatum(tmp.restore_max_time);
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	LWLockRelease(table_log_shared->lock);
+
+	return (Datum) 0;
+}
+
+/*
+table_log_stats_reset()
+
+discard all statistics collected so far
+
+parameter:
+  none
+return:
+  none
+*/
+Datum table_log_stats_reset(PG_FUNCTION_ARGS)
+{
+	HASH_SEQ_STATUS     hash_seq;
+	TableLogStatsEntry *entry;
+
+	if (!table_log_shared || !table_log_stats_hash)
+		elog(ERROR, "table_log_stats_reset: table_log must be loaded via shared_preload_libraries");
+
+	LWLockAcquire(table_log_shared->lock, LW_EXCLUSIVE);
+
+	hash_seq_init(&hash_seq, table_log_stats_hash);
+	while ((entry = hash_seq_search(&hash_seq)) != NULL)
+	{
+		hash_search(table_log_stats_hash, &entry->key, HASH_REMOVE, NULL);
+	}
+
+	LWLockRelease(table_log_shared->lock);
+
+	PG_RETURN_VOID();
+}
+
+/*
+table_log_hot_keys()
+
+show the most often changed primary keys of every table, collected with
+table_log.track_hot_keys
+
+parameter:
+  none
+return:
+  one row per tracked key: the key as text, the counted changes and the
+  maximum overestimation of the count
+*/
+Datum table_log_hot_keys(PG_FUNCTION_ARGS)
+{
+	Tuplestorestate    *tupstore;
+	TupleDesc           tupdesc;
+	HASH_SEQ_STATUS     hash_seq;
+	TableLogStatsEntry *entry;
+
+	if (!table_log_shared || !table_log_stats_hash)
+		elog(ERROR, "table_log_hot_keys: table_log must be loaded via shared_preload_libraries");
+
+	tupstore = __table_log_materialize(fcinfo, &tupdesc);
+
+	LWLockAcquire(table_log_shared->lock, LW_SHARED);
+
+	hash_seq_init(&hash_seq, table_log_stats_hash);
+	while ((entry = hash_seq_search(&hash_seq)) != NULL)
+	{
+		TableLogHotKey   tmp[TABLE_LOG_HOT_KEYS];
+		int              i;
+
+		/* copy the keys, so we don't hold the spinlock too long */
+		{
+			volatile TableLogStatsEntry *e = (volatile TableLogStatsEntry *) entry;
+
+			SpinLockAcquire(&e->mutex);
+			memcpy(tmp, (const void *) e->hot_keys, sizeof(tmp));
+			SpinLockRelease(&e->mutex);
+		}
+
+		for (i = 0; i < TABLE_LOG_HOT_KEYS; i++)
+		{
+			Datum            values[5];
+			bool             nulls[5];
+
+			if (tmp[i].count == 0)
+				continue;
+
+			memset(nulls, 0, sizeof(nulls));
+			values[0] = ObjectIdGetDatum(entry->key.dbid);
+			values[1] = ObjectIdGetDatum(entry->key.relid);
+			values[2] = CStringGetTextDatum(tmp[i].key);
+			values[3] = Int64GetDatum(tmp[i].count);
+			values[4] = Int64GetDatum(tmp[i].error);
+
+			tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+		}
+	}
+
+	LWLockRelease(table_log_shared->lock);
+
+	return (Datum) 0;
+}
+
+/*
+table_log_change_rate()
+
+show the logged changes of every table per table_log.change_rate_interval
+(a minute by default), over the last 60 intervals
+
+parameter:
+  none
+return:
+  one row per table and interval with changes: the start of the
+  interval, the logged events and the size of the logged values
+*/
+Datum table_log_change_rate(PG_FUNCTION_ARGS)
+{
+	Tuplestorestate    *tupstore;
+	TupleDesc           tupdesc;
+	HASH_SEQ_STATUS     hash_seq;
+	TableLogStatsEntry *entry;
+	int64               current;
+
+	if (!table_log_shared || !table_log_stats_hash)
+		elog(ERROR, "table_log_change_rate: table_log must be loaded via shared_preload_libraries");
+
+	tupstore = __table_log_materialize(fcinfo, &tupdesc);
+
+	current = GetCurrentTimestamp() / (USECS_PER_SEC * table_log_change_rate_interval);
+
+	LWLockAcquire(table_log_shared->lock, LW_SHARED);
+
+	hash_seq_init(&hash_seq, table_log_stats_hash);
+	while ((entry = hash_seq_search(&hash_seq)) != NULL)
+	{
+		TableLogRateBucket tmp[TABLE_LOG_RATE_BUCKETS];
+		int                i;
+
+		/* copy the buckets, so we don't hold the spinlock too long */
+		{
+			volatile TableLogStatsEntry *e = (volatile TableLogStatsEntry *) entry;
+
+			SpinLockAcquire(&e->mutex);
+			memcpy(tmp, (const void *) e->rate, sizeof(tmp));
+			SpinLockRelease(&e->mutex);
+		}
+
+		for (i = 0; i < TABLE_LOG_RATE_BUCKETS; i++)
+		{
+			Datum            values[5];
+			bool             nulls[5];
+
+			/* unused, or older than the ring */
+			if (tmp[i].bucket <= current - TABLE_LOG_RATE_BUCKETS)
+				continue;
+
+			memset(nulls, 0, sizeof(nulls));
+			values[0] = ObjectIdGetDatum(entry->key.dbid);
+			values[1] = ObjectIdGetDatum(entry->key.relid);
+			values[2] = TimestampTzGetDatum((TimestampTz) (tmp[i].bucket * USECS_PER_SEC * table_log_change_rate_interval));
+			values[3] = Int64GetDatum(tmp[i].changes);
+			values[4] = Int64GetDatum(tmp[i].bytes_logged);
+
+			tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+		}
+	}
+
+	LWLockRelease(table_log_shared->lock);
+
+	return (Datum) 0;
+}
+
+/*
+ * __table_log_restore_phase()
+ * Finish the current phase of a restore and start the next one.
+ * Passing TABLE_LOG_PHASE_INIT just finishes the current phase.
+ */
+static void __table_log_restore_phase(TableLogRestoreState *state, int phase)
+{
+	instr_time now;
+	instr_time elapsed;
+
+	INSTR_TIME_SET_CURRENT(now);
+	elapsed = now;
+	INSTR_TIME_SUBTRACT(elapsed, state->phase_start);
+	state->phase_time[state->phase] += INSTR_TIME_GET_MILLISEC(elapsed);
+	state->phase_start = now;
+	state->phase = phase;
+
+	TABLE_LOG_RESTORE_PHASE(state->relid, table_log_phase_names[phase]);
+
+	if (state->progress != NULL)
+	{
+		volatile TableLogRestoreProgress *p = state->progress;
+
+		SpinLockAcquire(&p->mutex);
+		p->phase = phase;
+		SpinLockRelease(&p->mutex);
+	}
+}
+
+/*
+ * __table_log_progress_begin()
+ * Get a free progress slot in shared memory for a new restore.
+ * If the module is not preloaded or all slots are in use, the restore
+ * runs without progress reporting.
+ */
+static void __table_log_progress_begin(TableLogRestoreState *state, Oid relid)
+{
+	int i;
+
+	state->progress = NULL;
+
+	if (!table_log_shared || !table_log_progress)
+		return;
+
+	if (!table_log_progress_exit_registered)
+	{
+		on_shmem_exit(__table_log_progress_exit, (Datum) 0);
+		table_log_progress_exit_registered = true;
+	}
+
+	LWLockAcquire(table_log_shared->lock, LW_EXCLUSIVE);
+
+	for (i = 0; i < table_log_max_restores; i++)
+	{
+		volatile TableLogRestoreProgress *p = &table_log_progress[i];
+
+		if (p->pid != 0)
+			continue;
+
+		SpinLockAcquire(&p->mutex);
+		p->pid = MyProcPid;
+		p->dbid = MyDatabaseId;
+		p->relid = relid;
+		p->phase = TABLE_LOG_PHASE_INIT;
+		p->log_rows_total = 0;
+		p->log_rows_processed = 0;
+		p->rows_written = 0;
+		p->started = GetCurrentTimestamp();
+		SpinLockRelease(&p->mutex);
+
+		state->progress = &table_log_progress[i];
+		break;
+	}
+
+	LWLockRelease(table_log_shared->lock);
+
+	if (state->progress == NULL)
+		elog(DEBUG2, "table_log: no free progress slot, increase table_log.max_restores");
+
+	table_log_my_progress = state->progress;
+}
+
+/*
+ * __table_log_progress_total()
+ * Set the number of log entries the restore has to replay.
+ */
+static void __table_log_progress_total(TableLogRestoreState *state, int64 total)
+{
+	volatile TableLogRestoreProgress *p = state->progress;
+
+	state->log_rows_total = total;
+
+	if (p == NULL)
+		return;
+
+	SpinLockAcquire(&p->mutex);
+	p->log_rows_total = total;
+	SpinLockRelease(&p->mutex);
+}
+
+/*
+ * __table_log_progress_update()
+ * Report the log entries replayed and the rows written so far.
+ */
+static void __table_log_progress_update(TableLogRestoreState *state, int64 processed, int64 written)
+{
+	volatile TableLogRestoreProgress *p = state->progress;
+
+	state->log_rows_processed = processed;
+	state->rows_written = written;
+
+	if (p == NULL)
+		return;
+
+	SpinLockAcquire(&p->mutex);
+	p->log_rows_processed = processed;
+	p->rows_written = written;
+	SpinLockRelease(&p->mutex);
+}
+
+/*
+ * __table_log_progress_end()
+ * Release the progress slot of a finished (or failed) restore.
+ */
+static void __table_log_progress_end(TableLogRestoreState *state)
+{
+	volatile TableLogRestoreProgress *p = state->progress;
+
+	if (p == NULL)
+		return;
+
+	SpinLockAcquire(&p->mutex);
+	p->pid = 0;
+	SpinLockRelease(&p->mutex);
+
+	state->progress = NULL;
+	table_log_my_progress = NULL;
+}
+
+/*
+ * __table_log_progress_exit()
+ * Release the progress slot if the backend exits during a restore.
+ */
+static void __table_log_progress_exit(int code, Datum arg)
+{
+	volatile TableLogRestoreProgress *p = table_log_my_progress;
+
+	if (p == NULL)
+		return;
+
+	SpinLockAcquire(&p->mutex);
+	if (p->pid == MyProcPid)
+		p->pid = 0;
+	SpinLockRelease(&p->mutex);
+
+	table_log_my_progress = NULL;
+}
+
+/*
+table_log_restore_progress()
+
+show the progress of all running restores
+
+parameter:
+  none
+return:
+  one row per running restore
+*/
+Datum table_log_restore_progress(PG_FUNCTION_ARGS)
+{
+	Tuplestorestate    *tupstore;
+	TupleDesc           tupdesc;
+	int                 i;
+
+	if (!table_log_shared || !table_log_progress)
+		elog(ERROR, "table_log_restore_progress: table_log must be loaded via shared_preload_libraries");
+
+	tupstore = __table_log_materialize(fcinfo, &tupdesc);
+
+	for (i = 0; i < table_log_max_restores; i++)
+	{
+		volatile TableLogRestoreProgress *p = &table_log_progress[i];
+		TableLogRestoreProgress tmp;
+		Datum                   values[8];
+		bool                    nulls[8];
+
+		SpinLockAcquire(&p->mutex);
+		tmp = *p;
+		SpinLockRelease(&p->mutex);
+
+		if (tmp.pid == 0)
+			continue;
+
+		memset(nulls, 0, sizeof(nulls));
+		values[0] = Int32GetDatum(tmp.pid);
+		values[1] = ObjectIdGetDatum(tmp.dbid);
+		values[2] = ObjectIdGetDatum(tmp.relid);
+		values[3] = CStringGetTextDatum(table_log_phase_names[tmp.phase]);
+		values[4] = Int64GetDatum(tmp.log_rows_total);
+		values[5] = Int64GetDatum(tmp.log_rows_processed);
+		values[6] = Int64GetDatum(tmp.rows_written);
+		values[7] = TimestampTzGetDatum(tmp.started);
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	return (Datum) 0;
+}
+
+/*
+table_log_rewind()
+
+undo all changes made to a logged table after a timestamp in the past
+
+only the log entries after the timestamp are read: for every key the
+first of these entries is the state of the row at the timestamp, an
+'old' entry is written back into the table, a 'new' entry means the
+row did not exist and is deleted. The changes go through the triggers
+of the table, so the rewind itself is logged again.
+
+parameter:
+  - the logged table
+  - timestamp in past
+return:
+  - number of changed rows in the table
+*/
+Datum table_log_rewind(PG_FUNCTION_ARGS)
+{
+	Oid            relid;
+	Oid            log_relid;
+	Datum          timestamp;
+	Relation       rel;
+	List           *pkey;
+	ListCell       *lc;
+	char           *table_orig;
+	char           *table_log;
+	StringInfo     col_list;      /* all columns */
+	StringInfo     col_list_net;  /* all columns, from the net changes */
+	StringInfo     set_list;      /* SET for the UPDATE */
+	StringInfo     pkey_list;     /* primary key columns */
+	StringInfo     pkey_join;     /* join condition between table and net changes */
+	StringInfo     bulk_open;     /* entries of a bulk mode window open at the timestamp */
+	StringInfo     query;
+	Oid            argtypes[1] = { TIMESTAMPTZOID };
+	Datum          values[1];
+	int            ret;
+	int            i;
+	bool           isnull;
+	int64          changed;
 
-	if (ret != SPI_OK_SELECT)
-	{
-		elog(ERROR, "could not check relation: %s", table_orig);
-	}
+	elog(DEBUG2, "start table_log_rewind()");
 
-	if (SPI_processed == 0)
+	if (PG_ARGISNULL(0) || PG_ARGISNULL(1))
 	{
-		elog(ERROR, "could not check relation: %s", table_orig);
+		elog(ERROR, "table_log_rewind: table and timestamp must not be NULL");
 	}
+	relid = PG_GETARG_OID(0);
+	timestamp = PG_GETARG_DATUM(1);
 
-	elog(DEBUG2, "original table: OK (%i columns)", table_orig_columns);
+	rel = heap_open(relid, AccessShareLock);
 
-	/* check log table */
-	resetStringInfo(query);
-	appendStringInfo(query,
-					 "SELECT a.attname FROM pg_class c, pg_attribute a WHERE c.relname = %s AND a.attnum > 0 AND a.attrelid = c.oid ORDER BY a.attnum",
-					 do_quote_literal(table_log));
+	table_log = __table_log_logged_table(rel, "table_log_rewind", &pkey, true, &log_relid);
+	table_orig = __table_log_relation_name(rel);
 
-	elog(DEBUG3, "query: %s", query->data);
+	col_list = makeStringInfo();
+	col_list_net = makeStringInfo();
+	set_list = makeStringInfo();
+	for (i = 0; i < rel->rd_att->natts; i++)
+	{
+		char       *col;
 
-	ret = SPI_exec(query->data, 0);
+		if (rel->rd_att->attrs[i]->attisdropped)
+		{
+			continue;
+		}
 
-	if (ret != SPI_OK_SELECT)
-	{
-		elog(ERROR, "could not check relation [1]: %s", table_log);
+		col = do_quote_ident(NameStr(rel->rd_att->attrs[i]->attname));
+		appendStringInfo(col_list, "%s%s", (col_list->len > 0 ? ", " : ""), col);
+		appendStringInfo(col_list_net, "%sn.%s", (col_list_net->len > 0 ? ", " : ""), col);
+		appendStringInfo(set_list, "%s%s = n.%s", (set_list->len > 0 ? ", " : ""), col, col);
 	}
 
-	if (SPI_processed > 0)
+	pkey_list = makeStringInfo();
+	pkey_join = makeStringInfo();
+	foreach(lc, pkey)
 	{
-		table_log_columns = SPI_processed;
-	} else {
-		elog(ERROR, "could not check relation [2]: %s", table_log);
-	}
-
-	/* check pkey in log table */
-	resetStringInfo(query);
-	appendStringInfo(query,
-					 "SELECT a.attname FROM pg_class c, pg_attribute a WHERE c.relname=%s AND c.relkind='r' AND a.attname=%s AND a.attnum > 0 AND a.attrelid = c.oid",
-					 do_quote_literal(table_log), do_quote_literal(table_log_pkey));
+		char       *col = do_quote_ident((char *) lfirst(lc));
 
-	elog(DEBUG3, "query: %s", query->data);
+		appendStringInfo(pkey_list, "%s%s", (pkey_list->len > 0 ? ", " : ""), col);
+		appendStringInfo(pkey_join, "%so.%s = n.%s", (pkey_join->len > 0 ? " AND " : ""), col, col);
+	}
 
-	ret = SPI_exec(query->data, 0);
+	heap_close(rel, NoLock);
 
-	if (ret != SPI_OK_SELECT)
+	ret = SPI_connect();
+	if (ret != SPI_OK_CONNECT)
 	{
-		elog(ERROR, "could not check relation [3]: %s", table_log);
+		elog(ERROR, "table_log_rewind: SPI_connect returned %d", ret);
 	}
 
-	if (SPI_processed == 0)
+	__table_log_check_archive(log_relid, timestamp, false, "table_log_rewind");
+
+	/* no concurrent changes while the net changes are applied */
+	query = makeStringInfo();
+	appendStringInfo(query, "LOCK TABLE %s IN SHARE ROW EXCLUSIVE MODE", table_orig);
+	ret = SPI_exec(query->data, 0);
+	if (ret != SPI_OK_UTILITY)
 	{
-		elog(ERROR, "could not check relation [4]: %s", table_log);
+		elog(ERROR, "could not lock table %s", table_orig);
 	}
 
-	elog(DEBUG3, "log table: OK (%i columns)", table_log_columns);
+	/* the rows at the timestamp of a bulk mode window open then */
+	bulk_open = makeStringInfo();
+	__table_log_append_bulk_open(bulk_open, relid, 0, "$1");
 
-	/* check restore table */
+	/*
+	 * one statement: all parts see the same snapshot and the log is read
+	 * only once, the DELETE, UPDATE and INSERT work on disjoint keys
+	 */
 	resetStringInfo(query);
 	appendStringInfo(query,
-					 "SELECT pg_attribute.attname AS a FROM pg_class, pg_attribute WHERE pg_class.relname=%s AND pg_attribute.attnum > 0 AND pg_attribute.attrelid=pg_class.oid",
-					 do_quote_literal(table_restore));
-
+					 "WITH net AS ("
+					 "SELECT DISTINCT ON (%s) %s, trigger_tuple FROM %s l "
+					 "WHERE (trigger_changed > $1 OR %s) AND NOT (trigger_mode = 'TRUNCATE' AND trigger_tuple = 'new') "
+					 "ORDER BY %s, trigger_id), "
+					 "d AS (DELETE FROM %s o USING net n WHERE %s AND n.trigger_tuple = 'new' RETURNING 1), "
+					 "u AS (UPDATE %s o SET %s FROM net n WHERE %s AND n.trigger_tuple = 'old' RETURNING 1), "
+					 "i AS (INSERT INTO %s (%s) SELECT %s FROM net n WHERE n.trigger_tuple = 'old' "
+					 "AND NOT EXISTS (SELECT 1 FROM %s o WHERE %s) RETURNING 1) "
+					 "SELECT (SELECT count(*) FROM d) + (SELECT count(*) FROM u) + (SELECT count(*) FROM i)",
+					 pkey_list->data, col_list->data, table_log, bulk_open->data, pkey_list->data,
+					 table_orig, pkey_join->data,
+					 table_orig, set_list->data, pkey_join->data,
+					 table_orig, col_list->data, col_list_net->data,
+					 table_orig, pkey_join->data);
 	elog(DEBUG3, "query: %s", query->data);
 
-	ret = SPI_exec(query->data, 0);
-
-	if (ret != SPI_OK_SELECT)
+	values[0] = timestamp;
+	ret = SPI_execute_with_args(query->data, 1, argtypes, values, NULL, false, 0);
+	if (ret != SPI_OK_SELECT || SPI_processed != 1)
 	{
-		elog(ERROR, "could not check relation: %s", table_restore);
+		elog(ERROR, "could not rewind table %s", table_orig);
 	}
 
-	if (SPI_processed > 0)
-	{
-		elog(ERROR, "restore table already exists: %s", table_restore);
-	}
+	changed = DatumGetInt64(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull));
 
-	elog(DEBUG2, "restore table: OK (doesnt exists)");
+	SPI_finish();
 
-	/* now get all columns from original table */
-	resetStringInfo(query);
-	appendStringInfo(query,
-					 "SELECT a.attname, format_type(a.atttypid, a.atttypmod), a.attnum FROM pg_class c, pg_attribute a WHERE c.relname = %s AND a.attnum > 0 AND a.attrelid = c.oid ORDER BY a.attnum",
-					 do_quote_literal(table_orig));
+	PG_RETURN_INT64(changed);
+}
 
-	elog(DEBUG3, "query: %s", query->data);
+/*
+table_log_diff()
 
-	ret = SPI_exec(query->data, 0);
+net changes of a logged table between two timestamps
 
-	if (ret != SPI_OK_SELECT)
-	{
-		elog(ERROR, "could not get columns from relation: %s", table_orig);
-	}
+only the log entries in (t1, t2] are read, in a single scan. For every
+changed key the first entry gives the state at t1 (an 'old' entry is the
+row, a 'new' entry means the row did not exist), the last entry the
+state at t2. Keys inserted and deleted again, and rows updated back to
+their old values, are not returned.
 
-	if (SPI_processed == 0)
+parameter:
+  - the logged table
+  - start timestamp (t1)
+  - end timestamp (t2)
+return:
+  - one row per changed key: operation (INSERT, UPDATE, DELETE), key,
+    the row at t1 and the row at t2 (in text form, can be cast to the
+    row type of the table), the rows are NULL for a keys_only log table
+*/
+Datum table_log_diff(PG_FUNCTION_ARGS)
+{
+	Oid            relid;
+	Oid            log_relid;
+	Relation       rel;
+	TableLogTriggerInfo info;
+	List           *pkey;
+	ListCell       *lc;
+	char           *table_orig;
+	char           *table_log;
+	StringInfo     row_expr;      /* the logged row, as row of the table */
+	StringInfo     pkey_list;     /* primary key columns */
+	StringInfo     bulk_open;     /* entries of a bulk mode window open at t1 */
+	StringInfo     bulk_open_end; /* and at t2 */
+	StringInfo     query;
+	Oid            argtypes[2] = { TIMESTAMPTZOID, TIMESTAMPTZOID };
+	Datum          args[2];
+	Portal         portal;
+	Tuplestorestate *tupstore;
+	TupleDesc      tupdesc;
+	int            ret;
+	int            i;
+
+	elog(DEBUG2, "start table_log_diff()");
+
+	if (PG_ARGISNULL(0) || PG_ARGISNULL(1) || PG_ARGISNULL(2))
 	{
-		elog(ERROR, "could not check relation: %s", table_orig);
+		elog(ERROR, "table_log_diff: table and timestamps must not be NULL");
 	}
+	relid = PG_GETARG_OID(0);
+	args[0] = PG_GETARG_DATUM(1);
+	args[1] = PG_GETARG_DATUM(2);
 
-	results = SPI_processed;
+	tupstore = __table_log_materialize(fcinfo, &tupdesc);
 
-	/* store number columns for later */
-	number_columns = SPI_processed;
+	rel = heap_open(relid, AccessShareLock);
 
-	elog(DEBUG2, "number columns: %i", results);
+	table_log = __table_log_logged_table(rel, "table_log_diff", &pkey, false, &log_relid);
+	table_orig = __table_log_relation_name(rel);
+	__table_log_find_trigger(rel, &info);
 
-	for (i = 0; i < results; i++)
+	row_expr = makeStringInfo();
+	if (info.keys_only == 1)
 	{
-		/* the column name */
-		tmp = SPI_getvalue(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 1);
-
-		/* now check, if this is the pkey */
-		if (strcmp((const char *)tmp, (const char *)table_orig_pkey) == 0)
+		/* only the keys are logged, every UPDATE counts */
+		appendStringInfoString(row_expr, "NULL::text");
+	}
+	else
+	{
+		appendStringInfoString(row_expr, "ROW(");
+		for (i = 0; i < rel->rd_att->natts; i++)
 		{
-			/* remember the (real) number */
-			col_pkey = i + 1;
+			if (rel->rd_att->attrs[i]->attisdropped)
+			{
+				continue;
+			}
+
+			appendStringInfo(row_expr, "%sl.%s", (row_expr->len > 4 ? ", " : ""),
+							 do_quote_ident(NameStr(rel->rd_att->attrs[i]->attname)));
 		}
+		appendStringInfo(row_expr, ")::%s::text", table_orig);
 	}
 
-	/* check if we have found the pkey */
-	if (col_pkey == 0)
+	pkey_list = makeStringInfo();
+	foreach(lc, pkey)
 	{
-		elog(ERROR, "cannot find pkey (%s) in table %s", table_orig_pkey, table_orig);
+		appendStringInfo(pkey_list, "%sl.%s", (pkey_list->len > 0 ? ", " : ""),
+						 do_quote_ident((char *) lfirst(lc)));
 	}
 
-	/* allocate memory for string */
-	col_query = makeStringInfo();
+	heap_close(rel, NoLock);
 
-	for (i = 0; i < results; i++)
+	ret = SPI_connect();
+	if (ret != SPI_OK_CONNECT)
 	{
-		if (i > 0)
-			appendStringInfo(col_query, ", ");
-
-		appendStringInfo(col_query, "%s",
-						 do_quote_ident(SPI_getvalue(SPI_tuptable->vals[i],
-													 SPI_tuptable->tupdesc, 1)));
+		elog(ERROR, "table_log_diff: SPI_connect returned %d", ret);
 	}
 
-	/* create restore table */
-	elog(DEBUG2, "string for columns: %s", col_query->data);
-	elog(DEBUG2, "create restore table: %s", table_restore);
-	resetStringInfo(query);
-	appendStringInfo(query, "SELECT * INTO ");
+	__table_log_check_archive(log_relid, args[0], false, "table_log_diff");
 
-	/* per default create a temporary table */
-	if (not_temporarly == 0)
-	{
-		appendStringInfo(query, "TEMPORARY ");
-	}
+	/*
+	 * a bulk mode window open at t1 has the rows at t1 in its 'old'
+	 * snapshot, one opened after t1 and still open at t2 changed nothing
+	 */
+	bulk_open = makeStringInfo();
+	__table_log_append_bulk_open(bulk_open, relid, 0, "$1");
+	bulk_open_end = makeStringInfo();
+	__table_log_append_bulk_open(bulk_open_end, relid, 0, "$2");
 
-	/* from which table? */
-	appendStringInfo(query, "TABLE %s FROM %s ", table_restore, table_orig);
+	/* first and last entry per key, from one pass over the log range */
+	query = makeStringInfo();
+	appendStringInfo(query,
+					 "SELECT CASE WHEN first_tuple = 'new' THEN 'INSERT' "
+					 "WHEN last_tuple = 'old' THEN 'DELETE' ELSE 'UPDATE' END, pkey, "
+					 "CASE WHEN first_tuple = 'old' THEN first_row END, "
+					 "CASE WHEN last_tuple = 'new' THEN last_row END "
+					 "FROM (SELECT DISTINCT ON (%s) %s%s%s AS pkey, "
+					 "first_value(l.trigger_tuple) OVER w AS first_tuple, "
+					 "first_value(%s) OVER w AS first_row, "
+					 "last_value(l.trigger_tuple) OVER w AS last_tuple, "
+					 "last_value(%s) OVER w AS last_row "
+					 "FROM %s l WHERE ((l.trigger_changed > $1 AND l.trigger_changed <= $2) OR %s) "
+					 "AND NOT (l.trigger_changed > $1 AND %s) "
+					 "AND NOT (l.trigger_mode = 'TRUNCATE' AND l.trigger_tuple = 'new') "
+					 "WINDOW w AS (PARTITION BY %s ORDER BY l.trigger_id "
+					 "ROWS BETWEEN UNBOUNDED PRECEDING AND UNBOUNDED FOLLOWING) "
+					 "ORDER BY %s) s "
+					 "WHERE NOT (first_tuple = 'new' AND last_tuple = 'old') "
+					 "AND NOT (first_tuple = 'old' AND last_tuple = 'new' AND coalesce(first_row = last_row, false))",
+					 pkey_list->data,
+					 (list_length(pkey) > 1 ? "ROW(" : ""), pkey_list->data,
+					 (list_length(pkey) > 1 ? ")::text" : "::text"),
+					 row_expr->data, row_expr->data,
+					 table_log, bulk_open->data, bulk_open_end->data,
+					 pkey_list->data, pkey_list->data);
+	elog(DEBUG3, "query: %s", query->data);
 
-	if (need_search_pkey == 1)
-	{
-		/* only extract a specific key */
-		appendStringInfo(query, "WHERE %s = %s ",
-						 do_quote_ident(table_orig_pkey),
-						 do_quote_literal(search_pkey));
-	}
+	portal = SPI_cursor_open_with_args(NULL, query->data, 2, argtypes, args, NULL, true, 0);
 
-	if (method == 0)
+	for (;;)
 	{
-		/* restore from begin (blank table) */
-		appendStringInfo(query, "LIMIT 0");
-	}
+		SPI_cursor_fetch(portal, true, 1000);
+		if (SPI_processed == 0)
+		{
+			break;
+		}
 
-	elog(DEBUG3, "query: %s", query->data);
+		for (i = 0; i < SPI_processed; i++)
+		{
+			Datum          values[4];
+			bool           nulls[4];
+			int            col;
 
-	ret = SPI_exec(query->data, 0);
+			for (col = 0; col < 4; col++)
+			{
+				values[col] = SPI_getbinval(SPI_tuptable->vals[i], SPI_tuptable->tupdesc,
+											col + 1, &nulls[col]);
+			}
 
-	if (ret != SPI_OK_SELINTO)
-	{
-		elog(ERROR, "could not check relation: %s", table_restore);
+			tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+		}
+
+		SPI_freetuptable(SPI_tuptable);
 	}
 
-	if (method == 1)
-		elog(DEBUG2, "%i rows copied", SPI_processed);
+	SPI_cursor_close(portal);
+	SPI_finish();
 
-	/* get timestamp as string */
-	timestamp_string = DatumGetCString(DirectFunctionCall1(timestamptz_out, timestamp));
+	return (Datum) 0;
+}
 
-	if (method == 0)
-		elog(DEBUG2, "need logs from start to timestamp: %s", timestamp_string);
-	else
-		elog(DEBUG2, "need logs from end to timestamp: %s", timestamp_string);
+/*
+table_log_as_of()
 
-	/* now build query for getting logs */
-	elog(DEBUG2, "build query for getting logs");
+the rows of a logged table at a timestamp in the past, without a
+restore table
 
-	/* allocate memory for string and build query */
-	d_query = makeStringInfo();
-	appendStringInfo(d_query,
-					 "SELECT %s, trigger_mode, trigger_tuple, trigger_changed FROM %s WHERE ",
-					 col_query->data, do_quote_ident(table_log));
+the same rule as in table_log_rewind(): for every key changed after the
+timestamp the first later log entry is the state of the row, an 'old'
+entry is the row, a 'new' entry means the row did not exist. All other
+rows are read from the table itself. Both parts are read in one
+statement, so a change and its log entry are always seen together and
+no lock is needed. Nothing is written, only the result set spills to
+temporary files when it is larger than work_mem.
 
-	if (method == 0)
-	{
-		/* from start to timestamp */
-		appendStringInfo(d_query, "trigger_changed <= %s",
-						 do_quote_literal(timestamp_string));
-	}
-	else
-	{
-		/* from now() backwards to timestamp */
-		appendStringInfo(d_query, "trigger_changed >= %s ",
-						 do_quote_literal(timestamp_string));
-	}
+parameter:
+  - a value of the row type of the logged table, usually NULL::tablename
+  - timestamp in past
+return:
+  - the rows of the table at the timestamp
+*/
+Datum table_log_as_of(PG_FUNCTION_ARGS)
+{
+	Oid            relid;
+	Oid            log_relid;
+	Datum          timestamp;
+	Relation       rel;
+	List           *pkey;
+	ListCell       *lc;
+	char           *table_orig;
+	char           *table_log;
+	StringInfo     col_list;      /* all columns */
+	StringInfo     pkey_list;     /* primary key columns */
+	StringInfo     pkey_join;     /* join condition between table and log */
+	StringInfo     bulk_open;     /* entries of a bulk mode window open at the timestamp */
+	StringInfo     query;
+	Oid            argtypes[1] = { TIMESTAMPTZOID };
+	Datum          args[1];
+	Portal         portal;
+	Tuplestorestate *tupstore;
+	TupleDesc      tupdesc;
+	Datum          *values;
+	bool           *nulls;
+	int            ret;
+	int            i;
 
-	if (need_search_pkey == 1)
-	{
-		appendStringInfo(d_query, "AND %s = %s ",
-						 do_quote_ident(table_orig_pkey),
-						 do_quote_literal(search_pkey));
-	}
+	elog(DEBUG2, "start table_log_as_of()");
 
-	if (method == 0)
+	relid = get_typ_typrelid(get_fn_expr_argtype(fcinfo->flinfo, 0));
+	if (!OidIsValid(relid))
 	{
-		appendStringInfo(d_query, "ORDER BY %s ASC",
-						 do_quote_ident(table_log_pkey));
+		elog(ERROR, "table_log_as_of: first argument must be of the row type of a table");
 	}
-	else
+	if (PG_ARGISNULL(1))
 	{
-		appendStringInfo(d_query, "ORDER BY %s DESC",
-						 do_quote_ident(table_log_pkey));
+		elog(ERROR, "table_log_as_of: timestamp must not be NULL");
 	}
+	timestamp = PG_GETARG_DATUM(1);
 
-	elog(DEBUG3, "query: %s", d_query->data);
+	tupstore = __table_log_materialize(fcinfo, &tupdesc);
+	values = (Datum *) palloc(tupdesc->natts * sizeof(Datum));
+	nulls = (bool *) palloc(tupdesc->natts * sizeof(bool));
 
-	ret = SPI_exec(d_query->data, 0);
+	rel = heap_open(relid, AccessShareLock);
 
-	if (ret != SPI_OK_SELECT)
-	{
-		elog(ERROR, "could not get log data from table: %s", table_log);
-	}
+	table_log = __table_log_logged_table(rel, "table_log_as_of", &pkey, true, &log_relid);
+	table_orig = __table_log_relation_name(rel);
 
-	elog(DEBUG2, "number log entries to restore: %i", SPI_processed);
+	col_list = makeStringInfo();
+	for (i = 0; i < rel->rd_att->natts; i++)
+	{
+		if (rel->rd_att->attrs[i]->attisdropped)
+		{
+			continue;
+		}
 
-	results = SPI_processed;
-	/* save results */
-	spi_tuptable = SPI_tuptable;
+		appendStringInfo(col_list, "%s%s", (col_list->len > 0 ? ", " : ""),
+						 do_quote_ident(NameStr(rel->rd_att->attrs[i]->attname)));
+	}
 
-	/* go through all results */
-	for (i = 0; i < results; i++)
+	pkey_list = makeStringInfo();
+	pkey_join = makeStringInfo();
+	foreach(lc, pkey)
 	{
+		char       *col = do_quote_ident((char *) lfirst(lc));
 
-		/* get tuple data */
-		trigger_mode = SPI_getvalue(spi_tuptable->vals[i], spi_tuptable->tupdesc, number_columns + 1);
-		trigger_tuple = SPI_getvalue(spi_tuptable->vals[i], spi_tuptable->tupdesc, number_columns + 2);
-		trigger_changed = SPI_getvalue(spi_tuptable->vals[i], spi_tuptable->tupdesc, number_columns + 3);
+		appendStringInfo(pkey_list, "%s%s", (pkey_list->len > 0 ? ", " : ""), col);
+		appendStringInfo(pkey_join, "%so.%s = l.%s", (pkey_join->len > 0 ? " AND " : ""), col, col);
+	}
 
-		/* check for update tuples we doesnt need */
-		if (strcmp((const char *)trigger_mode, (const char *)"UPDATE") == 0)
-		{
-			if (method == 0 && strcmp((const char *)trigger_tuple, (const char *)"old") == 0)
-			{
-				/* we need the old value of the pkey for the update */
-				old_pkey_string = SPI_getvalue(spi_tuptable->vals[i], spi_tuptable->tupdesc, col_pkey);
-				elog(DEBUG2, "tuple old pkey: %s", old_pkey_string);
+	heap_close(rel, NoLock);
 
-				/* then skip this tuple */
-				continue;
-			}
+	ret = SPI_connect();
+	if (ret != SPI_OK_CONNECT)
+	{
+		elog(ERROR, "table_log_as_of: SPI_connect returned %d", ret);
+	}
 
-			if (method == 1 && strcmp((const char *)trigger_tuple, (const char *)"new") == 0)
-			{
-				/* we need the old value of the pkey for the update */
-				old_pkey_string = SPI_getvalue(spi_tuptable->vals[i], spi_tuptable->tupdesc, col_pkey);
-				elog(DEBUG2, "tuple: old pkey: %s", old_pkey_string);
+	__table_log_check_archive(log_relid, timestamp, false, "table_log_as_of");
 
-				/* then skip this tuple */
-				continue;
-			}
-		}
+	/* the rows at the timestamp of a bulk mode window open then */
+	bulk_open = makeStringInfo();
+	__table_log_append_bulk_open(bulk_open, relid, 0, "$1");
 
-		if (method == 0)
-		{
-			/* roll forward */
-			elog(DEBUG2, "tuple: %s  %s  %s", trigger_mode, trigger_tuple, trigger_changed);
+	/* unchanged rows from the table, changed rows from their first later log entry */
+	query = makeStringInfo();
+	appendStringInfo(query,
+					 "SELECT %s FROM %s o WHERE NOT EXISTS (SELECT 1 FROM %s l "
+					 "WHERE (l.trigger_changed > $1 OR %s) AND %s) "
+					 "UNION ALL "
+					 "SELECT %s FROM (SELECT DISTINCT ON (%s) %s, trigger_tuple FROM %s l "
+					 "WHERE (trigger_changed > $1 OR %s) AND NOT (trigger_mode = 'TRUNCATE' AND trigger_tuple = 'new') "
+					 "ORDER BY %s, trigger_id) n WHERE n.trigger_tuple = 'old'",
+					 col_list->data, table_orig, table_log, bulk_open->data, pkey_join->data,
+					 col_list->data, pkey_list->data, col_list->data, table_log, bulk_open->data,
+					 pkey_list->data);
+	elog(DEBUG3, "query: %s", query->data);
 
-			if (strcmp((const char *)trigger_mode, (const char *)"INSERT") == 0)
-			{
-				__table_log_restore_table_insert(spi_tuptable, table_restore, table_orig_pkey, col_query->data, col_pkey, number_columns, i);
-			}
-			else if (strcmp((const char *)trigger_mode, (const char *)"UPDATE") == 0)
-			{
-				__table_log_restore_table_update(spi_tuptable, table_restore, table_orig_pkey, col_query->data, col_pkey, number_columns, i, old_pkey_string);
-			}
-			else if (strcmp((const char *)trigger_mode, (const char *)"DELETE") == 0)
-			{
-				__table_log_restore_table_delete(spi_tuptable, table_restore, table_orig_pkey, col_query->data, col_pkey, number_columns, i);
-			}
-			else
-			{
-				elog(ERROR, "unknown trigger_mode: %s", trigger_mode);
-			}
+	args[0] = timestamp;
+	portal = SPI_cursor_open_with_args(NULL, query->data, 1, argtypes, args, NULL, true, 0);
 
+	for (;;)
+	{
+		SPI_cursor_fetch(portal, true, 1000);
+		if (SPI_processed == 0)
+		{
+			break;
 		}
-		else
+
+		for (i = 0; i < SPI_processed; i++)
 		{
-			/* roll back */
-			char rb_mode[10]; /* reverse the method */
+			int            col;
+			int            natts = SPI_tuptable->tupdesc->natts;
+			int            out = 0;
 
-			if (strcmp((const char *)trigger_mode, (const char *)"INSERT") == 0)
-			{
-				sprintf(rb_mode, "DELETE");
-			}
-			else if (strcmp((const char *)trigger_mode, (const char *)"UPDATE") == 0)
-			{
-				sprintf(rb_mode, "UPDATE");
-			}
-			else if (strcmp((const char *)trigger_mode, (const char *)"DELETE") == 0)
-			{
-				sprintf(rb_mode, "INSERT");
-			}
-			else
+			/* the result row type still has the dropped columns */
+			for (col = 0; col < tupdesc->natts; col++)
 			{
-				elog(ERROR, "unknown trigger_mode: %s", trigger_mode);
+				if (tupdesc->attrs[col]->attisdropped)
+				{
+					values[col] = (Datum) 0;
+					nulls[col] = true;
+					continue;
+				}
+				if (out >= natts)
+				{
+					elog(ERROR, "table_log_as_of: row type of table %s changed", table_orig);
+				}
+				values[col] = SPI_getbinval(SPI_tuptable->vals[i], SPI_tuptable->tupdesc,
+											++out, &nulls[col]);
 			}
 
-			elog(DEBUG2, "tuple: %s  %s  %s", rb_mode, trigger_tuple, trigger_changed);
-
-			if (strcmp((const char *)trigger_mode, (const char *)"INSERT") == 0)
-			{
-				__table_log_restore_table_delete(spi_tuptable, table_restore, table_orig_pkey, col_query->data, col_pkey, number_columns, i);
-			}
-			else if (strcmp((const char *)trigger_mode, (const char *)"UPDATE") == 0)
-			{
-				__table_log_restore_table_update(spi_tuptable, table_restore, table_orig_pkey, col_query->data, col_pkey, number_columns, i, old_pkey_string);
-			}
-			else if (strcmp((const char *)trigger_mode, (const char *)"DELETE") == 0)
-			{
-				__table_log_restore_table_insert(spi_tuptable, table_restore, table_orig_pkey, col_query->data, col_pkey, number_columns, i);
-			}
+			tuplestore_putvalues(tupstore, tupdesc, values, nulls);
 		}
+
+		SPI_freetuptable(SPI_tuptable);
 	}
 
-	/* close SPI connection */
+	SPI_cursor_close(portal);
 	SPI_finish();
 
-	elog(DEBUG2, "table_log_restore_table() done, results in: %s", table_restore);
+	return (Datum) 0;
+}
 
-	/* convert string to VarChar for result */
-	return_name = DatumGetVarCharP(DirectFunctionCall2(varcharin, CStringGetDatum(table_restore), Int32GetDatum(strlen(table_restore) + VARHDRSZ)));
+/*
+table_log_restore_submit()
 
-	/* and return the name of the restore table */
-	PG_RETURN_VARCHAR_P(return_name);
-}
+run a restore as a job in a background worker
 
-void __table_log_restore_table_insert(SPITupleTable *spi_tuptable, char *table_restore,
-									  char *table_orig_pkey, char *col_query_start,
-									  int col_pkey, int number_columns, int i) {
-	int            j;
-	int            ret;
-	char          *tmp;
+the job is stored in table_log_job and started by a dynamic background
+worker, which waits for the commit of the submitting transaction. The
+restore table is always a normal (not temporary) table.
 
-	/* memory for dynamic query */
-	StringInfo     d_query;
+parameter:
+  - see table_log_restore_table(), without <dont create temporary table>
+return:
+  - the job id
+*/
+Datum table_log_restore_submit(PG_FUNCTION_ARGS)
+{
+	TableLogRestoreArgs     args;
+	TableLogJobExtra        extra;
+	BackgroundWorker        worker;
+	BackgroundWorkerHandle *handle;
+	Oid            argtypes[8] = { TEXTOID, TEXTOID, TEXTOID, TEXTOID, TEXTOID,
+								   TIMESTAMPTZOID, TEXTOID, INT4OID };
+	Datum          values[8];
+	char           nulls[8] = { ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ' };
+	char           *job_table;
+	StringInfo     query;
+	int32          job_id;
+	bool           isnull;
+	int            ret;
 
-	d_query = makeStringInfo();
+	__table_log_restore_args(fcinfo, &args, TABLE_LOG_FILTER_KEY);
 
-	/* build query */
-	appendStringInfo(d_query, "INSERT INTO %s (%s) VALUES (",
-					 do_quote_ident(table_restore),
-					 col_query_start);
+	ret = SPI_connect();
+	if (ret != SPI_OK_CONNECT)
+	{
+		elog(ERROR, "table_log_restore_submit: SPI_connect returned %d", ret);
+	}
 
-	for (j = 1; j <= number_columns; j++)
+	values[0] = CStringGetTextDatum(args.table_orig);
+	values[1] = CStringGetTextDatum(args.table_orig_pkey);
+	values[2] = CStringGetTextDatum(args.table_log);
+	values[3] = CStringGetTextDatum(args.table_log_pkey);
+	values[4] = CStringGetTextDatum(args.table_restore);
+	values[5] = args.timestamp;
+	values[6] = CStringGetTextDatum(args.search_pkey);
+	values[7] = Int32GetDatum(args.method);
+	if (strlen(args.search_pkey) == 0)
 	{
-		if (j > 1)
-		{
-			appendStringInfoString(d_query, ", ");
-		}
+		nulls[6] = 'n';
+	}
 
-		tmp = SPI_getvalue(spi_tuptable->vals[i], spi_tuptable->tupdesc, j);
+	/* the job table is in the schema of the extension, not necessarily in the search_path */
+	job_table = __table_log_extension_table("table_log_job");
+	if (job_table == NULL)
+	{
+		elog(ERROR, "table_log_restore_submit: restore jobs need CREATE EXTENSION table_log");
+	}
 
-		if (tmp == NULL)
-		{
-			appendStringInfoString(d_query, "NULL");
-		}
-		else
-		{
-			appendStringInfoString(d_query, do_quote_literal(tmp));
-		}
+	query = makeStringInfo();
+	appendStringInfo(query,
+					 "INSERT INTO %s (orig_table, orig_pkey, log_table, log_pkey, "
+					 "restore_table, restore_ts, search_pkey, method, search_path) "
+					 "VALUES ($1, $2, $3, $4, $5, $6, $7, $8, current_setting('search_path')) "
+					 "RETURNING job_id",
+					 job_table);
+
+	ret = SPI_execute_with_args(query->data, 8, argtypes, values, nulls, false, 1);
+	if (ret != SPI_OK_INSERT_RETURNING || SPI_processed != 1)
+	{
+		elog(ERROR, "table_log_restore_submit: could not insert into table_log_job");
 	}
 
-	appendStringInfoString(d_query, ")");
-	elog(DEBUG3, "query: %s", d_query->data);
+	job_id = DatumGetInt32(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull));
 
-	ret = SPI_exec(d_query->data, 0);
+	extra.dbid = MyDatabaseId;
+	extra.userid = GetUserId();
+	extra.xid = GetTopTransactionId();
+	extra.job_table = __table_log_relname_relid(job_table);
 
-	if (ret != SPI_OK_INSERT) {
-		elog(ERROR, "could not insert data into: %s", table_restore);
+	SPI_finish();
+
+	memset(&worker, 0, sizeof(worker));
+	worker.bgw_flags = BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION;
+	worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+	worker.bgw_restart_time = BGW_NEVER_RESTART;
+	snprintf(worker.bgw_library_name, BGW_MAXLEN, "table_log");
+	snprintf(worker.bgw_function_name, BGW_MAXLEN, "table_log_restore_worker");
+	snprintf(worker.bgw_name, BGW_MAXLEN, "table_log restore job %d", job_id);
+#if PG_VERSION_NUM >= 110000
+	snprintf(worker.bgw_type, BGW_MAXLEN, "table_log restore job");
+#endif
+	worker.bgw_main_arg = Int32GetDatum(job_id);
+	worker.bgw_notify_pid = 0;
+	memcpy(worker.bgw_extra, &extra, sizeof(extra));
+
+	if (!RegisterDynamicBackgroundWorker(&worker, &handle))
+	{
+		elog(ERROR, "table_log_restore_submit: could not start background worker, increase max_worker_processes");
 	}
 
-	/* done */
+	PG_RETURN_INT32(job_id);
 }
 
-void __table_log_restore_table_update(SPITupleTable *spi_tuptable, char *table_restore,
-									  char *table_orig_pkey, char *col_query_start,
-									  int col_pkey, int number_columns,
-									  int i, char *old_pkey_string) {
-	int   j;
-	int   ret;
-	char *tmp;
-	char *tmp2;
+/*
+table_log_restore_worker()
 
-	/* memory for dynamic query */
-	StringInfo d_query;
+main function of the background worker for a restore job
 
-	d_query = makeStringInfo();
+parameter:
+  - the job id
+return:
+  none
+*/
+void table_log_restore_worker(Datum main_arg)
+{
+	int32                 job_id = DatumGetInt32(main_arg);
+	TableLogJobExtra      extra;
+	TableLogRestoreArgs   args;
+	TableLogRestoreState  state;
+	StringInfo            query;
+	char                 *job_table;
+	char                 *search_path;
+	bool                  isnull;
+	int                   ret;
+
+	memcpy(&extra, MyBgworkerEntry->bgw_extra, sizeof(extra));
+	memset(&args, 0, sizeof(args));
+	memset(&state, 0, sizeof(state));
+
+	/* a cancel request ends the restore, not the worker */
+	pqsignal(SIGINT, StatementCancelHandler);
+	pqsignal(SIGTERM, die);
+	BackgroundWorkerUnblockSignals();
+
+#if PG_VERSION_NUM >= 110000
+	BackgroundWorkerInitializeConnectionByOid(extra.dbid, extra.userid, 0);
+#else
+	BackgroundWorkerInitializeConnectionByOid(extra.dbid, extra.userid);
+#endif
 
-	/* build query */
-	appendStringInfo(d_query, "UPDATE %s SET ",
-					 do_quote_ident(table_restore));
+	/* take over the job, once the submitting transaction is finished */
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+	XactLockTableWait(extra.xid, NULL, NULL, XLTW_None);
 
-	for (j = 1; j <= number_columns; j++)
+	ret = SPI_connect();
+	if (ret != SPI_OK_CONNECT)
 	{
-		if (j > 1)
-		{
-			appendStringInfoString(d_query, ", ");
-		}
+		elog(ERROR, "table_log_restore_worker: SPI_connect returned %d", ret);
+	}
+	PushActiveSnapshot(GetTransactionSnapshot());
 
-		tmp = SPI_getvalue(spi_tuptable->vals[i], spi_tuptable->tupdesc, j);
-		tmp2 = SPI_fname(spi_tuptable->tupdesc, j);
+	query = makeStringInfo();
+	appendStringInfo(query, "%s.%s",
+					 do_quote_ident(get_namespace_name(get_rel_namespace(extra.job_table))),
+					 do_quote_ident(get_rel_name(extra.job_table)));
+	job_table = MemoryContextStrdup(TopMemoryContext, query->data);
 
-		if (tmp == NULL)
-		{
-			appendStringInfo(d_query, "%s=NULL", do_quote_ident(tmp2));
-		}
-		else
-		{
-			appendStringInfo(d_query, "%s=%s",
-							 do_quote_ident(tmp2), do_quote_literal(tmp));
-		}
+	resetStringInfo(query);
+	appendStringInfo(query,
+					 "UPDATE %s SET status = 'running', started = now(), pid = pg_backend_pid() "
+					 "WHERE job_id = %d AND status = 'queued' "
+					 "RETURNING orig_table, orig_pkey, log_table, log_pkey, restore_table, "
+					 "restore_ts, coalesce(search_pkey, ''), method, search_path",
+					 job_table, job_id);
+	ret = SPI_exec(query->data, 0);
+	if (ret != SPI_OK_UPDATE_RETURNING)
+	{
+		elog(ERROR, "table_log_restore_worker: could not start job %d", job_id);
 	}
 
-	appendStringInfo(d_query,
-			 " WHERE %s=%s",
-			 do_quote_ident(table_orig_pkey),
-			 do_quote_literal(old_pkey_string));
+	if (SPI_processed == 0)
+	{
+		/* submitting transaction rolled back, or job cancelled */
+		SPI_finish();
+		PopActiveSnapshot();
+		CommitTransactionCommand();
+		proc_exit(0);
+	}
 
-	elog(DEBUG3, "query: %s", d_query->data);
+	args.table_orig = MemoryContextStrdup(TopMemoryContext, SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1));
+	args.table_orig_pkey = MemoryContextStrdup(TopMemoryContext, SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 2));
+	args.table_log = MemoryContextStrdup(TopMemoryContext, SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 3));
+	args.table_log_pkey = MemoryContextStrdup(TopMemoryContext, SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 4));
+	args.table_restore = MemoryContextStrdup(TopMemoryContext, SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 5));
+	args.timestamp = TimestampTzGetDatum(DatumGetTimestampTz(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 6, &isnull)));
+	args.search_pkey = MemoryContextStrdup(TopMemoryContext, SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 7));
+	args.method = DatumGetInt32(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 8, &isnull));
+	args.not_temporarly = 1;
+	search_path = MemoryContextStrdup(TopMemoryContext, SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 9));
 
-	ret = SPI_exec(d_query->data, 0);
+	SPI_finish();
+	PopActiveSnapshot();
+	CommitTransactionCommand();
 
-  if (ret != SPI_OK_UPDATE)
-  {
-	  elog(ERROR, "could not update data in: %s", table_restore);
-  }
+	/* resolve the table names like the submitting session */
+	SetConfigOption("search_path", search_path, PGC_USERSET, PGC_S_SESSION);
 
-  /* done */
+	pgstat_report_activity(STATE_RUNNING, "table_log restore job");
+
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+	PushActiveSnapshot(GetTransactionSnapshot());
+
+	PG_TRY();
+	{
+		__table_log_restore(&args, &state);
+		__table_log_job_finish(job_table, job_id, "done", &state, NULL);
+
+		PopActiveSnapshot();
+		CommitTransactionCommand();
+	}
+	PG_CATCH();
+	{
+		ErrorData      *edata;
+
+		MemoryContextSwitchTo(TopMemoryContext);
+		edata = CopyErrorData();
+		FlushErrorState();
+		AbortCurrentTransaction();
+
+		/* record the failure in a new transaction */
+		SetCurrentStatementStartTimestamp();
+		StartTransactionCommand();
+		PushActiveSnapshot(GetTransactionSnapshot());
+		__table_log_job_finish(job_table, job_id,
+							   (edata->sqlerrcode == ERRCODE_QUERY_CANCELED ? "cancelled" : "failed"),
+							   &state, edata->message);
+		PopActiveSnapshot();
+		CommitTransactionCommand();
+	}
+	PG_END_TRY();
+
+	pgstat_report_activity(STATE_IDLE, NULL);
+	proc_exit(0);
 }
 
-void __table_log_restore_table_delete(SPITupleTable *spi_tuptable, char *table_restore,
-									  char *table_orig_pkey, char *col_query_start,
-									  int col_pkey, int number_columns, int i) {
-	int   ret;
-	char *tmp;
+/*
+__table_log_job_finish()
 
-	/* memory for dynamic query */
-	StringInfo d_query;
+store the result of a restore job
 
-	/* get the size of value */
-	tmp = SPI_getvalue(spi_tuptable->vals[i], spi_tuptable->tupdesc, col_pkey);
+parameter:
+  - table_log_job (quoted)
+  - the job id
+  - new status
+  - state of the restore
+  - error message, or NULL
+return:
+  none
+*/
+static void __table_log_job_finish(char *job_table, int32 job_id, char *status, TableLogRestoreState *state, char *error)
+{
+	StringInfo     query;
+	Oid            argtypes[9] = { TEXTOID, INT8OID, INT8OID, INT8OID, TEXTOID,
+								   INT4OID, FLOAT8OID, FLOAT8OID, FLOAT8OID };
+	Datum          values[9];
+	char           nulls[9] = { ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ' };
+	int            i;
+	int            ret;
 
-	if (tmp == NULL)
+	ret = SPI_connect();
+	if (ret != SPI_OK_CONNECT)
 	{
-		elog(ERROR, "pkey cannot be NULL");
+		elog(ERROR, "table_log_restore_worker: SPI_connect returned %d", ret);
 	}
 
-	/* initalize StringInfo structure */
-	d_query = makeStringInfo();
-
-	/* build query */
-	appendStringInfo(d_query,
-					 "DELETE FROM %s WHERE %s=%s",
-					 do_quote_ident(table_restore),
-					 do_quote_ident(table_orig_pkey),
-					 do_quote_literal(tmp));
+	values[0] = CStringGetTextDatum(status);
+	values[1] = Int64GetDatum(state->log_rows_total);
+	values[2] = Int64GetDatum(state->log_rows_processed);
+	values[3] = Int64GetDatum(state->rows_written);
+	if (error != NULL)
+	{
+		values[4] = CStringGetTextDatum(error);
+	}
+	else
+	{
+		values[4] = (Datum) 0;
+		nulls[4] = 'n';
+	}
 
-	elog(DEBUG3, "query: %s", d_query->data);
+	/* a restore failing in the catalog checks has no method yet */
+	values[5] = Int32GetDatum(state->method);
+	if (state->method < 0)
+	{
+		nulls[5] = 'n';
+	}
+	values[6] = Float8GetDatum(state->est_log_before);
+	values[7] = Float8GetDatum(state->est_log_after);
+	values[8] = Float8GetDatum(state->est_live_rows);
+	for (i = 6; i < 9; i++)
+	{
+		nulls[i] = (state->estimated ? ' ' : 'n');
+	}
 
-	ret = SPI_exec(d_query->data, 0);
+	query = makeStringInfo();
+	appendStringInfo(query,
+					 "UPDATE %s SET status = $1, finished = now(), log_rows_total = $2, "
+					 "log_rows_processed = $3, rows_written = $4, error = $5, method_used = $6, "
+					 "est_log_before = $7, est_log_after = $8, est_live_rows = $9 WHERE job_id = %d",
+					 job_table, job_id);
 
-	if (ret != SPI_OK_DELETE)
+	ret = SPI_execute_with_args(query->data, 9, argtypes, values, nulls, false, 0);
+	if (ret != SPI_OK_UPDATE)
 	{
-		elog(ERROR, "could not delete data from: %s", table_restore);
+		elog(ERROR, "table_log_restore_worker: could not update job %d", job_id);
 	}
 
-  /* done */
+	SPI_finish();
 }
 
 /*
- * MULTIBYTE dependant internal functions follow
+ * quoting of identifiers and literals
  *
+ * all server encodings are ASCII safe: every byte of a multibyte
+ * character has the high bit set, so a quote or backslash byte is always
+ * a character of its own and the strings can be scanned byte by byte,
+ * without pg_mblen(). The scan looks at a machine word at a time and the
+ * runs without special characters are copied as a whole.
  */
-/* from src/backend/utils/adt/quote.c and slightly modified */
 
-#ifndef MULTIBYTE
+#define TABLE_LOG_WORD_ONES   UINT64CONST(0x0101010101010101)
+#define TABLE_LOG_WORD_HIGHS  UINT64CONST(0x8080808080808080)
 
-/* Return a properly quoted identifier */
-static char * do_quote_ident(char *iptr)
+/*
+ * __table_log_find_special()
+ * Return the first byte in [ptr, end) which is c1 or c2, or end.
+ * A byte of the word w is c exactly if the byte of w ^ (c * ONES) is
+ * zero, (x - ONES) & ~x & HIGHS is not zero if any byte of x is zero.
+ */
+static inline const char *__table_log_find_special(const char *ptr, const char *end, char c1, char c2)
 {
-	char    *result;
-	char    *result_return;
-	int     len;
+	uint64     mask1 = TABLE_LOG_WORD_ONES * (unsigned char) c1;
+	uint64     mask2 = TABLE_LOG_WORD_ONES * (unsigned char) c2;
 
-	len           = strlen(iptr);
-	result        = (char *) palloc(len * 2 + 3);
-	result_return = result;
-	*result++     = '"';
-
-	while (len-- > 0)
+	while (end - ptr >= (ptrdiff_t) sizeof(uint64))
 	{
-		if (*iptr == '"')
-		{
-			*result++ = '"';
-		}
-
-		if (*iptr == '\\')
+		uint64     word;
+		uint64     x1;
+		uint64     x2;
+
+		memcpy(&word, ptr, sizeof(uint64));
+		x1 = word ^ mask1;
+		x2 = word ^ mask2;
+		if ((((x1 - TABLE_LOG_WORD_ONES) & ~x1) | ((x2 - TABLE_LOG_WORD_ONES) & ~x2)) & TABLE_LOG_WORD_HIGHS)
 		{
-			/* just add a backslash, the ' will be follow */
-			*result++ = '\\';
+			break;
 		}
-		*result++ = *iptr++;
+		ptr += sizeof(uint64);
 	}
 
-	*result++ = '"';
-	*result++ = '\0';
+	while (ptr < end && *ptr != c1 && *ptr != c2)
+	{
+		ptr++;
+	}
 
-	return result_return;
+	return ptr;
 }
 
-/* Return a properly quoted literal value */
-static char * do_quote_literal(char *lptr)
+/*
+ * __table_log_append_quoted()
+ * Append str to buf, enclosed in quote. The quote character is doubled,
+ * with escape_backslash backslashes are doubled as well.
+ */
+static void __table_log_append_quoted(StringInfo buf, const char *str, char quote, bool escape_backslash)
 {
-	char    *result;
-	char    *result_return;
-	int     len;
+	size_t      len = strlen(str);
+	const char *end = str + len;
+	const char *ptr = str;
+	char        other = (escape_backslash ? '\\' : quote);
 
-	len           = strlen(lptr);
-	result        = (char *) palloc(len * 2 + 3);
-	result_return = result;
-	*result++     = '\'';
+	/* the usual case has nothing to escape */
+	enlargeStringInfo(buf, len + 3);
 
-	while (len-- > 0)
+	appendStringInfoChar(buf, quote);
+	while (ptr < end)
 	{
-		if (*lptr == '\'')
-		{
-			*result++ = '\\';
-		}
+		const char *special = __table_log_find_special(ptr, end, quote, other);
 
-		if (*lptr == '\\')
+		appendBinaryStringInfo(buf, ptr, special - ptr);
+		if (special == end)
 		{
-			/* just add a backslash, the ' will be follow */
-			*result++ = '\\';
+			break;
 		}
-		*result++ = *lptr++;
+		appendStringInfoChar(buf, *special);
+		appendStringInfoChar(buf, *special);
+		ptr = special + 1;
 	}
-
-	*result++ = '\'';
-	*result++ = '\0';
-
-	return result_return;
+	appendStringInfoChar(buf, quote);
 }
 
-#else
-
-/* Return a properly quoted identifier (MULTIBYTE version) */
-static char * do_quote_ident(char *iptr)
+/*
+ * __table_log_append_literal()
+ * Append a properly quoted literal value to buf. A value with
+ * backslashes is written as E'...', so the literal is read the same
+ * with every setting of standard_conforming_strings.
+ */
+static void __table_log_append_literal(StringInfo buf, const char *lptr)
 {
-	char    *result;
-	char    *result_return;
-	int     len;
-	int     wl;
-
-	len           = strlen(iptr);
-	result        = (char *) palloc(len * 2 + 3);
-	result_return = result;
-	*result++     = '"';
+	bool        backslash = (strchr(lptr, '\\') != NULL);
 
-	while (len > 0)
+	if (backslash)
 	{
-		if ((wl = pg_mblen(iptr)) != 1)
-		{
-			len -= wl;
-
-			while (wl-- > 0)
-			{
-				*result++ = *iptr++;
-			}
-			continue;
-		}
-
-		if (*iptr == '"')
-		{
-			*result++ = '"';
-		}
-
-		if (*iptr == '\\')
-		{
-			/* just add a backslash, the ' will be follow */
-			*result++ = '\\';
-		}
-		*result++ = *iptr++;
-
-		len--;
+		appendStringInfoChar(buf, 'E');
 	}
-
-	*result++ = '"';
-	*result++ = '\0';
-
-	return result_return;
+	__table_log_append_quoted(buf, lptr, '\'', backslash);
 }
 
-/* Return a properly quoted literal value (MULTIBYTE version) */
-static char * do_quote_literal(char *lptr)
+/* Return a properly quoted identifier */
+static char * do_quote_ident(char *iptr)
 {
-	char    *result;
-	char    *result_return;
-	int     len;
-	int     wl;
-
-	len           = strlen(lptr);
-	result        = (char *) palloc(len * 2 + 3);
-	result_return = result;
-	*result++     = '\'';
-
-	while (len > 0)
-	{
-		if ((wl = pg_mblen(lptr)) != 1)
-		{
-			len -= wl;
+	StringInfoData result;
 
-			while (wl-- > 0)
-			{
-				*result++ = *lptr++;
-			}
-			continue;
-		}
+	initStringInfo(&result);
+	__table_log_append_quoted(&result, iptr, '"', false);
 
-		if (*lptr == '\'')
-		{
-			*result++ = '\\';
-		}
+	return result.data;
+}
 
-		if (*lptr == '\\')
-		{
-			/* just add a backslash, the ' will be follow */
-			*result++ = '\\';
-		}
-		*result++ = *lptr++;
+/* Return a properly quoted literal value */
+static char * do_quote_literal(char *lptr)
+{
+	StringInfoData result;
 
-		len--;
-	}
-	*result++ = '\'';
-	*result++ = '\0';
+	initStringInfo(&result);
+	__table_log_append_literal(&result, lptr);
 
-	return result_return;
+	return result.data;
 }
 
-#endif /* MULTIBYTE */
-
 char * __table_log_varcharout(VarChar *s)
 {
 	char *result;
@@ -0,0 +1,45 @@
+/*
+ * table_log_probes.h -- static probes in table_log
+ *
+ *
+ * see table_log_probes.d for the list of probes
+ *
+ * With --enable-dtrace (ENABLE_DTRACE in pg_config.h), the Makefile
+ * generates table_log_probes_dtrace.h from table_log_probes.d, otherwise
+ * the probes compile to nothing (the arguments are still evaluated, so a
+ * variable only passed to a probe is not unused).
+ *
+ */
+#ifndef TABLE_LOG_PROBES_H
+#define TABLE_LOG_PROBES_H
+
+#ifdef ENABLE_DTRACE
+
+#include "table_log_probes_dtrace.h"
+
+#else
+
+#define TABLE_LOG_TRIGGER_START(INT1, INT2) ((void) (INT1), (void) (INT2))
+#define TABLE_LOG_TRIGGER_START_ENABLED() (0)
+#define TABLE_LOG_TRIGGER_ARGS_DONE(INT1) ((void) (INT1))
+#define TABLE_LOG_TRIGGER_ARGS_DONE_ENABLED() (0)
+#define TABLE_LOG_TRIGGER_LOGTABLE_DONE(INT1, INT2) ((void) (INT1), (void) (INT2))
+#define TABLE_LOG_TRIGGER_LOGTABLE_DONE_ENABLED() (0)
+#define TABLE_LOG_TRIGGER_DONE(INT1, INT2, INT3) ((void) (INT1), (void) (INT2), (void) (INT3))
+#define TABLE_LOG_TRIGGER_DONE_ENABLED() (0)
+#define TABLE_LOG_ROW_START(INT1, INT2, INT3) ((void) (INT1), (void) (INT2), (void) (INT3))
+#define TABLE_LOG_ROW_START_ENABLED() (0)
+#define TABLE_LOG_ROW_QUERY_DONE(INT1, INT2, INT3, INT4) ((void) (INT1), (void) (INT2), (void) (INT3), (void) (INT4))
+#define TABLE_LOG_ROW_QUERY_DONE_ENABLED() (0)
+#define TABLE_LOG_ROW_DONE(INT1, INT2, INT3, INT4) ((void) (INT1), (void) (INT2), (void) (INT3), (void) (INT4))
+#define TABLE_LOG_ROW_DONE_ENABLED() (0)
+#define TABLE_LOG_RESTORE_START(INT1, INT2) ((void) (INT1), (void) (INT2))
+#define TABLE_LOG_RESTORE_START_ENABLED() (0)
+#define TABLE_LOG_RESTORE_PHASE(INT1, INT2) ((void) (INT1), (void) (INT2))
+#define TABLE_LOG_RESTORE_PHASE_ENABLED() (0)
+#define TABLE_LOG_RESTORE_DONE(INT1, INT2, INT3) ((void) (INT1), (void) (INT2), (void) (INT3))
+#define TABLE_LOG_RESTORE_DONE_ENABLED() (0)
+
+#endif   /* ENABLE_DTRACE */
+
+#endif   /* TABLE_LOG_PROBES_H */